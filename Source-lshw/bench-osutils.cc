@@ -0,0 +1,216 @@
+#include "osutils.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * times the numeric attribute readers of osutils.cc against the stdio
+ * code they replaced: every line of /proc/bus/pci/devices, the integer
+ * attributes of every PCI device in sysfs, and big-endian cells
+ */
+
+#define PROC_BUS_PCI_DEVICES "/proc/bus/pci/devices"
+#define SYS_BUS_PCI_DEVICES "/sys/bus/pci/devices"
+
+static const struct
+{
+  const char *name;
+  int base;
+} attributes[] =
+{
+  {"vendor", 16},
+  {"device", 16},
+  {"class", 16},
+  {"subsystem_vendor", 16},
+  {"subsystem_device", 16},
+  {"irq", 10},
+  {"current_link_width", 10},
+  {"max_link_width", 10},
+  {NULL, 0},
+};
+
+struct attribute
+{
+  std::string path;
+  int base;
+};
+
+static double now()
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void report(const char *what,
+		   unsigned long count,
+		   double elapsed)
+{
+  char buffer[100];
+
+  snprintf(buffer, sizeof(buffer), "%-32s %8lu %10.3f ms %8.1f ns/item",
+	   what, count, elapsed * 1e3, count ? elapsed * 1e9 / count : 0);
+  std::cout << buffer << std::endl;
+}
+
+static unsigned int parse_devices(const std::vector < std::string > &lines)
+{
+  unsigned int fields = 0;
+
+  for (unsigned int i = 0; i < lines.size(); i++)
+  {
+    const char *p = lines[i].c_str();
+    const char *end = p + lines[i].length();
+    unsigned long long value;
+
+    while (parse_number(p, end, value, 16))
+      fields++;
+  }
+
+  return fields;
+}
+
+static unsigned int scanf_devices(const std::vector < std::string > &lines)
+{
+  unsigned int fields = 0;
+
+  for (unsigned int i = 0; i < lines.size(); i++)
+  {
+    unsigned int dfn, vend, irq;
+    unsigned long long base[7], size[7];
+    int cnt = sscanf(lines[i].c_str(),
+		     "%x %x %x %llx %llx %llx %llx %llx %llx %llx %llx %llx %llx %llx %llx %llx %llx",
+		     &dfn, &vend, &irq,
+		     &base[0], &base[1], &base[2], &base[3],
+		     &base[4], &base[5], &base[6],
+		     &size[0], &size[1], &size[2], &size[3],
+		     &size[4], &size[5], &size[6]);
+
+    if (cnt > 0)
+      fields += cnt;
+  }
+
+  return fields;
+}
+
+static unsigned int read_numbers(const std::vector < attribute > &paths)
+{
+  unsigned int count = 0;
+
+  for (unsigned int i = 0; i < paths.size(); i++)
+  {
+    unsigned long long value;
+
+    if (get_number(paths[i].path, value, paths[i].base))
+      count++;
+  }
+
+  return count;
+}
+
+static unsigned int fscanf_numbers(const std::vector < attribute > &paths)
+{
+  unsigned int count = 0;
+
+  for (unsigned int i = 0; i < paths.size(); i++)
+  {
+    FILE *in = fopen(paths[i].path.c_str(), "r");
+    unsigned long long value;
+
+    if (!in)
+      continue;
+    if (fscanf(in, (paths[i].base == 16) ? "%llx" : "%llu", &value) == 1)
+      count++;
+    fclose(in);
+  }
+
+  return count;
+}
+
+int main(int argc,
+	 char **argv)
+{
+  const char *devices = (argc > 1) ? argv[1] : PROC_BUS_PCI_DEVICES;
+  int rounds = (argc > 2) ? atoi(argv[2]) : 1000;
+  std::vector < std::string > lines;
+  std::vector < std::string > entries;
+  std::vector < attribute > paths;
+  std::vector < unsigned char >cells(4096);
+  unsigned long long sum = 0;
+  unsigned int count = 0;
+  double start;
+
+  if ((argc > 3) || (rounds <= 0))
+  {
+    std::cerr << "usage: " << argv[0] << " [devices [rounds]]" << std::endl;
+    return 1;
+  }
+
+  if (!loadfile(devices, lines) || lines.empty())
+  {
+    std::cerr << argv[0] << ": can't read " << devices << std::endl;
+    return 1;
+  }
+
+  // integer attributes, as many as it takes to have a few thousand
+  listdir(SYS_BUS_PCI_DEVICES, entries);
+  for (unsigned int i = 0; i < entries.size(); i++)
+    for (unsigned int j = 0; attributes[j].name; j++)
+    {
+      attribute a;
+
+      a.path = std::string(SYS_BUS_PCI_DEVICES) + "/" +
+	entries[i] + "/" + attributes[j].name;
+      a.base = attributes[j].base;
+      if (exists(a.path))
+	paths.push_back(a);
+    }
+  while (!paths.empty() && (paths.size() < 4096))
+  {
+    std::vector < attribute > copy = paths;
+
+    paths.insert(paths.end(), copy.begin(), copy.end());
+  }
+
+  start = now();
+  for (int i = 0; i < rounds; i++)
+    count += parse_devices(lines);
+  report("parse_number devices", count, now() - start);
+
+  count = 0;
+  start = now();
+  for (int i = 0; i < rounds; i++)
+    count += scanf_devices(lines);
+  report("sscanf devices", count, now() - start);
+
+  count = 0;
+  start = now();
+  count = read_numbers(paths);
+  report("get_number sysfs", count, now() - start);
+
+  count = 0;
+  start = now();
+  count = fscanf_numbers(paths);
+  report("fscanf sysfs", count, now() - start);
+
+  for (unsigned int i = 0; i < cells.size(); i++)
+    cells[i] = i * 7;
+  count = 0;
+  start = now();
+  for (int i = 0; i < rounds; i++)
+    for (unsigned int j = 0; j + 8 <= cells.size(); j += 4)
+    {
+      sum += get_be(&cells[j], ((j / 4) & 1) ? 8 : 4);
+      count++;
+    }
+  report("get_be cells", count, now() - start);
+
+  // keeps the compiler from dropping the loop above
+  return (sum == 1) ? 2 : 0;
+}
+
+static char *id = "@(#) $Id$";
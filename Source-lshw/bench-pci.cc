@@ -0,0 +1,263 @@
+#include "pci.h"
+#include "hw.h"
+#include "vfs.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * times scan_pci on a synthetic machine: a chain of PCIe switches, each
+ * one a level deeper than the last, with multi-function endpoints on
+ * the side ports, for 4096 functions in all. the sysfs tree is written
+ * to a sysroot archive (see vfs.cc) which is then replayed.
+ */
+
+#define FUNCTIONS 4096
+#define DEPTH 24		/* switches in the chain */
+
+#define SYS_DEVICES "/sys/bus/pci/devices"
+
+#define TYPE_ROOT_PORT 4
+#define TYPE_UPSTREAM 5
+#define TYPE_DOWNSTREAM 6
+#define TYPE_ENDPOINT 0
+
+struct fabric
+{
+  string archive;
+  vector < string > names;
+  unsigned int functions;
+  unsigned int nextbus;
+};
+
+static double now()
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void put16(string & c,
+		  unsigned int offset,
+		  unsigned int value)
+{
+  c[offset] = value & 0xff;
+  c[offset + 1] = (value >> 8) & 0xff;
+}
+
+/*
+ * configuration space with a PCIe capability: x16 Gen4 links, trained
+ * at full speed
+ */
+static string config(unsigned int type,
+		     unsigned int secondary)
+{
+  string c(256, '\0');
+
+  put16(c, 0x00, 0x8086);	// vendor
+  put16(c, 0x02, (type == TYPE_ENDPOINT) ? 0x1572 : 0x37c0);
+  put16(c, 0x04, 0x0006);	// command
+  put16(c, 0x06, 0x0010);	// status: capability list
+  c[0x08] = 1;			// revision
+  if (type == TYPE_ENDPOINT)
+  {
+    c[0x0b] = 0x02;		// ethernet
+    c[0x0e] = 0x80;		// multi-function
+  }
+  else
+  {
+    c[0x0a] = 0x04;		// PCI-to-PCI bridge
+    c[0x0b] = 0x06;
+    c[0x0e] = 0x01;
+    c[0x19] = secondary;
+    c[0x1a] = secondary;
+  }
+  c[0x34] = 0x40;
+
+  c[0x40] = 0x10;		// PCI Express
+  put16(c, 0x42, 0x0002 | (type << 4));
+  put16(c, 0x4c, 0x0104);	// link capabilities: x16, speed 4
+  put16(c, 0x52, 0x0104);	// link status
+  put16(c, 0x6c, 0x001e);	// supported speeds
+
+  return c;
+}
+
+static void add(fabric & f,
+		const string & path,
+		unsigned int bus,
+		unsigned int dev,
+		unsigned int fn,
+		const string & c)
+{
+  char name[20];
+  char header[100];
+
+  snprintf(name, sizeof(name), "0000:%02x:%02x.%d", bus, dev, fn);
+  f.names.push_back(name);
+  f.functions++;
+
+  snprintf(header, sizeof(header), "read 0 %u ", (unsigned int) c.size());
+  f.archive += string(header) + SYS_DEVICES "/" + name + "/config\n";
+  f.archive += c + "\n";
+  f.archive += string("link 0 " SYS_DEVICES "/") + name + "\n";
+  f.archive += "../../../devices/pci0000:00" + path + "/" + name + "\n";
+}
+
+// a downstream port with endpoints behind it
+static void add_leaf(fabric & f,
+		     const string & path,
+		     unsigned int bus,
+		     unsigned int dev,
+		     unsigned int endpoints)
+{
+  unsigned int secondary = f.nextbus++;
+  char name[20];
+  string below;
+
+  snprintf(name, sizeof(name), "/0000:%02x:%02x.0", bus, dev);
+  below = path + name;
+  add(f, path, bus, dev, 0, config(TYPE_DOWNSTREAM, secondary));
+
+  for (unsigned int i = 0; i < endpoints; i++)
+    add(f, below, secondary, i / 8, i % 8, config(TYPE_ENDPOINT, 0));
+}
+
+static string build_fabric(unsigned int &functions)
+{
+  fabric f;
+  string path = "";
+  unsigned int bus = 0;
+  unsigned int dev = 1;
+  unsigned int type = TYPE_ROOT_PORT;
+  unsigned int endpoints = FUNCTIONS - 3 * DEPTH;
+
+  f.functions = 0;
+  f.nextbus = 1;
+
+  // each switch has a port to the next one and one to a bus of
+  // endpoints, which are spread evenly over all the levels
+  for (unsigned int level = 0; level < DEPTH; level++)
+  {
+    unsigned int up = f.nextbus++;
+    unsigned int inside = f.nextbus++;
+    char name[20];
+
+    // the port above the switch, then the switch's upstream port
+    add(f, path, bus, dev, 0, config(type, up));
+    snprintf(name, sizeof(name), "/0000:%02x:%02x.0", bus, dev);
+    path += name;
+    add(f, path, up, 0, 0, config(TYPE_UPSTREAM, inside));
+    snprintf(name, sizeof(name), "/0000:%02x:00.0", up);
+    path += name;
+
+    add_leaf(f, path, inside, 1, endpoints / DEPTH +
+	     ((level < endpoints % DEPTH) ? 1 : 0));
+
+    bus = inside;
+    dev = 0;
+    type = TYPE_DOWNSTREAM;
+  }
+
+  functions = f.functions;
+
+  string result = "lshw-sysroot 1\n";
+  char header[100];
+
+  snprintf(header, sizeof(header), "dir %u " SYS_DEVICES "\n",
+	   (unsigned int) f.names.size());
+  result += header;
+  for (unsigned int i = 0; i < f.names.size(); i++)
+    result += f.names[i] + "\n";
+
+  return result + f.archive;
+}
+
+// devices and bridges below n
+static unsigned int count(hwNode & n)
+{
+  unsigned int result = 0;
+
+  for (unsigned int i = 0; i < n.countChildren(); i++)
+  {
+    hwNode & child = *n.getChild(i);
+
+    if (child.getHandle().substr(0, 3) == "PCI")
+      result++;
+    result += count(child);
+  }
+
+  return result;
+}
+
+int main(int argc,
+	 char **argv)
+{
+  int rounds = (argc > 1) ? atoi(argv[1]) : 5;
+  char archive[] = "/tmp/bench-pci.XXXXXX";
+  unsigned int functions = 0;
+  unsigned int found = 0;
+  double best = 0;
+  string data = build_fabric(functions);
+  int fd = -1;
+
+  if ((argc > 2) || (rounds <= 0))
+  {
+    cerr << "usage: " << argv[0] << " [rounds]" << endl;
+    return 1;
+  }
+
+  fd = mkstemp(archive);
+  if ((fd < 0) || (write(fd, data.data(), data.size()) != (ssize_t) data.size()))
+  {
+    cerr << argv[0] << ": can't write " << archive << endl;
+    return 1;
+  }
+  close(fd);
+
+  if (!vfs_replay(archive))
+  {
+    cerr << argv[0] << ": can't replay " << archive << endl;
+    unlink(archive);
+    return 1;
+  }
+  unlink(archive);
+
+  for (int i = 0; i < rounds; i++)
+  {
+    hwNode computer("computer", hw::system);
+    hwNode *core = NULL;
+    double start = now();
+    double elapsed = 0;
+
+    scan_pci(computer);
+    elapsed = now() - start;
+    if ((i == 0) || (elapsed < best))
+      best = elapsed;
+
+    core = computer.getChild("core");
+    found = 0;
+    for (unsigned int j = 0; core && (j < core->countChildren()); j++)
+      found += count(*core->getChild(j));	// below the host bridges
+  }
+
+  if (found != functions)
+  {
+    cerr << argv[0] << ": " << found << " of " << functions <<
+      " functions placed" << endl;
+    return 1;
+  }
+
+  printf("%u functions, %u switches deep: %.3f ms\n", functions, DEPTH,
+	 best * 1e3);
+
+  return 0;
+}
+
+static char *id = "@(#) $Id$";
@@ -0,0 +1,80 @@
+#include "pcidb.h"
+#include "parallel.h"
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * times the cold-start compilation of a pci.ids file, on one thread and
+ * split in chunks over all the processors (best of a few rounds)
+ */
+
+static double now()
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static double best(const char *filename,
+		   int rounds,
+		   size_t & records)
+{
+  double result = 0;
+
+  for (int i = 0; i < rounds; i++)
+  {
+    double start = now();
+    double elapsed = 0;
+
+    records = pcidb_parse(filename);
+    elapsed = now() - start;
+    if ((i == 0) || (elapsed < result))
+      result = elapsed;
+  }
+
+  return result;
+}
+
+int main(int argc,
+	 char **argv)
+{
+  int rounds = (argc > 2) ? atoi(argv[2]) : 5;
+  size_t serial = 0;
+  size_t chunked = 0;
+  double t1 = 0;
+  double tn = 0;
+  char buffer[100];
+
+  if ((argc < 2) || (argc > 3) || (rounds <= 0))
+  {
+    std::cerr << "usage: " << argv[0] << " pci.ids [rounds]" << std::endl;
+    return 1;
+  }
+
+  parallel_limit(1);
+  t1 = best(argv[1], rounds, serial);
+  parallel_limit(0);
+  tn = best(argv[1], rounds, chunked);
+
+  if ((serial == 0) || (serial != chunked))
+  {
+    std::cerr << argv[0] << ": " << argv[1] << ": " << serial <<
+      " records serially, " << chunked << " in chunks" << std::endl;
+    return 1;
+  }
+
+  snprintf(buffer, sizeof(buffer), "%-10s %2u thread(s) %10.3f ms",
+	   "serial", 1, t1 * 1e3);
+  std::cout << buffer << std::endl;
+  snprintf(buffer, sizeof(buffer), "%-10s %2u thread(s) %10.3f ms  x%.2f",
+	   "chunked", parallel_workers(), tn * 1e3, tn > 0 ? t1 / tn : 0);
+  std::cout << buffer << std::endl;
+  std::cout << serial << " records" << std::endl;
+
+  return 0;
+}
+
+static char *id = "@(#) $Id$";
@@ -1,4 +1,5 @@
 #include "cdrom.h"
+#include "vfs.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -27,25 +28,24 @@ bool scan_cdrom(hwNode & n)
   if (n.getLogicalName() == "")
     return false;
 
-  int fd = open(n.getLogicalName().c_str(), O_RDONLY | O_NONBLOCK);
+  int fd = vfs_open(n.getLogicalName(), O_RDONLY | O_NONBLOCK);
 
   if (fd < 0)
     return false;
 
-  int status = ioctl(fd, CDROM_DRIVE_STATUS, CDSL_CURRENT);
+  int status = vfs_ioctl(fd, CDROM_DRIVE_STATUS, (void *) CDSL_CURRENT);
   if (status < 0)
   {
-    close(fd);
+    vfs_close(fd);
     return false;
   }
 
-  int capabilities = ioctl(fd, CDROM_GET_CAPABILITY);
+  int capabilities = vfs_ioctl(fd, CDROM_GET_CAPABILITY);
+
+  vfs_close(fd);
 
   if (capabilities < 0)
-  {
-    close(fd);
     return false;
-  }
 
   if (capabilities & CDC_PLAY_AUDIO)
     n.addCapability("audio");
@@ -1,65 +1,71 @@
 #include "cpuid.h"
+#include "vfs.h"
+#include "osutils.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/stat.h>
-#include <sys/time.h>
+#include <vector>
+#include <map>
 
-#ifdef __i386__
+#if defined(__i386__) || defined(__x86_64__)
 
-#define cpuid_up(in,a,b,c,d)\
-  asm("cpuid": "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (in));
+#define MHZ_DELAY 20		/* ms for all the threads to get ready */
+#define MHZ_WINDOW 250		/* ms during which the TSCs are counted */
 
-static void cpuid(int cpunumber,
-		  unsigned long idx,
-		  unsigned long &eax,
-		  unsigned long &ebx,
-		  unsigned long &ecx,
-		  unsigned long &edx)
+#define SYS_CPU "/sys/devices/system/cpu"
+
+#define cpuid_up(in,sub,a,b,c,d)\
+  asm("cpuid": "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (in), "c" (sub))
+
+/*
+ * some leaves (4, 0xB, 0x8000001D) describe one of several items, picked
+ * by ecx: the cpuid device takes it in the upper half of the file offset
+ */
+static void cpuid_count(int cpunumber,
+			unsigned long idx,
+			unsigned long sub,
+			unsigned long &eax,
+			unsigned long &ebx,
+			unsigned long &ecx,
+			unsigned long &edx)
 {
   char cpuname[50];
   int fd = -1;
   unsigned char buffer[16];
 
   snprintf(cpuname, sizeof(cpuname), "/dev/cpu/%d/cpuid", cpunumber);
-  fd = open(cpuname, O_RDONLY);
+  fd = vfs_open(cpuname, O_RDONLY);
   if (fd >= 0)
   {
-    lseek(fd, idx, SEEK_CUR);
+    vfs_lseek(fd, (off_t) (((unsigned long long) sub << 32) | idx), SEEK_CUR);
     memset(buffer, 0, sizeof(buffer));
-    read(fd, buffer, sizeof(buffer));
-    close(fd);
-    eax = (*(unsigned long *) buffer);
-    ebx = (*(unsigned long *) (buffer + 4));
-    ecx = (*(unsigned long *) (buffer + 8));
-    edx = (*(unsigned long *) (buffer + 12));
+    vfs_read(fd, buffer, sizeof(buffer));
+    vfs_close(fd);
+    // the registers are 32 bits wide, whatever a long is
+    eax = (*(unsigned int *) buffer);
+    ebx = (*(unsigned int *) (buffer + 4));
+    ecx = (*(unsigned int *) (buffer + 8));
+    edx = (*(unsigned int *) (buffer + 12));
   }
+  else if (!vfs_replaying())
+    cpuid_up(idx, sub, eax, ebx, ecx, edx);
   else
-    cpuid_up(idx, eax, ebx, ecx, edx);
+    eax = ebx = ecx = edx = 0;
 }
 
-static hwNode *getcache(hwNode & node,
-			int n = 0)
+static void cpuid(int cpunumber,
+		  unsigned long idx,
+		  unsigned long &eax,
+		  unsigned long &ebx,
+		  unsigned long &ecx,
+		  unsigned long &edx)
 {
-  char cachename[10];
-  hwNode *cache = NULL;
-
-  if (n < 0)
-    n = 0;
-
-  snprintf(cachename, sizeof(cachename), "cache:%d", n);
-  cache = node.getChild(string(cachename));
-
-  if (cache)
-    return cache;
-
-  // "cache:0" is equivalent to "cache" if we only have L1 cache
-  if ((n == 0) && (node.countChildren(hw::memory) <= 1))
-    cache = node.getChild(string("cache"));
-  if (cache)
-    return cache;
-
-  return node.addChild(hwNode("cache", hw::memory));
+  cpuid_count(cpunumber, idx, 0, eax, ebx, ecx, edx);
 }
 
 /* Decode Intel TLB and cache info descriptors */
@@ -200,19 +206,295 @@ static void decode_intel_tlb(int x,
   }
 }
 
+/*
+ * a cache as CPUID describes it: size is that of one instance, shared by
+ * up to "sharing" logical processors; the package has "instances" of them
+ * (0 when unknown, and then so is the size of them all)
+ */
+struct cpuid_cache
+{
+  int level;
+  const char *type;		// "data", "instruction", "unified" or ""
+  unsigned long long size;
+  unsigned long ways, linesize, sets;
+  unsigned long sharing, instances;
+};
+
+static void cpuid_addcache(vector < cpuid_cache > &caches,
+			   int level,
+			   const char *type,
+			   unsigned long long size,
+			   unsigned long linesize,
+			   unsigned long sharing,
+			   unsigned long instances)
+{
+  cpuid_cache cache;
+
+  if (size == 0)
+    return;
+
+  memset(&cache, 0, sizeof(cache));
+  cache.level = level;
+  cache.type = type;
+  cache.size = size;
+  cache.linesize = linesize;
+  cache.sharing = sharing;
+  cache.instances = instances;
+  caches.push_back(cache);
+}
+
+/*
+ * number of logical processors in the package, to know how many instances
+ * of each cache it holds
+ */
+static unsigned long cpuid_logical(int cpunumber,
+				   unsigned long maxi)
+{
+  unsigned long eax, ebx, ecx, edx, logical = 0;
+
+  if (maxi >= 0xB)
+    for (unsigned long i = 0; i < 8; i++)
+    {
+      cpuid_count(cpunumber, 0xB, i, eax, ebx, ecx, edx);
+      if (((ecx >> 8) & 0xff) == 0)
+	break;
+      if (((ecx >> 8) & 0xff) == 2)	// core level, i.e. the whole package
+	logical = ebx & 0xffff;
+    }
+
+  if ((logical == 0) && (maxi >= 1))
+  {
+    cpuid(cpunumber, 1, eax, ebx, ecx, edx);
+    if (edx & (1 << 28))	// HTT: ebx tells how many there are
+      logical = (ebx >> 16) & 0xff;
+  }
+
+  return logical ? logical : 1;
+}
+
+/*
+ * deterministic cache parameters: Intel leaf 4 and AMD leaf 0x8000001D
+ * share the same layout, one cache per value of ecx
+ */
+static void cpuid_caches(int cpunumber,
+			 unsigned long leaf,
+			 unsigned long logical,
+			 vector < cpuid_cache > &caches)
+{
+  static const char *types[] = { "", "data", "instruction", "unified" };
+  unsigned long eax, ebx, ecx, edx;
+  size_t first = caches.size();
+
+  for (unsigned long i = 0; i < 32; i++)
+  {
+    cpuid_cache cache;
+    bool seen = false;
+
+    cpuid_count(cpunumber, leaf, i, eax, ebx, ecx, edx);
+    if (((eax & 0x1f) == 0) || ((eax & 0x1f) > 3))
+      break;
+
+    memset(&cache, 0, sizeof(cache));
+    cache.level = (eax >> 5) & 7;
+    cache.type = types[eax & 0x1f];
+    cache.ways = ((ebx >> 22) & 0x3ff) + 1;
+    cache.linesize = (ebx & 0xfff) + 1;
+    cache.sets = (ecx & 0xffffffffUL) + 1;
+    cache.size = (unsigned long long) cache.ways *
+      (((ebx >> 12) & 0x3ff) + 1) * cache.linesize * cache.sets;
+    cache.sharing = ((eax >> 14) & 0xfff) + 1;
+    cache.instances = (logical + cache.sharing - 1) / cache.sharing;
+
+    // a cpuid device that ignores ecx returns the first cache again
+    for (size_t j = first; j < caches.size(); j++)
+      if ((caches[j].level == cache.level) && (caches[j].type == cache.type))
+	seen = true;
+    if (seen)
+      break;
+
+    caches.push_back(cache);
+  }
+}
+
+// a 3-bit field, a single digit
+static string cpuid_level(const cpuid_cache & cache)
+{
+  return string(1, '0' + (cache.level & 7));
+}
+
+static void cpuid_setconfig(hwNode & cache,
+			    const string & key,
+			    unsigned long value,
+			    string & fields)
+{
+  char buffer[30];
+
+  if (value == 0)
+    return;
+
+  snprintf(buffer, sizeof(buffer), "%lu", value);
+  cache.setConfig(key, buffer);
+  fields += "," + key;
+}
+
+/*
+ * gives cache the size of the CPUID caches it stands for (all the
+ * instances in the package, left alone when their number is unknown)
+ * and, if it is only one, its geometry; the "cpuid" and "smbios"
+ * configuration entries list where each field of the result came from
+ */
+static void cpuid_merge(hwNode & cache,
+			const vector < const cpuid_cache * >&from)
+{
+  string fromcpuid = "";
+  string fromsmbios = "";
+  unsigned long long size = 0;
+
+  for (size_t i = 0; i < from.size(); i++)
+    size += from[i]->size * from[i]->instances;
+  for (size_t i = 0; i < from.size(); i++)
+    if (from[i]->instances == 0)
+      size = 0;
+
+  if (size != 0)
+  {
+    cache.setSize(size);
+    if (cache.getCapacity() < size)	// can't be right
+      cache.setCapacity(0);
+    fromcpuid += ",size";
+  }
+  else if (cache.getSize() != 0)
+    fromsmbios += ",size";
+
+  if (from.size() == 1)
+  {
+    const cpuid_cache & c = *from[0];
+
+    if ((cache.getConfig("type") == "") && (c.type[0] != '\0'))
+    {
+      cache.setConfig("type", c.type);
+      fromcpuid += ",type";
+    }
+    cpuid_setconfig(cache, "ways", c.ways, fromcpuid);
+    cpuid_setconfig(cache, "linesize", c.linesize, fromcpuid);
+    cpuid_setconfig(cache, "sets", c.sets, fromcpuid);
+    cpuid_setconfig(cache, "threads", c.sharing, fromcpuid);
+    cpuid_setconfig(cache, "instances", c.instances, fromcpuid);
+  }
+
+  if (cache.getCapacity() != 0)
+    fromsmbios += ",capacity";
+  if (cache.getClock() != 0)
+    fromsmbios += ",clock";
+  if (cache.getSlot() != "")
+    fromsmbios += ",slot";
+
+  if (fromcpuid != "")
+    cache.setConfig("cpuid", fromcpuid.substr(1));
+  if (fromsmbios != "")
+    cache.setConfig("smbios", fromsmbios.substr(1));
+}
+
+/*
+ * makes one hierarchy out of the caches SMBIOS put below cpu and those
+ * CPUID reports, matching them by level and type
+ */
+static void cpuid_reconcile(hwNode * cpu,
+			    const vector < cpuid_cache > &caches)
+{
+  vector < hwNode * >known;	// from SMBIOS
+  vector < bool > matched;
+  vector < bool > merged(caches.size(), false);
+
+  for (unsigned int i = 0; i < cpu->countChildren(); i++)
+  {
+    hwNode *child = cpu->getChild(i);
+
+    if (child && (child->getClass() == hw::memory)
+	&& (child->getConfig("level") != ""))
+      known.push_back(child);
+  }
+  matched.resize(known.size(), false);
+
+  // same level and type
+  for (size_t i = 0; i < known.size(); i++)
+    for (size_t j = 0; (j < caches.size()) && !matched[i]; j++)
+      if (!merged[j] && (known[i]->getConfig("type") != "")
+	  && (known[i]->getConfig("type") == caches[j].type)
+	  && (known[i]->getConfig("level") == cpuid_level(caches[j])))
+      {
+	vector < const cpuid_cache * >from(1, &caches[j]);
+
+	cpuid_merge(*known[i], from);
+	matched[i] = merged[j] = true;
+      }
+
+  // same level: SMBIOS often lists a single L1 cache where CPUID has
+  // separate instruction and data caches, it then stands for all of them
+  for (size_t i = 0; i < known.size(); i++)
+  {
+    vector < const cpuid_cache * >from;
+    bool alone = true;
+
+    if (matched[i])
+      continue;
+
+    for (size_t k = 0; k < known.size(); k++)
+      if ((k != i) && !matched[k]
+	  && (known[k]->getConfig("level") == known[i]->getConfig("level")))
+	alone = false;
+
+    for (size_t j = 0; j < caches.size(); j++)
+      if (!merged[j]
+	  && (known[i]->getConfig("level") == cpuid_level(caches[j]))
+	  && (alone || from.empty()))
+      {
+	from.push_back(&caches[j]);
+	merged[j] = true;
+      }
+
+    if (!from.empty())
+    {
+      cpuid_merge(*known[i], from);
+      matched[i] = true;
+    }
+  }
+
+  // whatever is left is only known to CPUID
+  for (size_t j = 0; j < caches.size(); j++)
+    if (!merged[j])
+    {
+      hwNode cache("cache",
+		   hw::memory);
+      vector < const cpuid_cache * >from(1, &caches[j]);
+      string description = "L" + cpuid_level(caches[j]) + " cache";
+
+      if ((caches[j].type[0] != '\0')
+	  && (strcmp(caches[j].type, "unified") != 0))
+	description += " (" + string(caches[j].type) + " cache)";
+      cache.setDescription(description);
+      cache.setConfig("level", cpuid_level(caches[j]));
+      cpuid_merge(cache, from);
+
+      cpu->addChild(cache);
+    }
+}
+
 static bool dointel(unsigned long maxi,
 		    hwNode * cpu,
 		    int cpunumber = 0)
 {
   char buffer[1024];
-  unsigned long signature, eax, ebx, ecx, edx, unused;
-  int stepping, model, family, type, reserved, brand, siblings;
+  unsigned long signature, features = 0, eax, ebx, ecx, edx, unused;
+  int stepping, model, family;
+  vector < cpuid_cache > caches;
 
   if (maxi >= 1)
   {
     cpuid(cpunumber, 1, eax, ebx, ecx, edx);
 
     signature = eax;
+    features = edx;
 
     stepping = eax & 0xf;
     model = (eax >> 4) & 0xf;
@@ -222,13 +504,29 @@ static bool dointel(unsigned long maxi,
     cpu->setVersion(buffer);
   }
 
-  if (maxi >= 2)
+  if (maxi >= 0x16)
+  {
+    // base and maximum clocks (in MHz), when cpufreq didn't give them
+    cpuid(cpunumber, 0x16, eax, ebx, ecx, edx);
+    if (((eax & 0xffff) != 0) && (cpu->getConfig("nominal") == ""))
+    {
+      snprintf(buffer, sizeof(buffer), "%luMHz", eax & 0xffff);
+      cpu->setConfig("nominal", buffer);
+    }
+    if (((ebx & 0xffff) != 0) && (cpu->getCapacity() == 0))
+      cpu->setCapacity((ebx & 0xffff) * 1000000ULL);
+  }
+
+  if (maxi >= 4)
+    cpuid_caches(cpunumber, 4, cpuid_logical(cpunumber, maxi), caches);
+  else if (maxi >= 2)
   {
     /*
      * Decode TLB and cache info 
      */
     int ntlb, i;
     long long l1cache = 0, l2cache = 0;
+    unsigned long logical = cpuid_logical(cpunumber, maxi);
 
     ntlb = 255;
     for (i = 0; i < ntlb; i++)
@@ -262,40 +560,17 @@ static bool dointel(unsigned long maxi,
       }
     }
 
-    if (l1cache != 0)
-    {
-      hwNode *l1 = cpu->getChild("cache:0");
-      hwNode *l2 = cpu->getChild("cache:1");
-
-      if (l1)
-	l1->setSize(l1cache);
-      else
-      {
-	hwNode newl1("cache",
-		     hw::memory);
-
-	newl1.setDescription("L1 cache");
-	newl1.setSize(l1cache);
-
-	cpu->addChild(newl1);
-      }
-      if (l2 && l2cache)
-	l2->setSize(l2cache);
-      else
-      {
-	hwNode newl2("cache",
-		     hw::memory);
-
-	newl2.setDescription("L2 cache");
-	newl2.setSize(l2cache);
-
-	if (l2cache)
-	  cpu->addChild(newl2);
-      }
-    }
+    // the descriptors give the L1 instruction and data caches together.
+    // processors without leaf 4 have a single core, its threads (if
+    // any) share everything
+    cpuid_addcache(caches, 1, "", l1cache, 0, logical, 1);
+    cpuid_addcache(caches, 2, "unified", l2cache, 0, logical, 1);
   }
 
-  if (maxi >= 3)
+  cpuid_reconcile(cpu, caches);
+
+  // processor serial number, if it has one and it is enabled
+  if ((maxi >= 3) && (features & (1 << 18)))
   {
     cpuid(cpunumber, 3, unused, unused, ecx, edx);
 
@@ -307,8 +582,6 @@ static bool dointel(unsigned long maxi,
 
     cpu->setSerial(buffer);
   }
-  else
-    cpu->setSerial("");
 
   return true;
 }
@@ -317,10 +590,11 @@ static bool doamd(unsigned long maxi,
 		  hwNode * cpu,
 		  int cpunumber = 0)
 {
-  unsigned long maxei = 0, eax, ebx, ecx, edx;
-  long long l1cache = 0, l2cache = 0;
+  unsigned long maxei = 0, logical = 0, eax, ebx, ecx, edx;
+  bool topology = false;
   unsigned int family = 0, model = 0, stepping = 0;
   char buffer[1024];
+  vector < cpuid_cache > caches;
 
   if (maxi < 1)
     return false;
@@ -334,52 +608,49 @@ static bool doamd(unsigned long maxi,
 
   cpuid(cpunumber, 0x80000000, maxei, ebx, ecx, edx);
 
-  if (maxei >= 0x80000005)
+  if (maxei >= 0x80000001)
   {
-    cpuid(cpunumber, 0x80000005, eax, ebx, ecx, edx);
-
-    l1cache = (ecx >> 24) * 1024;	// data cache
-    l1cache += (edx >> 24) * 1024;	// instruction cache
+    cpuid(cpunumber, 0x80000001, eax, ebx, ecx, edx);
+    topology = (ecx & (1 << 22)) != 0;	// topology extensions
   }
-  if (maxei >= 0x80000006)
+  if (maxei >= 0x80000008)
   {
-    cpuid(cpunumber, 0x80000006, eax, ebx, ecx, edx);
-
-    l2cache = (ecx >> 16) * 1024;
+    cpuid(cpunumber, 0x80000008, eax, ebx, ecx, edx);
+    logical = (ecx & 0xff) + 1;
   }
+  else
+    logical = cpuid_logical(cpunumber, maxi);
 
-  if (l1cache != 0)
+  if (topology && (maxei >= 0x8000001D))
+    cpuid_caches(cpunumber, 0x8000001D, logical, caches);
+  else
   {
-    hwNode *l1 = cpu->getChild("cache:0");
-    hwNode *l2 = cpu->getChild("cache:1");
-
-    if (l1)
-      l1->setSize(l1cache);
-    else
+    // sizes of the L1 and L2 caches of one core, and of the L3 cache
+    // the cores share. without topology extensions there is no SMT:
+    // every logical processor is a core.
+    if (maxei >= 0x80000005)
     {
-      hwNode newl1("cache",
-		   hw::memory);
-
-      newl1.setDescription("L1 cache");
-      newl1.setSize(l1cache);
+      cpuid(cpunumber, 0x80000005, eax, ebx, ecx, edx);
 
-      cpu->addChild(newl1);
+      cpuid_addcache(caches, 1, "data", (ecx >> 24) * 1024, ecx & 0xff,
+		     1, logical);
+      cpuid_addcache(caches, 1, "instruction", (edx >> 24) * 1024,
+		     edx & 0xff, 1, logical);
     }
-    if (l2 && l2cache)
-      l2->setSize(l2cache);
-    else
+    if (maxei >= 0x80000006)
     {
-      hwNode newl2("cache",
-		   hw::memory);
-
-      newl2.setDescription("L2 cache");
-      newl2.setSize(l2cache);
+      cpuid(cpunumber, 0x80000006, eax, ebx, ecx, edx);
 
-      if (l2cache)
-	cpu->addChild(newl2);
+      cpuid_addcache(caches, 2, "unified", ((ecx >> 16) & 0xffff) * 1024,
+		     ecx & 0xff, 1, logical);
+      cpuid_addcache(caches, 3, "unified",
+		     ((edx >> 18) & 0x3fff) * 512 * 1024ULL, edx & 0xff,
+		     logical, 1);
     }
   }
 
+  cpuid_reconcile(cpu, caches);
+
   return true;
 }
 
@@ -387,7 +658,7 @@ static bool docyrix(unsigned long maxi,
 		    hwNode * cpu,
 		    int cpunumber = 0)
 {
-  unsigned long maxei = 0, eax, ebx, ecx, edx;
+  unsigned long eax, ebx, ecx, edx;
   unsigned int family = 0, model = 0, stepping = 0;
   char buffer[1024];
 
@@ -436,6 +707,7 @@ static hwNode *getcpu(hwNode & node,
     return NULL;
 }
 
+#ifdef __i386__
 static __inline__ bool flag_is_changeable_p(unsigned int flag)
 {
   unsigned int f1, f2;
@@ -450,10 +722,15 @@ static __inline__ bool flag_is_changeable_p(unsigned int flag)
 		    "=&r"(f2):"ir"(flag));
   return ((f1 ^ f2) & flag) != 0;
 }
+#endif
 
 static bool haveCPUID()
 {
+#ifdef __x86_64__
+  return true;			// all 64-bit processors have it
+#else
   return flag_is_changeable_p(0x200000);
+#endif
 }
 
 /*
@@ -464,113 +741,448 @@ static bool haveCPUID()
 
 static __inline__ unsigned long long int rdtsc()
 {
-  unsigned long long int x;
-  __asm__ volatile (".byte 0x0f, 0x31":"=A" (x));
-  return x;
+  unsigned int low, high;
+
+  // not "=A": on x86-64 that is rax alone
+  __asm__ volatile (".byte 0x0f, 0x31":"=a" (low), "=d"(high));
+  return ((unsigned long long int) high << 32) | low;
 }
 
-static float estimate_MHz(int cpunum,
-			  long sleeptime = 250000)
+/*
+ * the TSC of every processor to measure is read at the start and at the
+ * end of the same window, by a thread pinned to it: it costs one window
+ * whatever the number of processors. so are APERF and MPERF, which only
+ * count while the processor runs, at its actual and at its nominal clock
+ */
+struct cpuid_clock
 {
-  struct timezone tz;
-  struct timeval tvstart, tvstop;
-  unsigned long long int cycles[2];	/* gotta be 64 bit */
-  float microseconds;		/* total time taken */
-  unsigned long eax, ebx, ecx, edx;
-  double freq = 1.0f;
+  int node;			// cpu:N the result is for
+  int cpunumber;
+  int sibling;			// clock shared with an SMT sibling, -1 if none
+  bool effective;		// read APERF and MPERF too
+  struct timespec start, stop;	// the window (CLOCK_MONOTONIC)
+  unsigned long long hz;	// 0 if it couldn't be measured
+  unsigned long long aperf, mperf;	// increments, 0 if unknown
+  pthread_t thread;
+  bool running;
+};
+
+#define MSR_IA32_MPERF 0xe7
+#define MSR_IA32_APERF 0xe8
+
+static bool read_msr(int fd,
+		     unsigned long msr,
+		     unsigned long long &value)
+{
+  unsigned char buffer[8];
 
-  /*
-   * Make sure we have a TSC (and hence RDTSC) 
-   */
-  cpuid(cpunum, 1, eax, ebx, ecx, edx);
-  if ((edx & (1 << 4)) == 0)
+  if (vfs_lseek(fd, msr, SEEK_SET) != (off_t) msr)
+    return false;
+  if (vfs_read(fd, buffer, sizeof(buffer)) != sizeof(buffer))
+    return false;
+
+  value = 0;
+  for (int i = 7; i >= 0; i--)
+    value = (value << 8) | buffer[i];
+
+  return true;
+}
+
+static void cpuid_after(struct timespec &t,
+			const struct timespec &from,
+			long ms)
+{
+  t.tv_sec = from.tv_sec + ms / 1000;
+  t.tv_nsec = from.tv_nsec + (ms % 1000) * 1000000L;
+  if (t.tv_nsec >= 1000000000L)
+  {
+    t.tv_sec++;
+    t.tv_nsec -= 1000000000L;
+  }
+}
+
+static void *measure_MHz(void *arg)
+{
+  cpuid_clock *clock = (cpuid_clock *) arg;
+  struct timespec t0, t1;
+  unsigned long long cycles[2];	/* gotta be 64 bit */
+  unsigned long long aperf[2], mperf[2];
+  bool pinned = false, counted = false;
+  long long ns = 0;
+  char msrname[50];
+  int msr = -1;
+  cpu_set_t cpus;
+
+  if ((clock->cpunumber >= 0) && (clock->cpunumber < CPU_SETSIZE))
   {
-    return 0;			// can't estimate frequency
+    CPU_ZERO(&cpus);
+    CPU_SET(clock->cpunumber, &cpus);
+    // the calling thread only: otherwise it might not be that TSC we read
+    pinned = (sched_setaffinity(0, sizeof(cpus), &cpus) == 0);
   }
 
-  memset(&tz, 0, sizeof(tz));
+  // the msr device reads the registers of its own processor, pinned or not
+  if (clock->effective)
+  {
+    snprintf(msrname, sizeof(msrname), "/dev/cpu/%d/msr", clock->cpunumber);
+    msr = vfs_open(msrname, O_RDONLY);
+  }
+
+  if (!pinned && (msr < 0))
+    return NULL;
 
   /*
    * get this function in cached memory 
    */
-  gettimeofday(&tvstart, &tz);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
   cycles[0] = rdtsc();
-  gettimeofday(&tvstart, &tz);
 
-  /*
-   * we don't trust that this is any specific length of time 
-   */
-  usleep(sleeptime);
+  // threads started late get a shorter window, they don't make it longer
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &clock->start, NULL)
+	 == EINTR);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  cycles[0] = rdtsc();
+  counted = (msr >= 0) && read_msr(msr, MSR_IA32_APERF, aperf[0])
+    && read_msr(msr, MSR_IA32_MPERF, mperf[0]);
 
-  gettimeofday(&tvstop, &tz);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &clock->stop, NULL)
+	 == EINTR);
+  counted = counted && read_msr(msr, MSR_IA32_APERF, aperf[1])
+    && read_msr(msr, MSR_IA32_MPERF, mperf[1]);
   cycles[1] = rdtsc();
-  gettimeofday(&tvstop, &tz);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  if (msr >= 0)
+    vfs_close(msr);
 
-  microseconds = (tvstop.tv_sec - tvstart.tv_sec) * 1000000 +
-    (tvstop.tv_usec - tvstart.tv_usec);
+  ns = (t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec);
+  if (pinned && (ns > 0) && (cycles[1] > cycles[0]))
+    clock->hz = (unsigned long long) ((cycles[1] - cycles[0]) * 1e9 / ns);
+  if (counted && (aperf[1] > aperf[0]) && (mperf[1] > mperf[0]))
+  {
+    clock->aperf = aperf[1] - aperf[0];
+    clock->mperf = mperf[1] - mperf[0];
+  }
+
+  return NULL;
+}
 
-  return (float) (cycles[1] - cycles[0]) / (microseconds / freq);
+/*
+ * the first of the SMT siblings of a processor, which has the same TSC
+ */
+static int cpuid_core(int cpunumber)
+{
+  char path[80];
+  string siblings = "";
+  const char *p = NULL;
+  unsigned long long first = 0;
+
+  snprintf(path, sizeof(path),
+	   "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+	   cpunumber);
+  siblings = get_string(path);
+  p = siblings.c_str();
+  if (!parse_number(p, p + siblings.length(), first))
+    return cpunumber;
+
+  return first;
 }
 
-static float average_MHz(int cpunum,
-			 int tries = 2)
+static void measure_clocks(vector < cpuid_clock > &clocks)
 {
-  float frequency = 0;
+  struct timespec now, start, stop;
 
-  for (int i = 1; i <= tries; i++)
-    frequency += estimate_MHz(cpunum, i * 150000);
+  if (clocks.empty())
+    return;
 
-  if (tries > 0)
-    return frequency / (float) tries;
-  else
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  cpuid_after(start, now, MHZ_DELAY);
+  cpuid_after(stop, start, MHZ_WINDOW);
+
+  // one thread per core: SMT siblings share the TSC measurement
+  for (size_t i = 0; i < clocks.size(); i++)
+  {
+    int core = cpuid_core(clocks[i].cpunumber);
+
+    clocks[i].sibling = -1;
+    clocks[i].hz = 0;
+    clocks[i].aperf = clocks[i].mperf = 0;
+    clocks[i].running = false;
+    clocks[i].start = start;
+    clocks[i].stop = stop;
+    // APERF and MPERF belong to each thread, not to the core
+    for (size_t j = 0; (j < i) && (core != clocks[i].cpunumber)
+	 && !clocks[i].effective; j++)
+      if ((clocks[j].cpunumber == core) && (clocks[j].sibling < 0))
+	clocks[i].sibling = j;
+
+    if (clocks[i].sibling < 0)
+      clocks[i].running =
+	(pthread_create(&clocks[i].thread, NULL, measure_MHz, &clocks[i]) ==
+	 0);
+  }
+
+  for (size_t i = 0; i < clocks.size(); i++)
+    if (clocks[i].running)
+      pthread_join(clocks[i].thread, NULL);
+
+  for (size_t i = 0; i < clocks.size(); i++)
+    if (clocks[i].sibling >= 0)
+      clocks[i].hz = clocks[clocks[i].sibling].hz;
+}
+
+static bool hastsc(int cpunumber)
+{
+  unsigned long eax, ebx, ecx, edx;
+
+  cpuid(cpunumber, 1, eax, ebx, ecx, edx);
+  return (edx & (1 << 4)) != 0;
+}
+
+/*
+ * VMware, and KVM which follows its convention, say how fast the
+ * (virtual) TSC runs in leaf 0x40000010: better than measuring it
+ * against a virtual clock. other hypervisors have unrelated data there.
+ */
+static unsigned long long hypervisor_tsc(int cpunumber)
+{
+  unsigned long eax, ebx, ecx, edx;
+  string signature = cpuid_hypervisor();
+
+  if ((signature != "VMwareVMware") && (signature != "KVMKVMKVM"))
+    return 0;
+
+  cpuid(cpunumber, 0x40000000, eax, ebx, ecx, edx);
+  if ((eax < 0x40000010) || (eax > 0x400000ff))
     return 0;
+
+  cpuid(cpunumber, 0x40000010, eax, ebx, ecx, edx);
+  return (eax & 0xffffffffUL) * 1000ULL;	// kHz
+}
+
+string cpuid_hypervisor(int n)
+{
+  unsigned long eax, ebx, ecx, edx;
+  unsigned long regs[3];
+  char signature[13];
+
+  if (!haveCPUID())
+    return "";
+
+  cpuid(0, 0, eax, ebx, ecx, edx);
+  if (eax < 1)
+    return "";
+  cpuid(0, 1, eax, ebx, ecx, edx);
+  if ((ecx & (1UL << 31)) == 0)	// "hypervisor present" bit
+    return "";
+
+  cpuid(0, 0x40000000 + 0x100 * n, eax, regs[0], regs[1], regs[2]);
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 4; j++)
+      signature[4 * i + j] = (regs[i] >> (8 * j)) & 0xff;
+  signature[12] = '\0';
+
+  return string(signature);
+}
+
+/*
+ * SMBIOS describes sockets, CPUID runs on logical processors: a socket
+ * is represented by the first processor of the package with the same
+ * rank (packages are in the order of their ids). processors listed by
+ * /proc/cpuinfo alone are logical processors already. returns -1 for
+ * sockets with no processor online.
+ */
+static int cpuid_cpunumber(const hwNode & cpu,
+			   int n)
+{
+  vector < string > entries;
+  map < unsigned long long, int >packages;	// id -> first processor
+  map < unsigned long long, int >::iterator i;
+
+  if (cpu.getHandle().substr(0, 4) != "DMI:")
+    return n;
+  if (!listdir(SYS_CPU, entries))
+    return n;
+
+  for (unsigned int j = 0; j < entries.size(); j++)
+  {
+    const char *p = entries[j].c_str();
+    const char *end = p + entries[j].length();
+    unsigned long long number = 0, package = 0;
+
+    if ((entries[j].substr(0, 3) != "cpu") || (end - p < 4))
+      continue;
+    p += 3;
+    if (!parse_number(p, end, number) || (p != end))
+      continue;
+    if (!get_number(SYS_CPU "/" + entries[j] +
+		    "/topology/physical_package_id", package))
+      continue;
+
+    i = packages.find(package);
+    if ((i == packages.end()) || ((unsigned long long) i->second > number))
+      packages[package] = number;
+  }
+
+  if (packages.empty())
+    return n;			// no topology, assume one thread per socket
+
+  for (i = packages.begin(); i != packages.end(); i++, n--)
+    if (n == 0)
+      return i->second;
+
+  return -1;
 }
 
-bool scan_cpuid(hwNode & n)
+static string mhz(unsigned long long hz)
 {
-  unsigned long maxi, unused, eax, ebx, ecx, edx;
+  char buffer[20];
+
+  snprintf(buffer, sizeof(buffer), "%lluMHz", hz / 1000000);
+  return string(buffer);
+}
+
+/*
+ * Intel brand strings end with the nominal clock ("... @ 2.10GHz")
+ */
+static unsigned long long brand_clock(const string & brand)
+{
+  size_t at = brand.rfind('@');
+  const char *p = NULL;
+  const char *end = NULL;
+  unsigned long long units = 0, fraction = 0, scale = 1;
+
+  if (at == string::npos)
+    return 0;
+
+  p = brand.c_str() + at + 1;
+  end = brand.c_str() + brand.length();
+  if (!parse_number(p, end, units))
+    return 0;
+  if ((p < end) && (*p == '.'))
+    for (p++; (p < end) && (*p >= '0') && (*p <= '9') && (scale < 1000); p++)
+    {
+      fraction = fraction * 10 + (*p - '0');
+      scale *= 10;
+    }
+
+  if (string(p, end - p).substr(0, 3) == "GHz")
+    return (units * scale + fraction) * 1000000000ULL / scale;
+  if (string(p, end - p).substr(0, 3) == "MHz")
+    return (units * scale + fraction) * 1000000ULL / scale;
+
+  return 0;
+}
+
+bool scan_cpuid(hwNode & n,
+		bool effective)
+{
+  unsigned long maxi, ebx, ecx, edx;
+  unsigned long long hz = 0;
   hwNode *cpu = NULL;
   int currentcpu = 0;
+  int cpunumber = 0;
+  vector < cpuid_clock > clocks;	// processors whose speed is unknown
+  bool result = true;
 
   if (!haveCPUID())
     return false;
 
-  while (cpu = getcpu(n, currentcpu))
+  for (; (cpu = getcpu(n, currentcpu)); currentcpu++)
   {
-    cpu->claim(true);		// claim the cpu and all its children
-    cpuid(currentcpu, 0, maxi, ebx, ecx, edx);
+    cpunumber = cpuid_cpunumber(*cpu, currentcpu);
+    if (cpunumber < 0)
+      continue;			// empty socket
+
+    cpuid(cpunumber, 0, maxi, ebx, ecx, edx);
     maxi &= 0xffff;
 
     switch (ebx)
     {
     case 0x756e6547:		/* Intel */
-      dointel(maxi, cpu, currentcpu);
+      dointel(maxi, cpu, cpunumber);
       break;
     case 0x68747541:		/* AMD */
-      doamd(maxi, cpu, currentcpu);
+      doamd(maxi, cpu, cpunumber);
       break;
     case 0x69727943:		/* Cyrix */
-      docyrix(maxi, cpu, currentcpu);
+      docyrix(maxi, cpu, cpunumber);
       break;
     default:
-      return false;
+      result = false;
     }
 
+    if (!result)
+      break;
+
     cpu->claim(true);		// claim the cpu and all its children
-    if (cpu->getSize() == 0)
-      cpu->setSize((long long) (1000000 * average_MHz(currentcpu)));
 
-    currentcpu++;
+    // cheap sources of the nominal clock, which is also what measuring
+    // the TSC would give, when cpufreq didn't know it
+    hz = hypervisor_tsc(cpunumber);
+    if (hz == 0)
+      hz = brand_clock(cpu->getProduct());
+    if ((hz != 0) && (cpu->getConfig("nominal") == ""))
+      cpu->setConfig("nominal", mhz(hz));
+    if ((hz != 0) && (cpu->getSize() == 0))
+      cpu->setSize(hz);
+
+    // the TSC is measured only when nothing cheaper knew the clocks
+    if (!vfs_replaying() && hastsc(cpunumber) &&
+	((cpu->getSize() == 0) || (cpu->getConfig("nominal") == "") ||
+	 effective))
+    {
+      cpuid_clock clock;
+
+      clock.node = currentcpu;
+      clock.cpunumber = cpunumber;
+      clock.effective = effective;
+      clocks.push_back(clock);
+    }
   }
 
-  return true;
+  measure_clocks(clocks);
+  for (size_t i = 0; i < clocks.size(); i++)
+  {
+    unsigned long long nominal = 0;
+
+    if (!(cpu = getcpu(n, clocks[i].node)))
+      continue;
+
+    // the TSC runs at the nominal clock
+    if (clocks[i].hz != 0)
+    {
+      if (cpu->getSize() == 0)
+	cpu->setSize(clocks[i].hz);
+      if (cpu->getConfig("nominal") == "")
+	cpu->setConfig("nominal", mhz(clocks[i].hz));
+    }
+
+    // and so does MPERF
+    nominal = clocks[i].hz;
+    if (nominal == 0)
+      nominal = atoll(cpu->getConfig("nominal").c_str()) * 1000000ULL;
+    if ((clocks[i].mperf != 0) && (nominal != 0))
+      cpu->setConfig("effective",
+		     mhz((unsigned long long) ((double) nominal *
+					       clocks[i].aperf /
+					       clocks[i].mperf)));
+  }
+
+  return result;
 }
 
 #else
-bool scan_cpuid(hwNode & n)
+bool scan_cpuid(hwNode & n,
+		bool effective)
 {
   return true;
 }
+
+string cpuid_hypervisor(int n)
+{
+  return "";
+}
 #endif
 
 static char *id = "@(#) $Id: cpuid.cc,v 1.11 2003/02/08 14:25:36 ezix Exp $";
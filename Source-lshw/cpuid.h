@@ -3,6 +3,17 @@
 
 #include "hw.h"
 
-bool scan_cpuid(hwNode & n);
+/*
+ * effective: measure the average clock each processor actually ran at
+ * (APERF/MPERF, needs /dev/cpu/N/msr), over one short window
+ */
+bool scan_cpuid(hwNode & n,
+		bool effective = false);
+
+/*
+ * signature of the hypervisor in CPUID leaf 0x40000000 + 0x100 * n (some
+ * present themselves as another one first), "" on real hardware
+ */
+string cpuid_hypervisor(int n = 0);
 
 #endif
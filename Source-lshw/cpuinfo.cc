@@ -1,5 +1,6 @@
 #include "cpuinfo.h"
 #include "osutils.h"
+#include "vfs.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -7,6 +8,8 @@
 #include <stdio.h>
 #include <vector>
 
+#define SYS_CPU "/sys/devices/system/cpu"
+
 static hwNode *getcpu(hwNode & node,
 		      int n = 0)
 {
@@ -123,10 +126,101 @@ static void cpuinfo_x86(hwNode & node,
   }
 }
 
+static string mhz(unsigned long long khz)
+{
+  char buffer[30];
+
+  snprintf(buffer, sizeof(buffer), "%lluMHz", khz / 1000);
+  return string(buffer);
+}
+
+/*
+ * whether the processor may run above its nominal clock: acpi-cpufreq
+ * has a global switch, the older AMD drivers one per processor (-1 when
+ * there is none)
+ */
+static int cpufreq_boost(const string & path)
+{
+  unsigned long long value = 0;
+
+  if (get_number(SYS_CPU "/cpufreq/boost", value) ||
+      get_number(path + "/cpb", value))
+    return (value != 0) ? 1 : 0;
+
+  return -1;
+}
+
+/*
+ * the highest P-state of acpi-cpufreq (P0) is the nominal clock, except
+ * on Intel where turbo is listed above it as an extra state 1MHz faster
+ */
+static unsigned long long cpufreq_p0(const string & path,
+				     unsigned long long khz)
+{
+  string frequencies = get_string(path + "/scaling_available_frequencies");
+  const char *p = frequencies.c_str();
+  const char *end = p + frequencies.length();
+  unsigned long long first = 0, second = 0;
+
+  if (parse_number(p, end, first) && parse_number(p, end, second) &&
+      (first == khz) && (second + 1000 == first))
+    return second;
+
+  return khz;
+}
+
+/*
+ * cpufreq knows the clocks of each processor (in kHz): with it, there is
+ * nothing left to measure
+ */
+static void cpufreq(hwNode & cpu,
+		    int n)
+{
+  char path[80];
+  string driver = "";
+  unsigned long long khz = 0;
+  int boost = -1;
+
+  snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cpufreq", n);
+  if (!exists(path))
+    return;
+
+  driver = hw::strip(get_string(string(path) + "/scaling_driver"));
+  if (driver != "")
+    cpu.setConfig("driver", driver);
+  boost = cpufreq_boost(path);
+  if (boost >= 0)
+    cpu.setConfig("boost", boost ? "enabled" : "disabled");
+
+  // nominal clock, only the P-state drivers export it
+  if (get_number(string(path) + "/base_frequency", khz) && (khz != 0))
+    cpu.setConfig("nominal", mhz(khz));
+
+  if (get_number(string(path) + "/cpuinfo_max_freq", khz) && (khz != 0))
+  {
+    // the P-state drivers count turbo in; the others stop at P0 and
+    // anything above it is left to the boost switch
+    if ((driver.find("pstate") != string::npos) ||
+	(driver == "intel_cpufreq"))
+      cpu.setCapacity(khz * 1000ULL);
+    else
+    {
+      khz = cpufreq_p0(path, khz);
+      if (cpu.getConfig("nominal") == "")
+	cpu.setConfig("nominal", mhz(khz));
+      if (boost != 1)
+	cpu.setCapacity(khz * 1000ULL);
+    }
+  }
+
+  if (get_number(string(path) + "/scaling_cur_freq", khz) && (khz != 0))
+    cpu.setSize(khz * 1000ULL);
+}
+
 bool scan_cpuinfo(hwNode & n)
 {
   hwNode *core = n.getChild("core");
-  int cpuinfo = open("/proc/cpuinfo", O_RDONLY);
+  int cpuinfo = vfs_open("/proc/cpuinfo", O_RDONLY);
 
   if (cpuinfo < 0)
     return false;
@@ -144,11 +238,11 @@ bool scan_cpuinfo(hwNode & n)
     hwNode *cpu = core->getChild("cpu");
     string cpuinfo_str = "";
 
-    while ((count = read(cpuinfo, buffer, sizeof(buffer))) > 0)
+    while ((count = vfs_read(cpuinfo, buffer, sizeof(buffer))) > 0)
     {
       cpuinfo_str += string(buffer, count);
     }
-    close(cpuinfo);
+    vfs_close(cpuinfo);
 
     vector < string > cpuinfo_lines;
     splitlines(cpuinfo_str, cpuinfo_lines);
@@ -171,12 +265,29 @@ bool scan_cpuinfo(hwNode & n)
 	//cpuinfo_ppc(n, id, value);
       }
     }
+
+    // getcpu() would add the processors cpuinfo didn't list
+    for (int i = 0; true; i++)
+    {
+      char cpuname[20];
+
+      snprintf(cpuname, sizeof(cpuname), "cpu:%d", i);
+      cpu = core->getChild(cpuname);
+      if (!cpu && (i == 0))
+	cpu = core->getChild("cpu");
+      if (!cpu)
+	break;
+
+      cpufreq(*cpu, i);
+    }
   }
   else
   {
-    close(cpuinfo);
+    vfs_close(cpuinfo);
     return false;
   }
+
+  return true;
 }
 
 static char *id =
@@ -1,5 +1,6 @@
 #include "device-tree.h"
 #include "osutils.h"
+#include "vfs.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -9,19 +10,18 @@
 
 #define DEVICETREE "/proc/device-tree"
 
-static unsigned long get_long(const string & path)
+/*
+ * OpenFirmware properties are big-endian 32 or 64 bit cells
+ */
+static unsigned long long get_long(const string & path)
 {
-  unsigned long result = 0;
-  int fd = open(path.c_str(), O_RDONLY);
+  unsigned char cells[8];
+  ssize_t len = read_attribute(path, cells, sizeof(cells));
 
-  if (fd >= 0)
-  {
-    read(fd, &result, sizeof(result));
-
-    close(fd);
-  }
+  if ((len != 4) && (len != 8))
+    return 0;
 
-  return result;
+  return get_be(cells, len);
 }
 
 static void scan_devtree_root(hwNode & core)
@@ -36,8 +36,7 @@ static void scan_devtree_bootrom(hwNode & core)
     hwNode bootrom("firmware",
 		   hw::memory);
     string upgrade = "";
-    unsigned long base = 0;
-    unsigned long size = 0;
+    unsigned char reg[8];
 
     bootrom.setProduct(get_string(DEVICETREE "/rom/boot-rom/model"));
     bootrom.setDescription("BootROM");
@@ -51,15 +50,10 @@ static void scan_devtree_bootrom(hwNode & core)
       bootrom.addCapability(upgrade);
     }
 
-    int fd = open(DEVICETREE "/rom/boot-rom/reg", O_RDONLY);
-    if (fd >= 0)
-    {
-      read(fd, &base, sizeof(base));
-      read(fd, &size, sizeof(size));
-
-      bootrom.setSize(size);
-      close(fd);
-    }
+    // base address and size, one cell each
+    if (read_attribute(DEVICETREE "/rom/boot-rom/reg", reg, sizeof(reg)) ==
+	sizeof(reg))
+      bootrom.setSize(get_be(reg + 4, 4));
 
     core.addChild(bootrom);
   }
@@ -78,41 +72,22 @@ static void scan_devtree_bootrom(hwNode & core)
   }
 }
 
-static int selectdir(const struct dirent *d)
-{
-  struct stat buf;
-
-  if (d->d_name[0] == '.')
-    return 0;
-
-  if (lstat(d->d_name, &buf) != 0)
-    return 0;
-
-  return S_ISDIR(buf.st_mode);
-}
-
 static void scan_devtree_cpu(hwNode & core)
 {
-  struct dirent **namelist;
-  int n;
+  vector < string > namelist;
 
-  pushd(DEVICETREE "/cpus");
-  n = scandir(".", &namelist, selectdir, alphasort);
-  popd();
-  if (n < 0)
+  if (!listdir(DEVICETREE "/cpus", namelist, S_IFDIR))
     return;
   else
   {
-    for (int i = 0; i < n; i++)
+    for (int i = 0; i < namelist.size(); i++)
     {
-      string basepath =
-	string(DEVICETREE "/cpus/") + string(namelist[i]->d_name);
+      string basepath = string(DEVICETREE "/cpus/") + namelist[i];
       unsigned long version = 0;
       unsigned long cachesize = 0;
       hwNode cpu("cpu",
 		 hw::processor);
-      struct dirent **cachelist;
-      int ncache;
+      vector < string > cachelist;
 
       if (hw::strip(get_string(basepath + "/device_type")) != "cpu")
 	break;			// oops, not a CPU!
@@ -152,16 +127,13 @@ static void scan_devtree_cpu(hwNode & core)
 	  cpu.addChild(cache);
       }
 
-      pushd(basepath);
-      ncache = scandir(".", &cachelist, selectdir, alphasort);
-      popd();
-      if (ncache > 0)
+      if (listdir(basepath, cachelist, S_IFDIR))
       {
-	for (int j = 0; j < ncache; j++)
+	for (int j = 0; j < cachelist.size(); j++)
 	{
 	  hwNode cache("cache",
 		       hw::memory);
-	  string cachebase = basepath + "/" + cachelist[j]->d_name;
+	  string cachebase = basepath + "/" + cachelist[j];
 
 	  if (hw::strip(get_string(cachebase + "/device_type")) != "cache" &&
 	      hw::strip(get_string(cachebase + "/device_type")) != "l2-cache")
@@ -186,17 +158,11 @@ static void scan_devtree_cpu(hwNode & core)
 
 	  if (cache.getSize() > 0)
 	    cpu.addChild(cache);
-
-	  free(cachelist[j]);
 	}
-	free(cachelist);
       }
 
       core.addChild(cpu);
-
-      free(namelist[i]);
     }
-    free(namelist);
   }
 }
 
@@ -215,7 +181,7 @@ static void scan_devtree_memory(hwNode & core)
     string devtreeslotnames = mcbase + string("/slot-names");
     string reg = mcbase + string("/reg");
 
-    if (stat(devtreeslotnames.c_str(), &buf) != 0)
+    if (vfs_stat(devtreeslotnames, &buf) != 0)
       break;
 
     if (!memory || (currentmc != 0))
@@ -228,8 +194,8 @@ static void scan_devtree_memory(hwNode & core)
       unsigned long bitmap = 0;
       char *slotnames = NULL;
       char *slotname = NULL;
-      int fd = open(devtreeslotnames.c_str(), O_RDONLY);
-      int fd2 = open(reg.c_str(), O_RDONLY);
+      int fd = vfs_open(devtreeslotnames, O_RDONLY);
+      int fd2 = vfs_open(reg, O_RDONLY);
 
       if ((fd >= 0) && (fd2 >= 0))
       {
@@ -237,8 +203,8 @@ static void scan_devtree_memory(hwNode & core)
 	slotnames = (char *) malloc(buf.st_size + 1);
 	slotname = slotnames;
 	memset(slotnames, 0, buf.st_size + 1);
-	read(fd, &bitmap, sizeof(bitmap));
-	read(fd, slotnames, buf.st_size + 1);
+	vfs_read(fd, &bitmap, sizeof(bitmap));
+	vfs_read(fd, slotnames, buf.st_size + 1);
 
 	while (strlen(slotname) > 0)
 	{
@@ -249,8 +215,8 @@ static void scan_devtree_memory(hwNode & core)
 	    hwNode bank("bank",
 			hw::memory);
 
-	    read(fd2, &base, sizeof(base));
-	    read(fd2, &size, sizeof(size));
+	    vfs_read(fd2, &base, sizeof(base));
+	    vfs_read(fd2, &size, sizeof(size));
 
 	    bank.setSlot(slotname);
 	    bank.setSize(size);
@@ -259,11 +225,12 @@ static void scan_devtree_memory(hwNode & core)
 	  slot *= 2;
 	  slotname += strlen(slotname) + 1;
 	}
-	close(fd);
-	close(fd2);
-
 	free(slotnames);
       }
+      if (fd >= 0)
+	vfs_close(fd);
+      if (fd2 >= 0)
+	vfs_close(fd2);
 
       currentmc++;
     }
@@ -1,4 +1,5 @@
 #include "disk.h"
+#include "vfs.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -24,23 +25,23 @@ bool scan_disk(hwNode & n)
   if (n.getLogicalName() == "")
     return false;
 
-  int fd = open(n.getLogicalName().c_str(), O_RDONLY | O_NONBLOCK);
+  int fd = vfs_open(n.getLogicalName(), O_RDONLY | O_NONBLOCK);
 
   if (fd < 0)
     return false;
 
   if (!n.isCapable("removable") && (n.getSize() == 0))
   {
-    if (ioctl(fd, BLKGETSIZE, &size) != 0)
+    if (vfs_ioctl(fd, BLKGETSIZE, &size, sizeof(size)) != 0)
       size = 0;
-    if (ioctl(fd, BLKSSZGET, &sectsize) != 0)
+    if (vfs_ioctl(fd, BLKSSZGET, &sectsize, sizeof(sectsize)) != 0)
       sectsize = 0;
 
     if ((size > 0) && (sectsize > 0))
       n.setSize((unsigned long long) size * (unsigned long long) sectsize);
   }
 
-  close(fd);
+  vfs_close(fd);
 
   return true;
 }
@@ -67,42 +67,28 @@
  */
 
 #include "dmi.h"
+#include "vfs.h"
+#include "parallel.h"
 
 #include <map>
+#include <algorithm>
 
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define SYS_FIRMWARE_DMI "/sys/firmware/dmi/tables"
 
 typedef unsigned char u8;
 typedef unsigned short u16;
 typedef unsigned int u32;
-
-struct dmi_header
-{
-  u8 type;
-  u8 length;
-  u16 handle;
-};
-
-static string dmi_string(struct dmi_header *dm,
-			 u8 s)
-{
-  char *bp = (char *) dm;
-  if (!s)
-    return "";
-
-  bp += dm->length;
-  while (s > 1)
-  {
-    bp += strlen(bp);
-    bp++;
-    s--;
-  }
-  return string(bp);
-}
+typedef unsigned long long u64;
 
 static string dmi_decode_ram(u16 data)
 {
@@ -473,9 +459,9 @@ static const char *dmi_port_connector_type(u8 code)
   return "";
 }
 
-static char *dmi_memory_array_location(u8 num)
+static const char *dmi_memory_array_location(u8 num)
 {
-  static char *memory_array_location[] = {
+  static const char *memory_array_location[] = {
     "",
     "",
     "",
@@ -488,7 +474,7 @@ static char *dmi_memory_array_location(u8 num)
     "Proprietary add-on card",
     "NuBus",
   };
-  static char *jp_memory_array_location[] = {
+  static const char *jp_memory_array_location[] = {
     "PC-98/C20 add-on card",
     "PC-98/C24 add-on card",
     "PC-98/E add-on card",
@@ -497,13 +483,13 @@ static char *dmi_memory_array_location(u8 num)
   if (num <= 0x0A)
     return memory_array_location[num];
   if (num >= 0xA0 && num < 0xA3)
-    return jp_memory_array_location[num];
+    return jp_memory_array_location[num - 0xA0];
   return "";
 }
 
-static char *dmi_memory_array_use(u8 num)
+static const char *dmi_memory_array_use(u8 num)
 {
-  static char *memory_array_use[] = {
+  static const char *memory_array_use[] = {
     "",
     "Other",
     "Unknown",
@@ -518,9 +504,9 @@ static char *dmi_memory_array_use(u8 num)
   return memory_array_use[num];
 };
 
-static char *dmi_memory_array_error_correction_type(u8 num)
+static const char *dmi_memory_array_error_correction_type(u8 num)
 {
-  static char *memory_array_error_correction_type[] = {
+  static const char *memory_array_error_correction_type[] = {
     "",
     "Other",
     "Unknown",
@@ -535,9 +521,9 @@ static char *dmi_memory_array_error_correction_type(u8 num)
   return memory_array_error_correction_type[num];
 }
 
-static char *dmi_memory_device_form_factor(u8 num)
+static const char *dmi_memory_device_form_factor(u8 num)
 {
-  static char *memory_device_form_factor[] = {
+  static const char *memory_device_form_factor[] = {
     "",
     "",
     "",
@@ -559,9 +545,9 @@ static char *dmi_memory_device_form_factor(u8 num)
   return memory_device_form_factor[num];
 }
 
-static char *dmi_memory_device_type(u8 num)
+static const char *dmi_memory_device_type(u8 num)
 {
-  static char *memory_device_type[] = {
+  static const char *memory_device_type[] = {
     "",
     "",
     "",
@@ -879,60 +865,73 @@ static const char *dmi_status(u8 code)
   return type[code];
 }
 
-/* 3 dec. places */
-static const char *dmi_millivolt(u8 * data,
-				 int indx)
+/*
+ * a structure of the table and its strings, decoded in place: accesses
+ * beyond the formatted area of short (older) structures read as 0
+ */
+struct dmi_structure
 {
-  static char buffer[20];
-  short int d;
+  const u8 *data;
+  const u8 *strings;
+  const u8 *end;		// of the string set
+  u8 type;
+  u8 length;
+  u16 handle;
 
-  if (data[indx + 1] == 0x80 && data[indx] == 0)
-    return "Unknown";
-  d = data[indx + 1] << 8 | data[indx];
-  sprintf(buffer, "%0.3f", d / 1000.0);
-  return buffer;
-}
+  u8 byte(unsigned int offset) const
+  {
+    return (offset < length) ? data[offset] : 0;
+  }
+  u16 word(unsigned int offset) const
+  {
+    return byte(offset) | byte(offset + 1) << 8;
+  }
+  u32 dword(unsigned int offset) const
+  {
+    return word(offset) | (u32) word(offset + 2) << 16;
+  }
+  u64 qword(unsigned int offset) const
+  {
+    return dword(offset) | (u64) dword(offset + 4) << 32;
+  }
+  string str(unsigned int offset) const;	// string numbered at offset
+};
 
-/* 2 dec. places */
-static const char *dmi_accuracy(u8 * data,
-				int indx)
+string dmi_structure::str(unsigned int offset) const
 {
-  static char buffer[20];
-  short int d;
+  const char *s = (const char *) strings;
+  u8 n = byte(offset);
+
+  while ((n > 0) && (s < (const char *) end))
+  {
+    const char *z = (const char *) memchr(s, 0, (const char *) end - s);
+
+    if (!z)
+      z = (const char *) end;
+    if (--n == 0)
+      return string(s, z - s);
+    if (z == s)			// empty string: end of the set
+      break;
+    s = z + 1;
+  }
 
-  if (data[indx + 1] == 0x80 && data[indx] == 0)
-    return "Unknown";
-  d = data[indx + 1] << 8 | data[indx];
-  sprintf(buffer, "%0.2f", d / 100.0);
-  return buffer;
+  return "";
 }
 
-/* 1 dec. place */
-static const char *dmi_temp(u8 * data,
-			    int indx)
+static string dmi_mhz(u32 mhz)
 {
-  static char buffer[20];
-  short int d;
+  char buffer[20];
+  snprintf(buffer, sizeof(buffer), "%uMHz", mhz);
 
-  if (data[indx + 1] == 0x80 && data[indx] == 0)
-    return "Unknown";
-  d = data[indx + 1] << 8 | data[indx];
-  sprintf(buffer, "%0.1f", d / 10.0);
-  return buffer;
+  return string(buffer);
 }
 
-/* 0 dec. place */
-static const char *dmi_speed(u8 * data,
-			     int indx)
+static string dmi_voltage(u16 millivolts)
 {
-  static char buffer[20];
-  short int d;
+  char buffer[20];
+  snprintf(buffer, sizeof(buffer), "%gV", millivolts / 1000.0);
 
-  if (data[indx + 1] == 0x80 && data[indx] == 0)
-    return "Unknown";
-  d = data[indx + 1] << 8 | data[indx];
-  sprintf(buffer, "%d", d);
-  return buffer;
+  return string(buffer);
 }
 
 static string dmi_handle(u16 handle)
@@ -943,711 +942,1393 @@ static string dmi_handle(u16 handle)
   return string(buffer);
 }
 
-static void dmi_table(int fd,
-		      u32 base,
-		      int len,
-		      int num,
-		      hwNode & node,
-		      int dmiversionmaj,
-		      int dmiversionmin)
+/*
+ * what the memory layout report needs from a memory device (type 17)
+ */
+struct dmi_memory_device
 {
-  unsigned char *buf = (unsigned char *) malloc(len);
-  struct dmi_header *dm;
-  hwNode *hardwarenode = NULL;
-  u8 *data;
-  int i = 0;
-  int r = 0, r2 = 0;
-  string handle;
+  u16 handle;
+  u16 array;			// physical memory array (type 16)
+  string locator, bank;
+  unsigned long long size;
+  unsigned int speed;		// rated, in MT/s
+  unsigned int configured;	// 0 when unknown
+  unsigned int width;		// data bits
+  int ranks;
+};
 
-  if (len == 0)
-    // no data
-    return;
+/*
+ * what the structure handlers share while a table is decoded
+ */
+struct dmi_context
+{
+  hwNode *node;			// the machine
+  hwNode *core;			// the motherboard
+  int dmiversionmaj, dmiversionmin;
 
-  if (buf == NULL)
-    // memory exhausted
-    return;
+  vector < dmi_memory_device > devices;
+  map < u16, unsigned long long >mapped;	// device handle -> bytes (type 20)
+  vector < hwNode > caches;	// type 7, added once all processors are known
+};
 
-  if (lseek(fd, (long) base, SEEK_SET) == -1)
-    // i/o error
-    return;
+/*
+ * types 5 and 6 were superseded by types 16 and 17 in DMI 2.1
+ */
+static bool dmi_obsolete(const dmi_context & ctx)
+{
+  return (ctx.dmiversionmaj > 2)
+    || ((ctx.dmiversionmaj == 2) && (ctx.dmiversionmin >= 1));
+}
 
-  while (r2 != len && (r = read(fd, buf + r2, len - r2)) != 0)
-    r2 += r;
-  if (r == 0)
-    // i/o error
-    return;
+static void dmi_bios(const dmi_structure & dm,
+		     dmi_context & ctx)
+{
+  // BIOS Information Block
+  string release(dm.str(8));
+  hwNode newnode("firmware",
+		 hw::memory,
+		 dm.str(4));
+  newnode.setVersion(dm.str(5));
+  newnode.setCapacity(64 * dm.byte(9) * 1024);
+  newnode.setSize(16 * (0x10000 - dm.word(6)));
+  newnode.setDescription("BIOS");
+
+  dmi_bios_features(dm.dword(10), dm.dword(14), newnode);
+
+  if (release != "")
+    newnode.setVersion(newnode.getVersion() + " (" + release + ")");
+  ctx.core->addChild(newnode);
+}
+
+static void dmi_system(const dmi_structure & dm,
+		       dmi_context & ctx)
+{
+  // System Information Block
+  ctx.node->setHandle(dmi_handle(dm.handle));
+  ctx.node->setVendor(dm.str(4));
+  ctx.node->setProduct(dm.str(5));
+  ctx.node->setVersion(dm.str(6));
+  ctx.node->setSerial(dm.str(7));
+}
+
+static void dmi_board(const dmi_structure & dm,
+		      dmi_context & ctx)
+{
+  // Board Information Block
+  hwNode *board = ctx.core;
+  hwNode newnode("board",
+		 hw::bus);
 
-  data = buf;
-  while (data + sizeof(struct dmi_header) <= (u8 *) buf + len)
+  if (dm.byte(0x0E) == 0)	// we are the only system board on the computer so connect everything to us
+    board->setDescription("Motherboard");
+  else
   {
-    u32 u, u2;
-    dm = (struct dmi_header *) data;
+    board = &newnode;
+    for (int i = 0; i < dm.byte(0x0E); i++)
+      newnode.attractHandle(dmi_handle(dm.word(0x0F + 2 * i)));
+    newnode.setDescription(dmi_board_type(dm.byte(0x0D)));
+  }
 
-    /*
-     * we won't read beyond allocated memory 
-     */
-    if (data + dm->length > (u8 *) buf + len)
-      // incomplete structure, abort decoding
-      break;
+  board->setVendor(dm.str(4));
+  board->setProduct(dm.str(5));
+  board->setVersion(dm.str(6));
+  board->setSerial(dm.str(7));
+  board->setSlot(dm.str(0x0A));
+  board->setHandle(dmi_handle(dm.handle));
 
-    handle = dmi_handle(dm->handle);
+  if (board == &newnode)
+    ctx.core->addChild(newnode);
+}
 
-    hardwarenode = node.getChild("core");
-    if (!hardwarenode)
-    {
-      node.addChild(hwNode("core", hw::bus));
-      hardwarenode = node.getChild("core");
-    }
-    if (!hardwarenode)
-      hardwarenode = &node;
+static void dmi_chassis(const dmi_structure & dm,
+			dmi_context & ctx)
+{
+  // Chassis Information Block
+  //
+  // special case: if the system characteristics are still unknown,
+  // use values from the chassis
+  if (ctx.node->getVendor() == "")
+    ctx.node->setVendor(dm.str(4));
+  if (ctx.node->getProduct() == "")
+    ctx.node->setProduct(dm.str(5));
+  if (ctx.node->getVersion() == "")
+    ctx.node->setVersion(dm.str(6));
+  if (ctx.node->getSerial() == "")
+    ctx.node->setSerial(dm.str(7));
+}
 
-    switch (dm->type)
-    {
-    case 0:
-      // BIOS Information Block
-      {
-	string release(dmi_string(dm,
-				  data[8]));
-	hwNode newnode("firmware",
-		       hw::memory,
-		       dmi_string(dm,
-				  data[4]));
-	newnode.setVersion(dmi_string(dm, data[5]));
-	newnode.setCapacity(64 * data[9] * 1024);
-	newnode.setSize(16 * (0x10000 - (data[7] << 8 | data[6])));
-	newnode.setDescription("BIOS");
-
-	dmi_bios_features(data[13] << 24 | data[12] << 16 | data[11] << 8 |
-			  data[10],
-			  data[17] << 24 | data[16] << 16 | data[15] << 8 |
-			  data[14], newnode);
-
-	if (release != "")
-	  newnode.setVersion(newnode.getVersion() + " (" + release + ")");
-	hardwarenode->addChild(newnode);
-      }
-      break;
+static void dmi_processor(const dmi_structure & dm,
+			  dmi_context & ctx)
+{
+  // Processor
+  hwNode newnode("cpu",
+		 hw::processor);
+  u32 u;
+
+  newnode.setSlot(dm.str(4));
+  newnode.setProduct(dmi_processor_family(dm.byte(6)));
+  newnode.setVersion(dm.str(0x10));
+  newnode.setVendor(dm.str(7));
+  if (dm.length > 0x1A)
+  {
+    // L1 cache
+    newnode.attractHandle(dmi_handle(dm.word(0x1A)));
+    // L2 cache
+    newnode.attractHandle(dmi_handle(dm.word(0x1C)));
+    // L3 cache
+    newnode.attractHandle(dmi_handle(dm.word(0x1E)));
+  }
+  if (dm.length > 0x20)
+  {
+    newnode.setSerial(dm.str(0x20));
+    if (dm.str(0x22) != "")
+      newnode.setProduct(newnode.getProduct() + " (" + dm.str(0x22) + ")");
+  }
 
-    case 1:
-      // System Information Block
-      node.setHandle(handle);
-      node.setVendor(dmi_string(dm, data[4]));
-      node.setProduct(dmi_string(dm, data[5]));
-      node.setVersion(dmi_string(dm, data[6]));
-      node.setSerial(dmi_string(dm, data[7]));
-      break;
+  // external clock
+  newnode.setClock(dm.word(0x12) * 1000000ULL);
+  // maximum speed
+  newnode.setCapacity(dm.word(0x14) * 1000000ULL);
+  // current speed
+  newnode.setSize(dm.word(0x16) * 1000000ULL);
 
-    case 2:
-      // Board Information Block
-      {
+  if (newnode.getCapacity() < newnode.getSize())
+    newnode.setCapacity(0);
 
-	if ((dm->length <= 0x0E) || (data[0x0E] == 0))	// we are the only system board on the computer so connect everything to us
-	{
-	  hardwarenode->setVendor(dmi_string(dm, data[4]));
-	  hardwarenode->setProduct(dmi_string(dm, data[5]));
-	  hardwarenode->setVersion(dmi_string(dm, data[6]));
-	  hardwarenode->setSerial(dmi_string(dm, data[7]));
-	  hardwarenode->setSlot(dmi_string(dm, data[0x0A]));
-	  hardwarenode->setHandle(handle);
-	  hardwarenode->setDescription("Motherboard");
-	}
-	else
-	{
-	  hwNode newnode("board",
-			 hw::bus);
-
-	  if (dm->length >= 0x0E)
-	    for (int i = 0; i < data[0x0E]; i++)
-	      newnode.
-		attractHandle(dmi_handle
-			      (data[0x0F + 2 * i + 1] << 8 |
-			       data[0x0F + 2 * i]));
-
-	  newnode.setVendor(dmi_string(dm, data[4]));
-	  newnode.setProduct(dmi_string(dm, data[5]));
-	  newnode.setVersion(dmi_string(dm, data[6]));
-	  newnode.setSerial(dmi_string(dm, data[7]));
-	  newnode.setSlot(dmi_string(dm, data[0x0A]));
-	  newnode.setHandle(handle);
-	  newnode.setDescription(dmi_board_type(data[0x0D]));
-	  hardwarenode->addChild(newnode);
-	}
-      }
-      break;
+  // CPU enabled/disabled by BIOS?
+  u = dm.byte(0x18) & 0x07;
+  if ((u == 2) || (u == 3) || (u == 4))
+    newnode.disable();
 
-    case 3:
-      // Chassis Information Block
-      //
-      // special case: if the system characteristics are still unknown,
-      // use values from the chassis
-      if (node.getVendor() == "")
-	node.setVendor(dmi_string(dm, data[4]));
-      if (node.getProduct() == "")
-	node.setProduct(dmi_string(dm, data[5]));
-      if (node.getVersion() == "")
-	node.setVersion(dmi_string(dm, data[6]));
-      if (node.getSerial() == "")
-	node.setSerial(dmi_string(dm, data[7]));
-      break;
+  newnode.setHandle(dmi_handle(dm.handle));
 
-    case 4:
-      // Processor
-      {
-	hwNode newnode("cpu",
-		       hw::processor);
-
-	newnode.setSlot(dmi_string(dm, data[4]));
-	newnode.setProduct(dmi_processor_family(data[6]));
-	newnode.setVersion(dmi_string(dm, data[0x10]));
-	newnode.setVendor(dmi_string(dm, data[7]));
-	if (dm->length > 0x1A)
-	{
-	  // L1 cache
-	  newnode.attractHandle(dmi_handle(data[0x1B] << 8 | data[0x1A]));
-	  // L2 cache
-	  newnode.attractHandle(dmi_handle(data[0x1D] << 8 | data[0x1C]));
-	  // L3 cache
-	  newnode.attractHandle(dmi_handle(data[0x1F] << 8 | data[0x1E]));
-	}
-	if (dm->length > 0x20)
-	{
-	  newnode.setSerial(dmi_string(dm, data[0x20]));
-	  if (dmi_string(dm, data[0x22]) != "")
-	    newnode.setProduct(newnode.getProduct() + " (" +
-			       string(dmi_string(dm, data[0x22])) + ")");
-	}
-
-	// external clock
-	u = data[0x13] << 8 | data[0x12];
-	newnode.setClock(u * 1000000);
-	// maximum speed
-	u = data[0x15] << 8 | data[0x14];
-	newnode.setCapacity(u * 1000000);
-	// current speed
-	u = data[0x17] << 8 | data[0x16];
-	newnode.setSize(u * 1000000);
-
-	if (newnode.getCapacity() < newnode.getSize())
-	  newnode.setCapacity(0);
-
-	// CPU enabled/disabled by BIOS?
-	u = data[0x18] & 0x07;
-	if ((u == 2) || (u == 3) || (u == 4))
-	  newnode.disable();
-
-	newnode.setHandle(handle);
-
-	hardwarenode->addChild(newnode);
-      }
-      break;
+  ctx.core->addChild(newnode);
+}
 
-    case 5:
-      // Memory Controller (obsolete in DMI 2.1+)
-      // therefore ignore the entry if the DMI version is recent enough
-      if ((dmiversionmaj < 2)
-	  || ((dmiversionmaj == 2) && (dmiversionmin < 1)))
-      {
-	unsigned long long size = 0;
-	hwNode newnode("memory",
-		       hw::memory);
+static void dmi_controller(const dmi_structure & dm,
+			   dmi_context & ctx)
+{
+  // Memory Controller (obsolete in DMI 2.1+)
+  // therefore ignore the entry if the DMI version is recent enough
+  if (dmi_obsolete(ctx))
+    return;
 
-	newnode.setHandle(handle);
+  unsigned long long size = 0;
+  hwNode newnode("memory",
+		 hw::memory);
 
-	size = data[0x0E] * (1 << data[8]) * 1024 * 1024;
-	newnode.setCapacity(size);
+  newnode.setHandle(dmi_handle(dm.handle));
 
-	// loop through the controller's slots and link them to us
-	for (i = 0; i < data[0x0E]; i++)
-	{
-	  char slotref[10];
-	  u16 slothandle = data[0x0F + 2 * i + 1] << 8 | data[0x0F + 2 * i];
-	  newnode.attractHandle(dmi_handle(slothandle));
-	}
+  size = dm.byte(0x0E) * (1 << dm.byte(8)) * 1024 * 1024;
+  newnode.setCapacity(size);
 
-	newnode.setProduct(dmi_decode_ram(data[0x0C] << 8 | data[0x0B]) +
-			   " Memory Controller");
+  // loop through the controller's slots and link them to us
+  for (int i = 0; i < dm.byte(0x0E); i++)
+    newnode.attractHandle(dmi_handle(dm.word(0x0F + 2 * i)));
 
-	hardwarenode->addChild(newnode);
-      }
-      break;
+  newnode.setProduct(dmi_decode_ram(dm.word(0x0B)) + " Memory Controller");
 
-    case 6:
-      // Memory Bank (obsolete in DMI 2.1+)
-      // therefore ignore the entry if the DMI version is recent enough
-      if ((dmiversionmaj < 2)
-	  || ((dmiversionmaj == 2) && (dmiversionmin < 1)))
-      {
-	hwNode newnode("bank",
-		       hw::memory);
-	hwNode *controllernode = NULL;
-	unsigned long long clock = 0;
-	unsigned long long capacity = 0;
-	unsigned long long size = 0;
-
-	newnode.setSlot(dmi_string(dm, data[4]).c_str());
-	if (data[6])
-	  clock = 1000000000 / data[6];	// convert value from ns to Hz
-	newnode.setClock(clock);
-	newnode.setDescription(dmi_decode_ram(data[8] << 8 | data[7]));
-	// installed size
-	switch (data[9] & 0x7F)
-	{
-	case 0x7D:
-	case 0x7E:
-	case 0x7F:
-	  break;
-	default:
-	  size = (1 << (data[9] & 0x7F)) << 20;
-	}
-	if (data[9] & 0x80)
-	  size *= 2;
-	// enabled size
-	switch (data[10] & 0x7F)
-	{
-	case 0x7D:
-	case 0x7E:
-	case 0x7F:
-	  break;
-	default:
-	  capacity = (1 << (data[10] & 0x7F)) << 20;
-	}
-	if (data[10] & 0x80)
-	  capacity *= 2;
-
-	newnode.setCapacity(capacity);
-	newnode.setSize(size);
-	if ((data[11] & 4) == 0)
-	{
-	  if (data[11] & (1 << 0))
-	    // bank has uncorrectable errors (BIOS disabled)
-	    newnode.disable();
-	}
-
-	newnode.setHandle(handle);
-
-	hardwarenode->addChild(newnode);
-      }
-      break;
-    case 7:
-      // Cache
-      {
-	hwNode newnode("cache",
-		       hw::memory);
-	int level;
-
-	newnode.setSlot(dmi_string(dm, data[4]));
-	u = data[6] << 8 | data[5];
-	level = 1 + (u & 7);
-
-	if (dm->length > 0x11)
-	  newnode.
-	    setDescription(dmi_cache_describe
-			   (u, data[0x0E] << 8 | data[0x0D], data[0x11]));
-	else
-	  newnode.
-	    setDescription(dmi_cache_describe
-			   (u, data[0x0E] << 8 | data[0x0D]));
-
-	if (!(u & (1 << 7)))
-	  newnode.disable();
-
-	newnode.setSize(dmi_cache_size(data[9] | data[10] << 8));
-	newnode.setCapacity(dmi_cache_size(data[7] | (data[8] << 8)));
-	if ((dm->length > 0x0F) && (data[0x0F] != 0))
-	{
-	  newnode.setClock(1000000000 / data[0x0F]);	// convert from ns to Hz
-	}
-
-	newnode.setHandle(handle);
-	hardwarenode->addChild(newnode);
-      }
-      break;
-    case 8:
-      //printf("\tPort Connector\n");
-      //printf("\t\tInternal Designator: %s\n",
-      //dmi_string(dm, data[4]).c_str());
-      //printf("\t\tInternal Connector Type: %s\n",
-      //dmi_port_connector_type(data[5]));
-      //printf("\t\tExternal Designator: %s\n",
-      //dmi_string(dm, data[6]).c_str());
-      //printf("\t\tExternal Connector Type: %s\n",
-      //dmi_port_connector_type(data[7]));
-      //printf("\t\tPort Type: %s\n", dmi_port_type(data[8]));
-      break;
-    case 9:
-#if 0
-      {
-	hwNode newnode("cardslot",
-		       hw::bus);
-	newnode.setHandle(handle);
-	newnode.setSlot(dmi_string(dm, data[4]));
-	printf("\t\tType: %s%s%s\n",
-	       dmi_bus_width(data[6]),
-	       dmi_card_size(data[8]), dmi_bus_name(data[5]));
-	if (data[7] == 3)
-	  printf("\t\tStatus: Available.\n");
-	if (data[7] == 4)
-	  printf("\t\tStatus: In use.\n");
-	if (data[11] & 0xFE)
-	  dmi_card_props(data[11]);
-	//hardwarenode->addChild(newnode);
-      }
-#endif
-      break;
-    case 10:
-#if 0
-      printf("\tOn Board Devices Information\n");
-      for (u = 2; u * 2 + 1 < dm->length; u++)
-      {
-	printf("\t\tDescription: %s : %s\n",
-	       dmi_string(dm, data[1 + 2 * u]).c_str(),
-	       (data[2 * u]) & 0x80 ? "Enabled" : "Disabled");
-	printf("\t\tType: %s\n", dmi_onboard_type(data[2 * u]));
-      }
-#endif
+  ctx.core->addChild(newnode);
+}
 
-      break;
-    case 11:
-      // OEM Data
-      break;
-    case 12:
-      // Configuration Information
-      break;
-    case 13:
-#if 0
-      printf("\tBIOS Language Information\n");
-      printf("\t\tInstallable Languages: %u\n", data[4]);
-      for (u = 1; u <= data[4]; u++)
-      {
-	printf("\t\t\t%s\n", dmi_string(dm, u).c_str());
-      }
-      printf("\t\tCurrently Installed Language: %s\n",
-	     dmi_string(dm, data[21]).c_str());
-#endif
-      break;
-    case 14:
-      // Group Associations
-      break;
-    case 15:
-      // Event Log
-      break;
-    case 16:
-      // Physical Memory Array
-      {
-	string id = "";
-	string description = "";
-	switch (data[5])
-	{
-	case 0x03:
-	  description = "System Memory";
-	  break;
-	case 0x04:
-	  description = "Video Memory";
-	  break;
-	case 0x05:
-	  description = "Flash Memory";
-	  break;
-	case 0x06:
-	  description = "NVRAM";
-	  break;
-	case 0x07:
-	  description = "Cache Memory";
-	  break;
-	default:
-	  description = "Generic Memory";
-	}
-
-	hwNode newnode("memory",
-		       hw::memory);
-	newnode.setHandle(handle);
-	newnode.setDescription(description);
-	newnode.setSlot(dmi_memory_array_location(data[4]));
-	//printf("\t\tError Correction Type: %s\n",
-	//dmi_memory_array_error_correction_type(data[6]));
-	u2 = data[10] << 24 | data[9] << 16 | data[8] << 8 | data[7];
-	if (u2 != 0x80000000)	// magic value for "unknown"
-	  newnode.setCapacity(u2 * 1024);
-	hardwarenode->addChild(newnode);
-      }
-      break;
-    case 17:
-      // Memory Device
-      {
-	string slot = "";
-	string description = "";
-	unsigned long long size = 0;
-	unsigned long long clock = 0;
-	u16 width = 0;
-	char bits[10];
-	string arrayhandle;
-	arrayhandle = dmi_handle(data[5] << 8 | data[4]);
-	strcpy(bits, "");
-	// total width
-	u = data[9] << 8 | data[8];
-	if (u != 0xffff)
-	  width = u;
-	//data width
-	u = data[11] << 8 | data[10];
-	if ((u != 0xffff) && (u != 0))
-	{
-	  if ((u == width) || (width == 0))
-	    snprintf(bits, sizeof(bits), "%d", u);
-	  else
-	    snprintf(bits, sizeof(bits), "%d/%d", width, u);
-	}
-	else
-	{
-	  if (width != 0)
-	    snprintf(bits, sizeof(bits), "%d", width);
-	}
-
-	// size
-	u = data[13] << 8 | data[12];
-	if (u != 0xffff)
-	  size = (1024 * (u & 0x7fff) * ((u & 0x8000) ? 1 : 1024));
-	description += string(dmi_memory_device_form_factor(data[14]));
-	slot = dmi_string(dm, data[16]);
-	//printf("\t\tBank Locator: %s\n", dmi_string(dm, data[17]));
-	description += string(dmi_memory_device_type(data[18]));
-	u = data[20] << 8 | data[19];
-	if (u & 0x1ffe)
-	  description += dmi_memory_device_detail(u);
-	if (dm->length > 21)
-	{
-	  char buffer[80];
-	  u = data[22] << 8 | data[21];
-	  // speed
-	  clock = u * 1000000;	// u is a frequency in MHz
-	  if (u == 0)
-	    strcpy(buffer, "");
-	  else
-	    snprintf(buffer, sizeof(buffer),
-		     "%u MHz (%.1f ns)", u, (1000.0 / u));
-	  description += " " + string(buffer);
-	}
-
-	hwNode newnode("bank",
-		       hw::memory);
-	newnode.setHandle(handle);
-	newnode.setSlot(slot);
-	if (dm->length > 23)
-	  newnode.setVendor(dmi_string(dm, data[23]));
-	if (dm->length > 24)
-	  newnode.setSerial(dmi_string(dm, data[24]));
-	if (dm->length > 26)
-	  newnode.setProduct(dmi_string(dm, data[26]));
-	if (strlen(bits))
-	  description += " " + string(bits) + " bits";
-	newnode.setDescription(description);
-	newnode.setSize(size);
-	newnode.setClock(clock);
-	hwNode *memoryarray = hardwarenode->findChildByHandle(arrayhandle);
-	if (memoryarray)
-	  memoryarray->addChild(newnode);
-	else
-	{
-	  hwNode ramnode("memory",
-			 hw::memory);
-	  ramnode.addChild(newnode);
-	  hardwarenode->addChild(ramnode);
-	}
-      }
-      break;
-    case 18:
-      // 32-bit Memory Error Information
-      break;
-    case 19:
-      // Memory Array Mapped Address
-      {
-	hwNode newnode("range",
-		       hw::address);
-	unsigned long start, end;
-	string arrayhandle = dmi_handle(data[0x0D] << 8 | data[0x0C]);
-	start = ((data[4] | data[5] << 8) | (data[6] | data[7] << 8) << 16);
-	end = ((data[8] | data[9] << 8) | (data[10] | data[11] << 8) << 16);
-	if (end - start < 512)	// memory range is smaller thant 512KB
-	{
-	  // consider that values were expressed in megagytes
-	  start *= 1024;
-	  end *= 1024;
-	}
-
-	newnode.setStart(start * 1024);	// values are in KB
-	if (end != start)
-	  newnode.setSize((end - start + 1) * 1024);	// values are in KB
-	newnode.setHandle(handle);
-	hwNode *memoryarray = hardwarenode->findChildByHandle(arrayhandle);
-#if 0
-	if (memoryarray)
-	  memoryarray->addChild(newnode);
-#endif
-      }
-      break;
-    case 20:
-      // Memory Device Mapped Address
-      {
-	hwNode newnode("range",
-		       hw::address);
-	unsigned long start, end;
-	string devicehandle = dmi_handle(data[0x0D] << 8 | data[0x0C]);
-	start = ((data[4] | data[5] << 8) | (data[6] | data[7] << 8) << 16);
-	end = ((data[8] | data[9] << 8) | (data[10] | data[11] << 8) << 16);
-	if (end - start < 512)	// memory range is smaller than 512KB
-	{
-	  // consider that values were expressed in megagytes
-	  start *= 1024;
-	  end *= 1024;
-	}
-
-	newnode.setStart(start * 1024);	// values are in KB
-	if (end != start)
-	  newnode.setSize((end - start + 1) * 1024);	// values are in KB
-	newnode.setHandle(handle);
-	hwNode *memorydevice = hardwarenode->findChildByHandle(devicehandle);
-#if 0
-	if (memorydevice && (newnode.getSize() != 0)
-	    && (newnode.getSize() <= memorydevice->getSize()))
-	  memorydevice->addChild(newnode);
-#endif
-      }
-      break;
-    case 21:
-      // Built-In Pointing Device
-      break;
-    case 22:
-      // Portable Battery
-      break;
-    case 23:
-      // System Reset
-      break;
-    case 24:
-      // Hardware Security
-      break;
-    case 25:
-      // System Power Controls
-      break;
-    case 26:
-      // Voltage Sensor
-      break;
-    case 27:
-      // Cooling Device
-      break;
-    case 28:
-      // Temperature Sensor
-      break;
-    case 29:
-      // Current Sensor
-      break;
-    case 30:
-      // Out-of-Band Remote Access
-      break;
-    case 31:
-      // Boot Integrity Services Entry Point
-      break;
-    case 32:
-      // System Boot Information
-      break;
-    case 33:
-      // 64-bit Memory Error Information
-      break;
-    case 34:
-      // Management Device
-      break;
-    case 35:
-      // Management Device Component
-      break;
-    case 36:
-      // Management Device Threshold Data
-      break;
-    case 37:
-      // Memory Channel
-      break;
-    case 38:
-      // IPMI Device
-      break;
-    case 39:
-      // Power Supply
-      break;
-    case 126:
-      // Inactive
-      break;
-    case 127:
-      // End-of-Table
-      break;
-    default:
-      break;
-    }
-    data += dm->length;
-    while (*data || data[1])
-      data++;
-    data += 2;
-    i++;
+static void dmi_module(const dmi_structure & dm,
+		       dmi_context & ctx)
+{
+  // Memory Bank (obsolete in DMI 2.1+)
+  // therefore ignore the entry if the DMI version is recent enough
+  if (dmi_obsolete(ctx))
+    return;
+
+  hwNode newnode("bank",
+		 hw::memory);
+  unsigned long long clock = 0;
+  unsigned long long capacity = 0;
+  unsigned long long size = 0;
+
+  newnode.setSlot(dm.str(4));
+  if (dm.byte(6))
+    clock = 1000000000 / dm.byte(6);	// convert value from ns to Hz
+  newnode.setClock(clock);
+  newnode.setDescription(dmi_decode_ram(dm.word(7)));
+  // installed size
+  switch (dm.byte(9) & 0x7F)
+  {
+  case 0x7D:
+  case 0x7E:
+  case 0x7F:
+    break;
+  default:
+    size = (1 << (dm.byte(9) & 0x7F)) << 20;
+  }
+  if (dm.byte(9) & 0x80)
+    size *= 2;
+  // enabled size
+  switch (dm.byte(10) & 0x7F)
+  {
+  case 0x7D:
+  case 0x7E:
+  case 0x7F:
+    break;
+  default:
+    capacity = (1 << (dm.byte(10) & 0x7F)) << 20;
   }
-  free(buf);
+  if (dm.byte(10) & 0x80)
+    capacity *= 2;
+
+  newnode.setCapacity(capacity);
+  newnode.setSize(size);
+  if ((dm.byte(11) & 4) == 0)
+  {
+    if (dm.byte(11) & (1 << 0))
+      // bank has uncorrectable errors (BIOS disabled)
+      newnode.disable();
+  }
+
+  newnode.setHandle(dmi_handle(dm.handle));
+
+  ctx.core->addChild(newnode);
 }
 
-bool scan_dmi(hwNode & n)
+static void dmi_cache(const dmi_structure & dm,
+		      dmi_context & ctx)
 {
-  unsigned char buf[20];
-  int fd = open("/dev/mem",
-		O_RDONLY);
-  long fp = 0xE0000L;
-  u8 smmajver = 0, smminver = 0;
-  u16 dmimaj = 0, dmimin = 0;
-  if (sizeof(u8) != 1 || sizeof(u16) != 2 || sizeof(u32) != 4)
-    // compiler incompatibility
-    return false;
-  if (fd == -1)
-    return false;
-  if (lseek(fd, fp, SEEK_SET) == -1)
+  // Cache
+  hwNode newnode("cache",
+		 hw::memory);
+  char level[10];
+  u16 u;
+
+  newnode.setSlot(dm.str(4));
+  u = dm.word(5);
+
+  if (dm.length > 0x11)
+    newnode.setDescription(dmi_cache_describe(u, dm.word(0x0D),
+					      dm.byte(0x11)));
+  else
+    newnode.setDescription(dmi_cache_describe(u, dm.word(0x0D)));
+
+  if (!(u & (1 << 7)))
+    newnode.disable();
+
+  newnode.setSize(dmi_cache_size(dm.word(9)));
+  newnode.setCapacity(dmi_cache_size(dm.word(7)));
+  if (dm.byte(0x0F) != 0)
+    newnode.setClock(1000000000 / dm.byte(0x0F));	// convert from ns to Hz
+
+  // level and type let scan_cpuid() match this cache with its own
+  snprintf(level, sizeof(level), "%d", (u & 7) + 1);
+  newnode.setConfig("level", level);
+  switch (dm.byte(0x11))
   {
-    close(fd);
-    return false;
+  case 3:
+    newnode.setConfig("type", "instruction");
+    break;
+  case 4:
+    newnode.setConfig("type", "data");
+    break;
+  case 5:
+    newnode.setConfig("type", "unified");
+    break;
   }
 
-  fp -= 16;
-  while (fp < 0xFFFFF)
+  newnode.setHandle(dmi_handle(dm.handle));
+  // processors often come after their caches in the table: keep the
+  // caches until then, so that they end up below the right processor
+  ctx.caches.push_back(newnode);
+}
+
+static void dmi_array(const dmi_structure & dm,
+		      dmi_context & ctx)
+{
+  // Physical Memory Array
+  string description = "";
+  u32 u;
+
+  switch (dm.byte(5))
   {
-    fp += 16;
-    if (read(fd, buf, 16) != 16)
-    {
-      close(fd);
-      return false;
-    }
-    else if (memcmp(buf, "_SM_", 4) == 0)
-    {
-      // SMBIOS
-      smmajver = buf[6];
-      smminver = buf[7];
-    }
-    else if (memcmp(buf, "_DMI_", 5) == 0)
-    {
-      u16 num = buf[13] << 8 | buf[12];
-      u16 len = buf[7] << 8 | buf[6];
-      u32 base = buf[11] << 24 | buf[10] << 16 | buf[9] << 8 | buf[8];
-      dmimaj = buf[14] ? buf[14] >> 4 : smmajver;
-      dmimin = buf[14] ? buf[14] & 0x0F : smminver;
-      dmi_table(fd, base, len, num, n, dmimaj, dmimin);
-      /*
-       * dmi_table moved us far away 
-       */
-      lseek(fd, fp + 16, SEEK_SET);
-    }
+  case 0x03:
+    description = "System Memory";
+    break;
+  case 0x04:
+    description = "Video Memory";
+    break;
+  case 0x05:
+    description = "Flash Memory";
+    break;
+  case 0x06:
+    description = "NVRAM";
+    break;
+  case 0x07:
+    description = "Cache Memory";
+    break;
+  default:
+    description = "Generic Memory";
   }
-  close(fd);
-  if (smmajver != 0)
+
+  hwNode newnode("memory",
+		 hw::memory);
+  newnode.setHandle(dmi_handle(dm.handle));
+  newnode.setDescription(description);
+  newnode.setSlot(dmi_memory_array_location(dm.byte(4)));
+  u = dm.dword(7);
+  if (u != 0x80000000)		// magic value for "unknown"
+    newnode.setCapacity(u * 1024ULL);
+  ctx.core->addChild(newnode);
+}
+
+static void dmi_device(const dmi_structure & dm,
+		       dmi_context & ctx)
+{
+  // Memory Device
+  string description = "";
+  u32 speed = 0, configured = 0;
+  unsigned long long size = 0;
+  unsigned long long clock = 0;
+  u16 width = 0;
+  char bits[20];
+  u16 u;
+
+  strcpy(bits, "");
+  // total width
+  u = dm.word(8);
+  if (u != 0xffff)
+    width = u;
+  //data width
+  u = dm.word(10);
+  if ((u != 0xffff) && (u != 0))
   {
-    char buffer[20];
-    snprintf(buffer, sizeof(buffer), "smbios-%d.%d", smmajver, smminver);
-    n.addCapability(string(buffer));
+    if ((u == width) || (width == 0))
+      snprintf(bits, sizeof(bits), "%d", u);
+    else
+      snprintf(bits, sizeof(bits), "%d/%d", width, u);
   }
-  if (dmimaj != 0)
+  else
   {
-    char buffer[20];
-    snprintf(buffer, sizeof(buffer), "dmi-%d.%d", dmimaj, dmimin);
-    n.addCapability(string(buffer));
+    if (width != 0)
+      snprintf(bits, sizeof(bits), "%d", width);
+  }
+
+  // size
+  u = dm.word(12);
+  if ((u == 0x7fff) && (dm.length >= 0x20))	// extended size, in MB
+    size = (dm.dword(0x1C) & 0x7fffffff) * 1024ULL * 1024;
+  else if (u != 0xffff)
+    size = (1024ULL * (u & 0x7fff) * ((u & 0x8000) ? 1 : 1024));
+  description += string(dmi_memory_device_form_factor(dm.byte(14)));
+  description += string(dmi_memory_device_type(dm.byte(18)));
+  u = dm.word(19);
+  if (u & 0x1ffe)
+    description += dmi_memory_device_detail(u);
+  // rated and configured speeds (SMBIOS 2.7+), 32-bit ones in 3.3+
+  speed = dm.word(21);
+  if ((speed == 0xffff) && (dm.length >= 0x58))
+    speed = dm.dword(0x54);
+  configured = dm.word(0x20);
+  if ((configured == 0xffff) && (dm.length >= 0x5C))
+    configured = dm.dword(0x58);
+  if (dm.length > 21)
+  {
+    char buffer[80];
+    // speed
+    clock = speed * 1000000ULL;	// speed is a frequency in MHz
+    if (speed == 0)
+      strcpy(buffer, "");
+    else
+      snprintf(buffer, sizeof(buffer), "%u MHz (%.1f ns)", speed,
+	       (1000.0 / speed));
+    description += " " + string(buffer);
+  }
+
+  hwNode newnode("bank",
+		 hw::memory);
+  newnode.setHandle(dmi_handle(dm.handle));
+  newnode.setSlot(dm.str(16));
+  newnode.setVendor(dm.str(23));
+  newnode.setSerial(dm.str(24));
+  newnode.setProduct(dm.str(26));
+  if (strlen(bits))
+    description += " " + string(bits) + " bits";
+  newnode.setDescription(description);
+  newnode.setSize(size);
+  newnode.setClock(clock);
+  if (configured != 0)
+  {
+    // what the memory actually runs at
+    newnode.setClock(configured * 1000000ULL);
+    if (speed != 0)
+      newnode.setConfig("ratedspeed", dmi_mhz(speed));
+  }
+  // voltages (SMBIOS 2.8+)
+  if (dm.word(0x26) != 0)
+    newnode.setConfig("voltage", dmi_voltage(dm.word(0x26)));
+  if (dm.word(0x22) != 0)
+    newnode.setConfig("minvoltage", dmi_voltage(dm.word(0x22)));
+  if (dm.word(0x24) != 0)
+    newnode.setConfig("maxvoltage", dmi_voltage(dm.word(0x24)));
+  hwNode *memoryarray = ctx.core->findChildByHandle(dmi_handle(dm.word(4)));
+  if (memoryarray)
+    memoryarray->addChild(newnode);
+  else
+  {
+    hwNode ramnode("memory",
+		   hw::memory);
+    ramnode.addChild(newnode);
+    ctx.core->addChild(ramnode);
+  }
+
+  dmi_memory_device device;
+  device.handle = dm.handle;
+  device.array = dm.word(4);
+  device.locator = dm.str(16);
+  device.bank = dm.str(17);
+  device.size = size;
+  device.speed = speed;
+  device.configured = configured;
+  device.width = dm.word(10);
+  if ((device.width == 0xffff) || (device.width == 0))
+    device.width = width;
+  device.ranks = dm.byte(0x1B) & 0x0F;	// SMBIOS 2.6+
+  ctx.devices.push_back(device);
+}
+
+/*
+ * start and end addresses of type 20, in KB (or in bytes, as
+ * 64-bit values at offset extended, when they don't fit)
+ */
+static void dmi_range(const dmi_structure & dm,
+		      unsigned int extended,
+		      hwNode & range)
+{
+  unsigned long long start, end;
+
+  start = dm.dword(4);
+  end = dm.dword(8);
+  if ((start == 0xFFFFFFFF) && (dm.length >= extended + 16))
+  {
+    // SMBIOS 2.7+
+    start = dm.qword(extended) / 1024;
+    end = dm.qword(extended + 8) / 1024;
+  }
+  else if (end - start < 512)	// memory range is smaller than 512KB
+  {
+    // consider that values were expressed in megagytes
+    start *= 1024;
+    end *= 1024;
   }
 
+  range.setStart(start * 1024);	// values are in KB
+  if (end != start)
+    range.setSize((end - start + 1) * 1024);	// values are in KB
+  range.setHandle(dmi_handle(dm.handle));
+}
+
+static void dmi_device_range(const dmi_structure & dm,
+			     dmi_context & ctx)
+{
+  // Memory Device Mapped Address
+  hwNode newnode("range",
+		 hw::address);
+
+  dmi_range(dm, 0x13, newnode);
+  ctx.mapped[dm.word(0x0C)] += newnode.getSize();
+#if 0
+  hwNode *memorydevice = ctx.core->findChildByHandle(dmi_handle(dm.word(0x0C)));
+  if (memorydevice && (newnode.getSize() != 0)
+      && (newnode.getSize() <= memorydevice->getSize()))
+    memorydevice->addChild(newnode);
+#endif
+}
+
+/*
+ * number following one of the words in s (which must start a token), as
+ * in "CPU1", "PROC 2" or "Channel_A": when letter is true, a single
+ * letter is accepted too
+ */
+static string dmi_after(const string & s,
+			const char **words,
+			bool letter)
+{
+  for (; *words; words++)
+    for (size_t pos = s.find(*words); pos != string::npos;
+	 pos = s.find(*words, pos + 1))
+    {
+      size_t i = pos + strlen(*words);
+      size_t j = 0;
+
+      if ((pos > 0) && isalpha(s[pos - 1]))
+	continue;
+      while ((i < s.length()) && strchr(" _-#", s[i]))
+	i++;
+      for (j = i; (j < s.length()) && isdigit(s[j]); j++);
+      if ((j == i) && letter && (i < s.length()) && isalpha(s[i]))
+	j = i + 1;
+      if (j > i)
+	return s.substr(i, j - i);
+    }
+
+  return "";
+}
+
+/*
+ * guesses socket and channel from the locators of a memory device, as
+ * given by the common BIOSes: "CPU1_DIMM_B2", "P2-DIMMC1", "DIMM_A1"
+ * with "NODE 1", "P0_Node0_Channel1_Dimm0"...
+ */
+static void dmi_locate(const dmi_memory_device & device,
+		       string & socket,
+		       string & channel)
+{
+  static const char *sockets[] = { "CPU", "PROC", "SOCKET", "P", NULL };
+  static const char *nodes[] = { "NODE", NULL };
+  static const char *channels[] = { "CHANNEL", NULL };
+  static const char *dimms[] = { "DIMM", NULL };
+  string locator = device.bank + " " + device.locator;
+
+  for (size_t i = 0; i < locator.length(); i++)
+    locator[i] = toupper(locator[i]);
+
+  socket = dmi_after(locator, sockets, false);
+  if (socket == "")
+    socket = dmi_after(locator, nodes, false);
+
+  channel = dmi_after(locator, channels, true);
+  if (channel == "")
+  {
+    // DIMM_A1, DIMMB2, A1: a letter followed by the slot number
+    string slot = dmi_after(locator, dimms, true);
+
+    if ((slot.length() == 1) && isalpha(slot[0]))
+      channel = slot;
+  }
+  if (channel == "")
+  {
+    size_t i = locator.length();
+
+    while ((i > 0) && isdigit(locator[i - 1]))
+      i--;
+    if ((i > 0) && (i < locator.length()) && isalpha(locator[i - 1]) &&
+	((i == 1) || !isalnum(locator[i - 2])))
+      channel = locator.substr(i - 1, 1);
+  }
+}
+
+static string dmi_size(unsigned long long size)
+{
+  const char *prefixes = "KMGTPE";
+  int i = 0;
+  char buffer[30];
+
+  while ((size >= 1024) && (size % 1024 == 0) && (i < 6))
+  {
+    size >>= 10;
+    i++;
+  }
+
+  snprintf(buffer, sizeof(buffer), "%llu%sB", size,
+	   (i > 0) ? string(1, prefixes[i - 1]).c_str() : "");
+
+  return string(buffer);
+}
+
+struct dmi_channel
+{
+  int slots, dimms;
+  unsigned long long size;
+  int ranks;			// 0 when unknown
+  unsigned int speed;		// configured (or rated) one of the slowest DIMM
+  unsigned int width;
+};
+
+struct dmi_socket
+{
+  map < string, dmi_channel > channels;
+  vector < u16 > arrays;
+  unsigned int fastest;		// configured speed of the fastest DIMM
+  int unmapped;
+  bool complete;		// all DIMMs have a known channel
+};
+
+/*
+ * the value per channel when it is the same for all of them, or the
+ * list of the values of each channel
+ */
+static string dmi_symmetry(const map < string, unsigned long long >&values,
+			   bool size,
+			   bool & symmetric)
+{
+  string result = "";
+  string common = "";
+
+  symmetric = true;
+  for (map < string, unsigned long long >::const_iterator i =
+       values.begin(); i != values.end(); i++)
+  {
+    char buffer[30];
+    string value = "";
+
+    if (size)
+      value = dmi_size(i->second);
+    else
+    {
+      snprintf(buffer, sizeof(buffer), "%llu", i->second);
+      value = buffer;
+    }
+    if (i == values.begin())
+      common = value;
+    symmetric = symmetric && (value == common);
+    result += (result == "" ? "" : ",") + i->first + ":" + value;
+  }
+
+  return symmetric ? common : result;
+}
+
+/*
+ * socket -> memory array -> channel -> slot model of the memory devices,
+ * reported for each socket on its memory array: populated channels,
+ * capacity, ranks and DIMMs per channel, theoretical peak bandwidth, and
+ * what keeps the channels from being interleaved evenly (empty channels,
+ * asymmetric channels, DIMMs left out of the address map); banks are
+ * flagged when they run below their rated speed or below the fastest one
+ * of their socket
+ */
+static void dmi_memory_layout(dmi_context & ctx)
+{
+  map < string, dmi_socket > sockets;
+  map < u16, string > owners;	// memory array -> its only socket, if any
+  vector < u16 > arrays;
+  vector < string > socketof(ctx.devices.size());
+
+  for (size_t i = 0; i < ctx.devices.size(); i++)
+  {
+    const dmi_memory_device & device = ctx.devices[i];
+    hwNode *bank = ctx.core->findChildByHandle(dmi_handle(device.handle));
+    string socket = "";
+    string channel = "";
+    size_t array = 0;
+    unsigned int speed = 0;
+
+    while ((array < arrays.size()) && (arrays[array] != device.array))
+      array++;
+    if (array == arrays.size())
+      arrays.push_back(device.array);
+
+    dmi_locate(device, socket, channel);
+    if (socket == "")		// one memory array per socket
+    {
+      char buffer[30];
+      snprintf(buffer, sizeof(buffer), "%lu", (unsigned long) array);
+      socket = buffer;
+    }
+
+    if (sockets.find(socket) == sockets.end())
+    {
+      sockets[socket].fastest = 0;
+      sockets[socket].unmapped = 0;
+      sockets[socket].complete = true;
+    }
+    socketof[i] = socket;
+    dmi_socket & s = sockets[socket];
+    if ((device.size != 0) && (device.configured > s.fastest))
+      s.fastest = device.configured;
+    if (find(s.arrays.begin(), s.arrays.end(), device.array) ==
+	s.arrays.end())
+      s.arrays.push_back(device.array);
+    if (owners.find(device.array) == owners.end())
+      owners[device.array] = socket;
+    else if (owners[device.array] != socket)
+      owners[device.array] = "";
+
+    if (channel == "")
+    {
+      s.complete = s.complete && (device.size == 0);
+      continue;
+    }
+
+    if (bank)
+    {
+      bank->setConfig("socket", socket);
+      bank->setConfig("channel", channel);
+    }
+
+    if (s.channels.find(channel) == s.channels.end())
+      memset(&s.channels[channel], 0, sizeof(dmi_channel));
+    dmi_channel & c = s.channels[channel];
+    c.slots++;
+    if (device.size == 0)
+      continue;
+
+    if ((c.dimms == 0) || ((c.ranks != 0) && (device.ranks != 0)))
+      c.ranks += device.ranks;
+    else
+      c.ranks = 0;
+    speed = device.configured ? device.configured : device.speed;
+    if ((speed != 0) && ((c.speed == 0) || (speed < c.speed)))
+      c.speed = speed;
+    c.width = device.width;
+    c.dimms++;
+    c.size += device.size;
+    if (!ctx.mapped.empty() &&
+	(ctx.mapped.find(device.handle) == ctx.mapped.end()))
+      s.unmapped++;
+  }
+
+  // banks running slower than they are rated for, or than the others
+  for (size_t i = 0; i < ctx.devices.size(); i++)
+  {
+    const dmi_memory_device & device = ctx.devices[i];
+    hwNode *bank = NULL;
+    string downclocked = "";
+
+    if ((device.size == 0) || (device.configured == 0))
+      continue;
+    if ((device.speed != 0) && (device.configured < device.speed))
+      downclocked = "rated";
+    if (device.configured < sockets[socketof[i]].fastest)
+      downclocked += string((downclocked != "") ? "," : "") + "socket";
+    if (downclocked == "")
+      continue;
+    bank = ctx.core->findChildByHandle(dmi_handle(device.handle));
+    if (bank)
+      bank->setConfig("downclocked", downclocked);
+  }
+
+  for (map < string, dmi_socket >::iterator i = sockets.begin();
+       i != sockets.end(); i++)
+  {
+    dmi_socket & s = i->second;
+    map < string, unsigned long long >sizes, ranks, dimms;
+    hwNode *node = NULL;
+    string prefix = "";
+    string unbalanced = "";
+    unsigned long long bandwidth = 0;
+    bool symmetric = true;
+    bool knownranks = true;
+    char buffer[80];
+
+    for (map < string, dmi_channel >::iterator c = s.channels.begin();
+	 c != s.channels.end(); c++)
+      if (c->second.dimms > 0)
+      {
+	sizes[c->first] = c->second.size;
+	ranks[c->first] = c->second.ranks;
+	dimms[c->first] = c->second.dimms;
+	knownranks = knownranks && (c->second.ranks != 0);
+	bandwidth += 1000000ULL * c->second.speed * (c->second.width / 8);
+      }
+    if (!s.complete || sizes.empty())
+      continue;
+
+    // on the memory array, unless it is shared with other sockets
+    node = ctx.core->findChildByHandle(dmi_handle(s.arrays[0]));
+    if (!node)
+      continue;
+    if ((s.arrays.size() > 1) || (owners[s.arrays[0]] != i->first))
+      prefix = "socket" + i->first + ".";
+
+    snprintf(buffer, sizeof(buffer), "%lu/%lu", (unsigned long) sizes.size(),
+	     (unsigned long) s.channels.size());
+    node->setConfig(prefix + "channels", buffer);
+    if (sizes.size() < s.channels.size())
+      unbalanced += ",channels";
+
+    node->setConfig(prefix + "channelsize",
+		    dmi_symmetry(sizes, true, symmetric));
+    if (!symmetric)
+      unbalanced += ",channelsize";
+    if (knownranks)
+    {
+      node->setConfig(prefix + "ranks", dmi_symmetry(ranks, false, symmetric));
+      if (!symmetric)
+	unbalanced += ",ranks";
+    }
+    node->setConfig(prefix + "dimmsperchannel",
+		    dmi_symmetry(dimms, false, symmetric));
+    if (!symmetric)
+      unbalanced += ",dimmsperchannel";
+
+    if (bandwidth > 0)
+    {
+      snprintf(buffer, sizeof(buffer), "%.1fGB/s", bandwidth / 1e9);
+      node->setConfig(prefix + "bandwidth", buffer);
+    }
+
+    if (s.unmapped > 0)
+    {
+      snprintf(buffer, sizeof(buffer), "%d", s.unmapped);
+      node->setConfig(prefix + "unmapped", buffer);
+      unbalanced += ",unmapped";
+    }
+    if (unbalanced != "")
+      node->setConfig(prefix + "unbalanced", unbalanced.substr(1));
+  }
+}
+
+/*
+ * the structure types we know about: the others (ports, slots, sensors,
+ * event log...) are skipped
+ */
+typedef void (*dmi_decoder) (const dmi_structure &, dmi_context &);
+
+static const struct
+{
+  u8 type;
+  dmi_decoder decode;
+}
+dmi_decoders[] =
+{
+  {0, dmi_bios},
+  {1, dmi_system},
+  {2, dmi_board},
+  {3, dmi_chassis},
+  {4, dmi_processor},
+  {5, dmi_controller},
+  {6, dmi_module},
+  {7, dmi_cache},
+  {16, dmi_array},
+  {17, dmi_device},
+  {20, dmi_device_range},
+};
+
+/*
+ * decodes the structures of a whole table (only those whose types are
+ * listed in types, if not NULL): buf must be followed by two zero bytes
+ * so that the strings of a truncated last structure end
+ */
+static void dmi_table(const u8 * buf,
+		      u32 len,
+		      hwNode & node,
+		      int dmiversionmaj,
+		      int dmiversionmin,
+		      const int *types = NULL)
+{
+  dmi_decoder decoders[256];
+  dmi_context ctx;
+  const u8 *data = buf;
+  const u8 *last = buf + len;
+
+  memset(decoders, 0, sizeof(decoders));
+  for (size_t i = 0; i < sizeof(dmi_decoders) / sizeof(dmi_decoders[0]); i++)
+  {
+    bool wanted = (types == NULL);
+
+    for (const int *t = types; t && (*t >= 0) && !wanted; t++)
+      wanted = (*t == dmi_decoders[i].type);
+    if (wanted)
+      decoders[dmi_decoders[i].type] = dmi_decoders[i].decode;
+  }
+
+  if (len < 4)
+    return;
+
+  ctx.node = &node;
+  ctx.core = node.getChild("core");
+  if (!ctx.core)
+    ctx.core = node.addChild(hwNode("core", hw::bus));
+  if (!ctx.core)
+    ctx.core = &node;
+  ctx.dmiversionmaj = dmiversionmaj;
+  ctx.dmiversionmin = dmiversionmin;
+
+  while (data + 4 <= last)
+  {
+    dmi_structure dm;
+
+    dm.data = data;
+    dm.type = data[0];
+    dm.length = data[1];
+    dm.handle = data[2] | data[3] << 8;
+
+    /*
+     * we won't read beyond allocated memory 
+     */
+    if ((dm.length < 4) || (data + dm.length > last))
+      // incomplete structure, abort decoding
+      break;
+
+    data += dm.length;
+    dm.strings = data;
+    while ((data + 1 < last) && (*data || data[1]))
+      data++;
+    dm.end = data + 1;
+    data += 2;
+
+    if (decoders[dm.type])
+      decoders[dm.type] (dm, ctx);
+  }
+
+  for (size_t i = 0; i < ctx.caches.size(); i++)
+    ctx.core->addChild(ctx.caches[i]);
+
+  if (!ctx.devices.empty())
+    dmi_memory_layout(ctx);
+}
+
+/*
+ * reads size bytes (up to the end of the file if size is 0) in as few
+ * calls as possible, adding two zero bytes for dmi_table()
+ */
+static bool read_table(int fd,
+		       size_t size,
+		       string & data)
+{
+  size_t chunk = size ? size : 0x10000;
+  char *buffer = (char *) malloc(chunk);
+  ssize_t count = 0;
+
+  if (!buffer)
+    return false;
+
+  data = "";
+  while (((size == 0) || (data.length() < size)) &&
+	 ((count = vfs_read(fd, buffer,
+			    size ? size - data.length() : chunk)) > 0))
+    data += string(buffer, count);
+  free(buffer);
+
+  data += string(2, '\0');
+  return count >= 0;
+}
+
+/*
+ * entry points: the SMBIOS 3 one has a 64-bit table address and a 32-bit
+ * length, the SMBIOS 2 one embeds a legacy DMI one (which can also be
+ * found alone)
+ */
+struct dmi_entry
+{
+  int smmajver, smminver;
+  int dmimaj, dmimin;
+  u64 base;
+  u32 len;
+};
+
+static u32 le32(const u8 * p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (u32) p[3] << 24;
+}
+
+static bool dmi_entry_point(const u8 * buf,
+			    size_t len,
+			    dmi_entry & entry)
+{
+  memset(&entry, 0, sizeof(entry));
+
+  if ((len >= 0x18) && (memcmp(buf, "_SM3_", 5) == 0))
+  {
+    entry.smmajver = entry.dmimaj = buf[7];
+    entry.smminver = entry.dmimin = buf[8];
+    entry.len = le32(buf + 0x0c);	// maximum size
+    entry.base = le32(buf + 0x10) | (u64) le32(buf + 0x14) << 32;
+    return true;
+  }
+
+  if ((len >= 0x1f) && (memcmp(buf, "_SM_", 4) == 0))
+  {
+    entry.smmajver = buf[6];
+    entry.smminver = buf[7];
+    buf += 0x10;
+    len -= 0x10;
+  }
+
+  if ((len >= 0x0f) && (memcmp(buf, "_DMI_", 5) == 0))
+  {
+    entry.len = buf[7] << 8 | buf[6];
+    entry.base = le32(buf + 8);
+    entry.dmimaj = buf[14] ? buf[14] >> 4 : entry.smmajver;
+    entry.dmimin = buf[14] ? buf[14] & 0x0F : entry.smminver;
+    return true;
+  }
+
+  return false;
+}
+
+/*
+ * the kernel exports the entry point and the table: no need to be root
+ * and it works where /dev/mem doesn't, like UEFI systems
+ */
+static bool scan_sysfs(dmi_entry & entry,
+		       string & table)
+{
+  struct stat info;
+  string entrypoint = "";
+  int fd = -1;
+  bool result = false;
+
+  fd = vfs_open(SYS_FIRMWARE_DMI "/smbios_entry_point", O_RDONLY);
+  if (fd < 0)
+    return false;
+  result = read_table(fd, 0, entrypoint);
+  vfs_close(fd);
+
+  if (!result || !dmi_entry_point((const u8 *) entrypoint.data(),
+				  entrypoint.length() - 2, entry))
+    return false;
+
+  if (vfs_stat(SYS_FIRMWARE_DMI "/DMI", &info) != 0)
+    info.st_size = 0;
+  fd = vfs_open(SYS_FIRMWARE_DMI "/DMI", O_RDONLY);
+  if (fd < 0)
+    return false;
+  result = read_table(fd, info.st_size, table);
+  vfs_close(fd);
+
+  return result;
+}
+
+/*
+ * the entry point is in the BIOS area, on a 16-byte boundary
+ */
+static bool scan_devmem(dmi_entry & entry,
+			string & table)
+{
+  int fd = vfs_open("/dev/mem", O_RDONLY);
+  string bios = "";
+  bool result = false;
+
+  if (fd == -1)
+    return false;
+
+  if ((vfs_lseek(fd, 0xE0000L, SEEK_SET) != -1) &&
+      read_table(fd, 0x20000, bios))
+    for (size_t fp = 0; fp + 16 <= bios.length() - 2; fp += 16)
+      if (dmi_entry_point((const u8 *) bios.data() + fp,
+			  bios.length() - 2 - fp, entry))
+      {
+	result = (entry.len > 0) &&
+	  (vfs_lseek(fd, entry.base, SEEK_SET) != -1) &&
+	  read_table(fd, entry.len, table);
+	break;
+      }
+
+  vfs_close(fd);
+  return result;
+}
+
+/*
+ * table is what read_table() returned
+ */
+static void dmi_decode(const dmi_entry & entry,
+		       const string & table,
+		       hwNode & n,
+		       const int *types)
+{
+  u32 len = entry.len;
+
+  // the entry point gives the size of the table or an upper bound
+  if (table.length() - 2 < len)
+    len = table.length() - 2;
+
+  dmi_table((const u8 *) table.data(), len, n, entry.dmimaj,
+	    entry.dmimin, types);
+
+  if (entry.smmajver != 0)
+  {
+    char buffer[20];
+    snprintf(buffer, sizeof(buffer), "smbios-%d.%d", entry.smmajver,
+	     entry.smminver);
+    n.addCapability(string(buffer));
+  }
+  if (entry.dmimaj != 0)
+  {
+    char buffer[20];
+    snprintf(buffer, sizeof(buffer), "dmi-%d.%d", entry.dmimaj,
+	     entry.dmimin);
+    n.addCapability(string(buffer));
+  }
+}
+
+bool scan_dmi(hwNode & n,
+	      const int *types)
+{
+  dmi_entry entry;
+  string table = "";
+
+  if (sizeof(u8) != 1 || sizeof(u16) != 2 || sizeof(u32) != 4)
+    // compiler incompatibility
+    return false;
+
+  if (!scan_sysfs(entry, table) && !scan_devmem(entry, table))
+    return false;
+
+  dmi_decode(entry, table, n, types);
+
+  return true;
+}
+
+/*
+ * dumps taken on other machines: a smbios_entry_point and a DMI file
+ * in the directory of each host, either as files or in a tar archive
+ * (which is mapped in memory)
+ */
+struct dmi_dump
+{
+  string host;
+  string files[2];		// entry point and table, unless archived
+  const char *archived[2];
+  size_t sizes[2];
+};
+
+struct dmi_dumps
+{
+  vector < dmi_dump > dumps;
+  map < string, size_t > hosts;	// directory -> index in dumps
+  size_t first;			// of the batch being decoded
+  vector < hwNode > nodes;
+  vector < char >decoded;	// not vector<bool>: written by several threads
+  const int *types;
+};
+
+static const char *dmi_dump_files[] = { "smbios_entry_point", "DMI" };
+
+/*
+ * host name for the directory of a dump: the sysfs directories it was
+ * copied with, if any, are not part of it
+ */
+static string dmi_dump_host(string dir)
+{
+  static const char *sysfs[] = { "tables", "dmi", "firmware", "sys" };
+
+  for (size_t i = 0; i < sizeof(sysfs) / sizeof(sysfs[0]); i++)
+  {
+    size_t slash = dir.rfind('/');
+    string last = (slash == string::npos) ? dir : dir.substr(slash + 1);
+
+    if (last != sysfs[i])
+      break;
+    dir = (slash == string::npos) ? "" : dir.substr(0, slash);
+  }
+
+  return dir;
+}
+
+static void dmi_dump_add(dmi_dumps & d,
+			 const string & path,
+			 const char *data,
+			 size_t size)
+{
+  size_t slash = path.rfind('/');
+  string dir = (slash == string::npos) ? "" : path.substr(0, slash);
+  string name = (slash == string::npos) ? path : path.substr(slash + 1);
+  int which = -1;
+
+  for (int i = 0; i < 2; i++)
+    if (name == dmi_dump_files[i])
+      which = i;
+  if (which < 0)
+    return;
+
+  if (d.hosts.find(dir) == d.hosts.end())
+  {
+    dmi_dump dump;
+
+    dump.host = dmi_dump_host(dir);
+    dump.archived[0] = dump.archived[1] = NULL;
+    dump.sizes[0] = dump.sizes[1] = 0;
+    d.hosts[dir] = d.dumps.size();
+    d.dumps.push_back(dump);
+  }
+
+  dmi_dump & dump = d.dumps[d.hosts[dir]];
+  dump.files[which] = path;
+  dump.archived[which] = data;
+  dump.sizes[which] = size;
+}
+
+static void dmi_dump_scandir(dmi_dumps & d,
+			     const string & top,
+			     const string & dir)
+{
+  DIR *entries = opendir((top + "/" + dir).c_str());
+  struct dirent *entry = NULL;
+  vector < string > names;
+
+  if (!entries)
+    return;
+  while ((entry = readdir(entries)) != NULL)
+    if (entry->d_name[0] != '.')
+      names.push_back(entry->d_name);
+  closedir(entries);
+
+  // hosts come out in a predictable order
+  sort(names.begin(), names.end());
+
+  for (size_t i = 0; i < names.size(); i++)
+  {
+    string path = (dir == "") ? names[i] : dir + "/" + names[i];
+    struct stat buf;
+
+    if (lstat((top + "/" + path).c_str(), &buf) != 0)
+      continue;
+    if (S_ISDIR(buf.st_mode))
+      dmi_dump_scandir(d, top, path);
+    else if (S_ISREG(buf.st_mode))
+      dmi_dump_add(d, path, NULL, 0);
+  }
+}
+
+static unsigned long long dmi_octal(const char *s,
+				    size_t len)
+{
+  unsigned long long result = 0;
+  size_t i = 0;
+
+  while ((i < len) && (s[i] == ' '))
+    i++;
+  for (; (i < len) && (s[i] >= '0') && (s[i] <= '7'); i++)
+    result = result * 8 + (s[i] - '0');
+
+  return result;
+}
+
+/*
+ * POSIX (ustar) and GNU tar archives: the members are used in place
+ */
+static bool dmi_dump_scantar(dmi_dumps & d,
+			     const char *data,
+			     size_t size)
+{
+  string longname = "";
+  size_t pos = 0;
+
+  if ((size < 512) || (memcmp(data + 257, "ustar", 5) != 0))
+    return false;
+
+  while (pos + 512 <= size)
+  {
+    const char *header = data + pos;
+    unsigned long long length = dmi_octal(header + 124, 12);
+    string name = string(header, strnlen(header, 100));
+
+    if (header[0] == '\0')	// end of archive
+      break;
+    if (header[345] && (longname == ""))
+      name = string(header + 345, strnlen(header + 345, 155)) + "/" + name;
+    if (longname != "")
+      name = longname;
+    longname = "";
+
+    pos += 512;
+    if (length > size - pos)
+      break;
+
+    if (header[156] == 'L')	// GNU long name of the next member
+      longname = string(data + pos, strnlen(data + pos, length));
+    else if ((header[156] == '0') || (header[156] == '\0'))
+    {
+      while (name.substr(0, 2) == "./")
+	name = name.substr(2);
+      dmi_dump_add(d, name, data + pos, length);
+    }
+
+    pos += (length + 511) & ~511ULL;
+  }
+
+  return true;
+}
+
+static void dmi_dump_decode(unsigned int index,
+			    void *data)
+{
+  dmi_dumps & d = *(dmi_dumps *) data;
+  const dmi_dump & dump = d.dumps[d.first + index];
+  string contents[2];
+  dmi_entry entry;
+
+  for (int i = 0; i < 2; i++)
+    if (dump.archived[i])
+      contents[i] = string(dump.archived[i], dump.sizes[i]) + string(2, '\0');
+    else
+    {
+      int fd = open(dump.files[i].c_str(), O_RDONLY);
+
+      if (fd < 0)
+	return;
+      if (!read_table(fd, 0, contents[i]))
+	contents[i] = "";
+      close(fd);
+    }
+
+  if ((contents[0].length() < 2) || (contents[1].length() < 2) ||
+      !dmi_entry_point((const u8 *) contents[0].data(),
+		       contents[0].length() - 2, entry))
+    return;
+
+  dmi_decode(entry, contents[1], d.nodes[index], d.types);
+  d.decoded[index] = true;
+}
+
+bool scan_dmi_dumps(const string & path,
+		    dmi_dump_output output,
+		    void *data,
+		    const int *types)
+{
+  dmi_dumps d;
+  struct stat buf;
+  void *archive = MAP_FAILED;
+  size_t batch = 64 * parallel_workers();
+
+  if (stat(path.c_str(), &buf) != 0)
+    return false;
+
+  if (S_ISDIR(buf.st_mode))
+    dmi_dump_scandir(d, path, "");
+  else
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+      return false;
+    if (buf.st_size > 0)
+      archive = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (archive == MAP_FAILED)
+      return false;
+    if (!dmi_dump_scantar(d, (const char *) archive, buf.st_size))
+    {
+      munmap(archive, buf.st_size);
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < d.dumps.size(); i++)
+  {
+    string host = d.dumps[i].host;
+
+    if (host == "")
+    {
+      size_t slash = path.find_last_not_of('/');
+      host = path.substr(0, slash + 1);
+      host = host.substr(host.rfind('/') + 1);
+    }
+    d.dumps[i].host = host;
+    if (!d.dumps[i].archived[0])
+      for (int j = 0; j < 2; j++)
+	d.dumps[i].files[j] = path + "/" + d.dumps[i].files[j];
+  }
+
+  // decoded by batches, so that the trees of a whole fleet aren't all in
+  // memory at once
+  d.types = types;
+  for (d.first = 0; d.first < d.dumps.size(); d.first += batch)
+  {
+    size_t count = d.dumps.size() - d.first;
+
+    if (count > batch)
+      count = batch;
+    d.nodes.clear();
+    for (size_t i = 0; i < count; i++)
+      d.nodes.push_back(hwNode(d.dumps[d.first + i].host, hw::system));
+    d.decoded.assign(count, false);
+
+    parallel_for(count, dmi_dump_decode, &d);
+
+    for (size_t i = 0; i < count; i++)
+      output(d.nodes[i], d.decoded[i] != 0, data);
+  }
+
+  if (archive != MAP_FAILED)
+    munmap(archive, buf.st_size);
+
   return true;
 }
 
@@ -3,6 +3,27 @@
 
 #include "hw.h"
 
-bool scan_dmi(hwNode & n);
+/*
+ * types: the SMBIOS structure types to decode, terminated by -1 (all of
+ * them when NULL), e.g. { 4, 16, 17, 19, 20, -1 } for processors and memory
+ */
+bool scan_dmi(hwNode & n,
+	      const int *types = NULL);
+
+/*
+ * decodes SMBIOS dumps from other machines instead: path is a directory
+ * or a tar archive holding the smbios_entry_point and DMI files of each
+ * host in a directory named after it. the dumps are decoded in parallel
+ * and output() gets the trees one by one, in the order they were found
+ * (decoded is false for the dumps that couldn't be)
+ */
+typedef void (*dmi_dump_output) (hwNode & host,
+				 bool decoded,
+				 void *data);
+
+bool scan_dmi_dumps(const string & path,
+		    dmi_dump_output output,
+		    void *data = NULL,
+		    const int *types = NULL);
 
 #endif
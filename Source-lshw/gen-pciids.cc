@@ -0,0 +1,19 @@
+#include "pcidb.h"
+
+/*
+ * compiles pci.ids files (colon-separated list) into C++ tables for the
+ * built-in database, see pcidb.h
+ */
+int main(int argc,
+	 char **argv)
+{
+  if (argc > 2)
+  {
+    std::cerr << "usage: " << argv[0] << " [pci.ids[:pci.ids...]]" << std::endl;
+    return 1;
+  }
+
+  return pcidb_embed((argc == 2) ? argv[1] : "", std::cout) ? 0 : 1;
+}
+
+static char *id = "@(#) $Id$";
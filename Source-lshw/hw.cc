@@ -2,7 +2,9 @@
 #include "osutils.h"
 #include <vector>
 #include <map>
+#include <set>
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>
 
 using namespace hw;
@@ -475,10 +477,31 @@ static string generateId(const string & radical,
   return radical + ":" + string(buffer);
 }
 
+void hwNode::swap(hwNode & node)
+{
+  struct hwNode_i *tmp = This;
+
+  This = node.This;
+  node.This = tmp;
+}
+
 hwNode *hwNode::addChild(const hwNode & node)
+{
+  hwNode copy(node);
+
+  return moveChild(copy);
+}
+
+/*
+ * adds node without copying it (nor its children): its contents are taken
+ * over, node is left empty
+ */
+hwNode *hwNode::moveChild(hwNode & node)
 {
   hwNode *existing = NULL;
   string id = node.getId();
+  string prefix = id + ":";
+  set < int >used;
   int count = 0;
 
   if (!This)
@@ -487,25 +510,54 @@ hwNode *hwNode::addChild(const hwNode & node)
   // first see if the new node is attracted by one of our children
   for (int i = 0; i < This->children.size(); i++)
     if (This->children[i].attractsNode(node))
-      return This->children[i].addChild(node);
+      return This->children[i].moveChild(node);
 
-  existing = getChild(id);
-  if (existing)			// first rename existing instance
+  // a single pass to see which numbered names are taken: looking each
+  // one up made adding n siblings cost n^3
+  for (int i = 0; i < This->children.size(); i++)
   {
-    while (getChild(generateId(id, count)))	// find a usable name
-      count++;
+    string childid = This->children[i].getId();
+
+    if (childid == id)
+      existing = &(This->children[i]);
+    else if ((childid.compare(0, prefix.length(), prefix) == 0) &&
+	     (childid.length() > prefix.length()) &&
+	     (childid.find_first_not_of("0123456789", prefix.length()) ==
+	      string::npos))
+      used.insert(atoi(childid.c_str() + prefix.length()));
+  }
 
+  while (used.find(count) != used.end())	// find a usable name
+    count++;
+
+  if (existing)			// first rename existing instance
+  {
     existing->setId(generateId(id, count));	// rename
+    used.insert(count);
+    while (used.find(count) != used.end())
+      count++;
   }
 
-  while (getChild(generateId(id, count)))
-    count++;
+  // growing the vector would copy every child and their whole subtrees
+  if (This->children.size() == This->children.capacity())
+  {
+    vector < hwNode > children;
+
+    children.reserve(2 * This->children.size() + 1);
+    for (int i = 0; i < This->children.size(); i++)
+    {
+      children.push_back(hwNode(""));
+      children.back().swap(This->children[i]);
+    }
+    This->children.swap(children);
+  }
 
-  This->children.push_back(node);
-  if (existing || getChild(generateId(id, 0)))
+  This->children.push_back(hwNode(""));
+  This->children.back().swap(node);
+  if (existing || (used.find(0) != used.end()))
     This->children.back().setId(generateId(id, count));
 
-  return getChild(This->children.back().getId());
+  return &(This->children.back());
 }
 
 void hwNode::attractHandle(const string & handle)
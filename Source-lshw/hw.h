@@ -91,6 +91,8 @@ class hwNode
 	hwNode * findChildByHandle(const string & handle);
 	hwNode * findChildByLogicalName(const string & handle);
 	hwNode * addChild(const hwNode & node);
+	hwNode * moveChild(hwNode & node);	// leaves node empty
+	void swap(hwNode & node);
 	bool isBus() const
 	{
 	  return countChildren()>0;
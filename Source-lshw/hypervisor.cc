@@ -0,0 +1,117 @@
+#include "hypervisor.h"
+#include "cpuid.h"
+#include "osutils.h"
+
+#define SYS_HYPERVISOR "/sys/hypervisor"
+
+/*
+ * CPUID signatures (leaf 0x40000000)
+ */
+static const struct
+{
+  const char *signature;
+  const char *name;
+} hypervisor_signatures[] =
+{
+  {"KVMKVMKVM", "kvm"},
+  {"Linux KVM Hv", "kvm"},
+  {"Microsoft Hv", "hyperv"},
+  {"VMwareVMware", "vmware"},
+  {"XenVMMXenVMM", "xen"},
+  {"VBoxVBoxVBox", "virtualbox"},
+  {"TCGTCGTCGTCG", "qemu"},
+  {"bhyve bhyve ", "bhyve"},
+  {" lrpepyh  vr", "parallels"},
+  {"ACRNACRNACRN", "acrn"},
+};
+
+/*
+ * what virtual machines say they are in SMBIOS: both strings have to be
+ * found in the system vendor and product ("" matches anything)
+ */
+static const struct
+{
+  const char *vendor;
+  const char *product;
+  const char *name;
+} hypervisor_systems[] =
+{
+  {"QEMU", "", "qemu"},
+  {"", "KVM", "kvm"},
+  {"VMware", "", "vmware"},
+  {"innotek GmbH", "", "virtualbox"},
+  {"", "VirtualBox", "virtualbox"},
+  {"Xen", "", "xen"},
+  {"Microsoft Corporation", "Virtual Machine", "hyperv"},
+  {"Parallels", "", "parallels"},
+  {"", "BHYVE", "bhyve"},
+  {"Bochs", "", "bochs"},
+};
+
+static string hypervisor_cpuid(int n)
+{
+  string signature = cpuid_hypervisor(n);
+
+  for (size_t i = 0;
+       i < sizeof(hypervisor_signatures) / sizeof(hypervisor_signatures[0]);
+       i++)
+    if (signature == hypervisor_signatures[i].signature)
+      return hypervisor_signatures[i].name;
+
+  return "";
+}
+
+static string hypervisor_dmi(const hwNode & n)
+{
+  string vendor = n.getVendor();
+  string product = n.getProduct();
+
+  for (size_t i = 0;
+       i < sizeof(hypervisor_systems) / sizeof(hypervisor_systems[0]); i++)
+    if ((vendor.find(hypervisor_systems[i].vendor) != string::npos) &&
+	(product.find(hypervisor_systems[i].product) != string::npos))
+      return hypervisor_systems[i].name;
+
+  return "";
+}
+
+bool scan_hypervisor(hwNode & n)
+{
+  string fromcpuid = hypervisor_cpuid(0);
+  string fromsysfs = hw::strip(get_string(SYS_HYPERVISOR "/type"));
+  string fromdmi = hypervisor_dmi(n);
+  string detectedby = "";
+  string name = "";
+
+  // KVM can present itself as Hyper-V to Windows guests, then gives its
+  // own signature in the next range
+  if ((fromcpuid == "hyperv") && (hypervisor_cpuid(1) != ""))
+    fromcpuid = hypervisor_cpuid(1);
+
+  // the processor knows best, SMBIOS strings are only what the
+  // hypervisor was configured to put there
+  if (fromcpuid != "")
+    name = fromcpuid;
+  else if (fromsysfs != "")
+    name = fromsysfs;
+  else
+    name = fromdmi;
+
+  if (name == "")
+    return false;
+
+  // only the sources that agree
+  if (fromcpuid == name)
+    detectedby += ",cpuid";
+  if (fromsysfs == name)
+    detectedby += ",sysfs";
+  if (fromdmi == name)
+    detectedby += ",smbios";
+
+  n.setConfig("hypervisor", name);
+  n.setConfig("detectedby", detectedby.substr(1));
+
+  return true;
+}
+
+static char *id = "@(#) $Id$";
@@ -0,0 +1,12 @@
+#ifndef _HYPERVISOR_H_
+#define _HYPERVISOR_H_
+
+#include "hw.h"
+
+/*
+ * to be called once scan_dmi() has named the machine: n gets
+ * "hypervisor" in its configuration when it is a virtual machine
+ */
+bool scan_hypervisor(hwNode & n);
+
+#endif
@@ -1,5 +1,7 @@
 #include "cpuinfo.h"
 #include "osutils.h"
+#include "vfs.h"
+#include "probe.h"
 #include "cdrom.h"
 #include "disk.h"
 #include <sys/types.h>
@@ -74,76 +76,56 @@ static const char *description[] = {
 #define hw_config word93
 #endif
 
-static unsigned long long get_longlong(const string & path)
-{
-  FILE *in = fopen(path.c_str(), "r");
-  unsigned long long l = 0;
-
-  if (in)
-  {
-    fscanf(in, "%lld", &l);
-    fclose(in);
-  }
-
-  return l;
-}
-
-static int selectdir(const struct dirent *d)
-{
-  struct stat buf;
-
-  if (d->d_name[0] == '.')
-    return 0;
-
-  if (lstat(d->d_name, &buf) != 0)
-    return 0;
-
-  return S_ISDIR(buf.st_mode);
-}
-
 static string get_pciid(const string & bus,
 			const string & device)
 {
   char buffer[20];
-  int pcibus, pcidevfunc;
+  unsigned long long pcibus = 0, pcidevfunc = 0;
+  const char *p = NULL;
 
-  sscanf(bus.c_str(), "%x", &pcibus);
-  sscanf(device.c_str(), "%x", &pcidevfunc);
-  snprintf(buffer, sizeof(buffer), "PCI:%02x:%02x.%x", pcibus,
-	   PCI_SLOT(pcidevfunc), PCI_FUNC(pcidevfunc));
+  p = bus.c_str();
+  parse_number(p, p + bus.length(), pcibus, 16);
+  p = device.c_str();
+  parse_number(p, p + device.length(), pcidevfunc, 16);
+  snprintf(buffer, sizeof(buffer), "PCI:%02x:%02x.%x", (unsigned int) pcibus,
+	   (unsigned int) PCI_SLOT(pcidevfunc),
+	   (unsigned int) PCI_FUNC(pcidevfunc));
 
   return string(buffer);
 }
 
-static bool probe_ide(const string & name,
-		      hwNode & device)
+/*
+ * runs on a probe worker (see probe.h)
+ */
+static bool probe_ide(hwNode & device,
+		      void *)
 {
   struct hd_driveid id;
   const u_int8_t *id_regs = (const u_int8_t *) &id;
-  int fd = open(device.getLogicalName().c_str(), O_RDONLY | O_NONBLOCK);
+  int fd = vfs_open(device.getLogicalName(), O_RDONLY | O_NONBLOCK);
 
   if (fd < 0)
     return false;
 
   memset(&id, 0, sizeof(id));
-  if (ioctl(fd, HDIO_GET_IDENTITY, &id) != 0)
+  if (vfs_ioctl(fd, HDIO_GET_IDENTITY, &id, sizeof(id)) != 0)
   {
-    close(fd);
+    vfs_close(fd);
     return false;
   }
 
   u_int8_t args[4 + 512] = { WIN_IDENTIFY, 0, 0, 1, };
-  if (ioctl(fd, HDIO_DRIVE_CMD, &args) != 0)
+  if (vfs_ioctl(fd, HDIO_DRIVE_CMD, &args, sizeof(args)) != 0)
   {
     args[0] = WIN_PIDENTIFY;
-    if (ioctl(fd, HDIO_DRIVE_CMD, &args) != 0)
+    if (vfs_ioctl(fd, HDIO_DRIVE_CMD, &args, sizeof(args)) != 0)
     {
-      close(fd);
+      vfs_close(fd);
       return false;
     }
   }
 
-  close(fd);
+  vfs_close(fd);
 
   u_int16_t pidentity[256];
   for (int i = 0; i < 256; i++)
@@ -301,103 +283,114 @@ static bool probe_ide(const string & name,
   return true;
 }
 
-bool scan_ide(hwNode & n)
+struct ide_channel
 {
-  struct dirent **namelist;
-  int nentries;
+  hwNode ide;
+  vector < string > identify;
+  vector < int >probes;
 
-  pushd(PROC_IDE);
-  nentries = scandir(".", &namelist, selectdir, alphasort);
-  popd();
+    ide_channel():ide("ide", hw::storage)
+  {
+  }
+};
 
-  if (nentries < 0)
+bool scan_ide(hwNode & n)
+{
+  vector < string > namelist;
+  vector < ide_channel > channels;
+
+  if (!listdir(PROC_IDE, namelist, S_IFDIR))
     return false;
 
-  for (int i = 0; i < nentries; i++)
+  // first start probing all the drives at once...
+  for (int i = 0; i < namelist.size(); i++)
   {
     vector < string > config;
-    hwNode ide("ide",
-	       hw::storage);
+    ide_channel channel;
 
-    ide.setLogicalName(namelist[i]->d_name);
-    ide.setHandle("IDE:" + string(namelist[i]->d_name));
+    channel.ide.setLogicalName(namelist[i]);
+    channel.ide.setHandle("IDE:" + namelist[i]);
 
-    if (loadfile
-	(string(PROC_IDE) + "/" + namelist[i]->d_name + "/config", config))
+    if (loadfile(string(PROC_IDE) + "/" + namelist[i] + "/config", config))
     {
-      vector < string > identify;
-
       if (config.size() > 0)
-	splitlines(config[0], identify, ' ');
+	splitlines(config[0], channel.identify, ' ');
       config.clear();
 
-      if (identify.size() >= 1)
+      if (channel.identify.size() >= 1)
       {
-	struct dirent **devicelist;
-	int ndevices;
+	vector < string > devicelist;
 
-	pushd(string(PROC_IDE) + "/" + namelist[i]->d_name);
-	ndevices = scandir(".", &devicelist, selectdir, alphasort);
-	popd();
+	listdir(string(PROC_IDE) + "/" + namelist[i], devicelist, S_IFDIR);
 
-	for (int j = 0; j < ndevices; j++)
+	for (int j = 0; j < devicelist.size(); j++)
 	{
 	  string basepath =
-	    string(PROC_IDE) + "/" + namelist[i]->d_name + "/" +
-	    devicelist[j]->d_name;
+	    string(PROC_IDE) + "/" + namelist[i] + "/" + devicelist[j];
 	  hwNode idedevice("device",
 			   hw::storage);
+	  unsigned long long capacity = 0;
 
 	  idedevice =
 	    hwNode(get_string(basepath + "/media", "disk"), hw::storage);
 
-	  idedevice.setCapacity(512 * get_longlong(basepath + "/capacity"));
-	  idedevice.setLogicalName(string("/dev/") + devicelist[j]->d_name);
+	  if (get_number(basepath + "/capacity", capacity))
+	    idedevice.setCapacity(512 * capacity);
+	  idedevice.setLogicalName(string("/dev/") + devicelist[j]);
 	  idedevice.setProduct(get_string(basepath + "/model"));
 	  idedevice.claim();
-	  idedevice.setHandle(ide.getHandle() + ":" +
-			      string(devicelist[j]->d_name));
-
-	  probe_ide(devicelist[j]->d_name, idedevice);
+	  idedevice.setHandle(channel.ide.getHandle() + ":" + devicelist[j]);
 
-	  ide.addChild(idedevice);
-	  free(devicelist[j]);
+	  channel.probes.push_back(probe_submit(idedevice, probe_ide));
 	}
-	free(devicelist);
 
-	if (identify[0] == "pci" && identify.size() == 11)
-	{
-	  string pciid = get_pciid(identify[2], identify[4]);
-	  hwNode *parent = n.findChildByHandle(pciid);
+	channels.push_back(channel);
+      }
+    }
+  }
 
-	  ide.setDescription(hw::strip("Channel " + hw::strip(identify[10])));
+  // ... then collect the results
+  for (int i = 0; i < channels.size(); i++)
+  {
+    hwNode & ide = channels[i].ide;
+    vector < string > &identify = channels[i].identify;
 
-	  if (parent)
-	  {
-	    parent->claim();
-	    ide.setClock(parent->getClock());
-	    parent->addChild(ide);
-	  }
-	}
-	else
-	{
-	  for (int k = 0; k < ide.countChildren(); k++)
-	  {
-	    hwNode *candidate =
-	      n.findChildByLogicalName(ide.getChild(k)->getLogicalName());
-
-	    if (candidate)
-	      candidate->merge(*ide.getChild(k));
-	  }
-	  //n.addChild(ide);
-	}
-      }
+    for (int j = 0; j < channels[i].probes.size(); j++)
+    {
+      hwNode idedevice("device",
+		       hw::storage);
+
+      probe_wait(channels[i].probes[j], idedevice);
+      ide.addChild(idedevice);
+    }
+
+    if (identify[0] == "pci" && identify.size() == 11)
+    {
+      string pciid = get_pciid(identify[2], identify[4]);
+      hwNode *parent = n.findChildByHandle(pciid);
 
+      ide.setDescription(hw::strip("Channel " + hw::strip(identify[10])));
+
+      if (parent)
+      {
+	parent->claim();
+	ide.setClock(parent->getClock());
+	parent->addChild(ide);
+      }
     }
+    else
+    {
+      for (int k = 0; k < ide.countChildren(); k++)
+      {
+	hwNode *candidate =
+	  n.findChildByLogicalName(ide.getChild(k)->getLogicalName());
 
-    free(namelist[i]);
+	if (candidate)
+	  candidate->merge(*ide.getChild(k));
+      }
+      //n.addChild(ide);
+    }
   }
-  free(namelist);
 
   return false;
 }
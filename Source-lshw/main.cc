@@ -6,14 +6,19 @@
 #include "dmi.h"
 #include "cpuinfo.h"
 #include "cpuid.h"
+#include "hypervisor.h"
 #include "device-tree.h"
 #include "pci.h"
 #include "pcmcia.h"
 #include "ide.h"
 #include "scsi.h"
+#include "osutils.h"
+#include "vfs.h"
+#include "probe.h"
 
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 void usage(const char *progname)
 {
@@ -21,35 +26,79 @@ void usage(const char *progname)
   fprintf(stderr, "usage: %s [-options ...]\n", progname);
   fprintf(stderr, "\t-version      print program version\n");
   fprintf(stderr, "\t-html         output hardware tree as HTML\n");
+  fprintf(stderr,
+	  "\t-numa         list PCI devices by NUMA node instead of the tree\n");
+  fprintf(stderr,
+	  "\t-vfs          list SR-IOV virtual functions one by one\n");
+  fprintf(stderr,
+	  "\t-aer SEC      measure PCI Express error rates over SEC seconds\n");
+  fprintf(stderr,
+	  "\t-effective    measure the clock each CPU actually runs at\n");
+  fprintf(stderr,
+	  "\t-record FILE  save everything read from the system to FILE\n");
+  fprintf(stderr,
+	  "\t-replay FILE  read the system from FILE instead of the hardware\n");
+  fprintf(stderr,
+	  "\t-timeout SEC  give up on devices not answering within SEC seconds\n");
+  fprintf(stderr,
+	  "\t-smbios PATH  decode the SMBIOS dumps in PATH instead of this machine\n");
   fprintf(stderr, "\n");
 }
 
+static void printdump(hwNode & host,
+		      bool decoded,
+		      void *htmloutput)
+{
+  if (decoded)
+    print(host, *(bool *) htmloutput);
+  else
+    fprintf(stderr, "%s: invalid SMBIOS dump\n", host.getId().c_str());
+}
+
 int main(int argc,
 	 char **argv)
 {
   char hostname[80];
+  string record = "";
+  string replay = "";
+  string dumps = "";
+  double timeout = PROBE_TIMEOUT;
+  double sample = 0;
   bool htmloutput = false;
+  bool numaoutput = false;
+  bool expandvfs = false;
+  bool effective = false;
 
-  if (argc > 2)
+  for (int i = 1; i < argc; i++)
   {
-    usage(argv[0]);
-    exit(1);
-  }
-
-  if (argc == 2)
-  {
-    if (strcmp(argv[1], "-version") == 0)
+    if (strcmp(argv[i], "-version") == 0)
     {
       printf("%s\n", getpackageversion());
       exit(0);
     }
-    if (strcmp(argv[1], "-help") == 0 || strcmp(argv[1], "--help") == 0)
+    if (strcmp(argv[i], "-help") == 0 || strcmp(argv[i], "--help") == 0)
     {
       usage(argv[0]);
       exit(0);
     }
-    if (strcmp(argv[1], "-html") == 0)
+    if (strcmp(argv[i], "-html") == 0)
       htmloutput = true;
+    else if (strcmp(argv[i], "-numa") == 0)
+      numaoutput = true;
+    else if (strcmp(argv[i], "-vfs") == 0)
+      expandvfs = true;
+    else if (strcmp(argv[i], "-effective") == 0)
+      effective = true;
+    else if ((strcmp(argv[i], "-aer") == 0) && (i + 1 < argc))
+      sample = atof(argv[++i]);
+    else if ((strcmp(argv[i], "-record") == 0) && (i + 1 < argc))
+      record = argv[++i];
+    else if ((strcmp(argv[i], "-replay") == 0) && (i + 1 < argc))
+      replay = argv[++i];
+    else if ((strcmp(argv[i], "-timeout") == 0) && (i + 1 < argc))
+      timeout = atof(argv[++i]);
+    else if ((strcmp(argv[i], "-smbios") == 0) && (i + 1 < argc))
+      dumps = argv[++i];
     else
     {
       usage(argv[0]);
@@ -57,22 +106,69 @@ int main(int argc,
     }
   }
 
-  if (gethostname(hostname, sizeof(hostname)) == 0)
+  if (((record != "") && (replay != "")) || (timeout < 0) || (sample < 0))
+  {
+    usage(argv[0]);
+    exit(1);
+  }
+
+  if (dumps != "")
+  {
+    if (!scan_dmi_dumps(dumps, printdump, &htmloutput))
+    {
+      fprintf(stderr, "%s: cannot read %s\n", argv[0], dumps.c_str());
+      exit(1);
+    }
+    return 0;
+  }
+
+  if ((record != "") && !vfs_record(record))
+  {
+    fprintf(stderr, "%s: cannot record to %s\n", argv[0], record.c_str());
+    exit(1);
+  }
+
+  if ((replay != "") && !vfs_replay(replay))
+  {
+    fprintf(stderr, "%s: cannot replay %s\n", argv[0], replay.c_str());
+    exit(1);
+  }
+
+  probe_setup(PROBE_WORKERS, (unsigned int) (timeout * 1000));
+
+  // use the kernel's idea of the hostname so that replays show the
+  // machine they were recorded on
+  memset(hostname, 0, sizeof(hostname));
+  strncpy(hostname, hw::strip(get_string("/proc/sys/kernel/hostname")).c_str(),
+	  sizeof(hostname) - 1);
+
+  if ((hostname[0] != '\0')
+      || (!vfs_replaying() && (gethostname(hostname, sizeof(hostname)) == 0)))
   {
     hwNode computer(hostname,
 		    hw::system);
 
     scan_dmi(computer);
+    scan_hypervisor(computer);
     scan_device_tree(computer);
     scan_memory(computer);
     scan_cpuinfo(computer);
-    scan_cpuid(computer);
-    scan_pci(computer);
+    scan_cpuid(computer, effective);
+    scan_pci(computer, expandvfs, (unsigned int) (sample * 1000));
     scan_pcmcia(computer);
     scan_ide(computer);
     scan_scsi(computer);
 
-    print(computer, htmloutput);
+    if (numaoutput)
+      printnuma(computer);
+    else
+      print(computer, htmloutput);
+  }
+
+  if (!vfs_finish())
+  {
+    fprintf(stderr, "%s: cannot write %s\n", argv[0], record.c_str());
+    return 1;
   }
 
   return 0;
@@ -1,4 +1,5 @@
 #include "mem.h"
+#include "vfs.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -26,7 +27,7 @@ bool scan_memory(hwNode & n)
     }
   }
 
-  if (stat("/proc/kcore", &buf) == 0)
+  if (vfs_stat("/proc/kcore", &buf) == 0)
   {
     if (!memory)
     {
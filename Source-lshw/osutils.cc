@@ -1,4 +1,5 @@
 #include "osutils.h"
+#include "vfs.h"
 #include <stack>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -87,7 +88,9 @@ int splitlines(const string & s,
 
 bool exists(const string & path)
 {
-  return access(path.c_str(), F_OK) == 0;
+  struct stat buf;
+
+  return vfs_stat(path, &buf) == 0;
 }
 
 bool loadfile(const string & file,
@@ -96,17 +99,17 @@ bool loadfile(const string & file,
   char buffer[1024];
   string buffer_str = "";
   size_t count = 0;
-  int fd = open(file.c_str(), O_RDONLY);
+  int fd = vfs_open(file, O_RDONLY);
 
   if (fd < 0)
     return false;
 
-  while ((count = read(fd, buffer, sizeof(buffer))) > 0)
+  while ((count = vfs_read(fd, buffer, sizeof(buffer))) > 0)
     buffer_str += string(buffer, count);
 
   splitlines(buffer_str, list);
 
-  close(fd);
+  vfs_close(fd);
 
   return true;
 }
@@ -114,7 +117,7 @@ bool loadfile(const string & file,
 string get_string(const string & path,
 		  const string & def)
 {
-  int fd = open(path.c_str(), O_RDONLY);
+  int fd = vfs_open(path, O_RDONLY);
   string result = def;
 
   if (fd >= 0)
@@ -125,48 +128,157 @@ string get_string(const string & path,
     memset(buffer, 0, sizeof(buffer));
     result = "";
 
-    while ((count = read(fd, buffer, sizeof(buffer))) > 0)
+    while ((count = vfs_read(fd, buffer, sizeof(buffer))) > 0)
       result += string(buffer, count);
 
-    close(fd);
+    vfs_close(fd);
   }
 
   return result;
 }
 
-static int selectdir(const struct dirent *d)
+ssize_t read_attribute(const string & path,
+		       void *buffer,
+		       size_t size)
 {
-  struct stat buf;
+  int fd = vfs_open(path, O_RDONLY);
+  size_t len = 0;
+  ssize_t count = 0;
+
+  if (fd < 0)
+    return -1;
 
-  if (d->d_name[0] == '.')
-    return 0;
+  while ((len < size)
+	 && ((count = vfs_read(fd, (char *) buffer + len, size - len)) > 0))
+    len += count;
 
-  if (lstat(d->d_name, &buf) != 0)
-    return 0;
+  vfs_close(fd);
 
-  return S_ISDIR(buf.st_mode);
+  return (count < 0) ? -1 : len;
 }
 
-static int selectdevice(const struct dirent *d)
+bool parse_number(const char *&s,
+		  const char *end,
+		  unsigned long long &value,
+		  int base)
 {
-  struct stat buf;
+  const unsigned long long cutoff = ~0ULL / base;
+  const unsigned int cutlim = ~0ULL % base;
+  unsigned long long result = 0;
+  const char *p = s;
+  const char *digits = NULL;
+
+  while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\n')))
+    p++;
+
+  if ((base == 16) && (end - p > 2) && (p[0] == '0') && ((p[1] | 0x20) == 'x'))
+    p += 2;
+
+  for (digits = p; p < end; p++)
+  {
+    unsigned int d = (unsigned char) *p - '0';
+
+    if (d > 9)
+    {
+      // 'A'-'F' and 'a'-'f' map to 10-15, anything else is out of range
+      d = (((unsigned char) *p | 0x20) - 'a') + 10;
+      if ((d < 10) || (d >= (unsigned int) base))
+	break;
+    }
+    else if (d >= (unsigned int) base)
+      break;
+
+    if ((result > cutoff) || ((result == cutoff) && (d > cutlim)))
+      return false;		// overflow
+    result = result * base + d;
+  }
+
+  if (p == digits)
+    return false;
+
+  s = p;
+  value = result;
+  return true;
+}
+
+bool get_number(const string & path,
+		unsigned long long &value,
+		int base)
+{
+  char buffer[64];
+  ssize_t len = read_attribute(path, buffer, sizeof(buffer));
+  const char *p = buffer;
+  unsigned long long result = 0;
+
+  if ((len <= 0) || (len == sizeof(buffer)))
+    return false;
+
+  if (!parse_number(p, buffer + len, result, base))
+    return false;
+
+  // only trailing blanks are allowed after the number
+  for (; p < buffer + len; p++)
+    if ((*p != ' ') && (*p != '\t') && (*p != '\n') && (*p != '\0'))
+      return false;
+
+  value = result;
+  return true;
+}
+
+/*
+ * decodes big-endian cells, as found in the OpenFirmware device tree
+ */
+unsigned long long get_be(const void *data,
+			  size_t len)
+{
+  const unsigned char *p = (const unsigned char *) data;
+  unsigned long long result = 0;
+
+  for (size_t i = 0; (i < len) && (i < sizeof(result)); i++)
+    result = (result << 8) | p[i];
+
+  return result;
+}
+
+bool listdir(const string & path,
+	     vector < string > &entries,
+	     mode_t type)
+{
+  vector < string > all;
+
+  entries.clear();
+
+  if (vfs_scandir(path, all) < 0)
+    return false;
+
+  for (unsigned int i = 0; i < all.size(); i++)
+  {
+    struct stat buf;
+
+    if (all[i][0] == '.')
+      continue;
 
-  if (d->d_name[0] == '.')
-    return 0;
+    if (type != 0)
+    {
+      if (vfs_lstat(path + "/" + all[i], &buf) != 0)
+	continue;
+      if ((buf.st_mode & S_IFMT) != type)
+	continue;
+    }
 
-  if (lstat(d->d_name, &buf) != 0)
-    return 0;
+    entries.push_back(all[i]);
+  }
 
-  return S_ISCHR(buf.st_mode) || S_ISBLK(buf.st_mode);
+  return true;
 }
 
-static bool matches(string name,
+static bool matches(const string & name,
 		    mode_t mode,
 		    dev_t device)
 {
   struct stat buf;
 
-  if (lstat(name.c_str(), &buf) != 0)
+  if (vfs_lstat(name, &buf) != 0)
     return false;
 
   return ((S_ISCHR(buf.st_mode) && S_ISCHR(mode)) ||
@@ -177,49 +289,21 @@ static string find_deventry(string basepath,
 			    mode_t mode,
 			    dev_t device)
 {
-  struct dirent **namelist;
-  int n, i;
+  vector < string > entries;
   string result = "";
 
-  pushd(basepath);
-
-  n = scandir(".", &namelist, selectdevice, alphasort);
-
-  if (n < 0)
-  {
-    popd();
+  if (!listdir(basepath, entries))
     return "";
-  }
 
-  for (i = 0; i < n; i++)
-  {
-    if (result == "" && matches(namelist[i]->d_name, mode, device))
-      result = string(namelist[i]->d_name);
-    free(namelist[i]);
-  }
-  free(namelist);
-
-  popd();
-
-  if (result != "")
-    return basepath + "/" + result;
+  for (unsigned int i = 0; i < entries.size(); i++)
+    if (matches(basepath + "/" + entries[i], mode, device))
+      return basepath + "/" + entries[i];
 
-  pushd(basepath);
-  n = scandir(".", &namelist, selectdir, alphasort);
-  popd();
-
-  if (n < 0)
+  if (!listdir(basepath, entries, S_IFDIR))
     return "";
 
-  for (i = 0; i < n; i++)
-  {
-    if (result == "")
-      result =
-	find_deventry(basepath + "/" + string(namelist[i]->d_name), mode,
-		      device);
-    free(namelist[i]);
-  }
-  free(namelist);
+  for (unsigned int i = 0; (result == "") && (i < entries.size()); i++)
+    result = find_deventry(basepath + "/" + entries[i], mode, device);
 
   return result;
 }
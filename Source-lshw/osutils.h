@@ -10,6 +10,9 @@ std::string popd();
 std::string pwd();
 
 bool exists(const std::string & path);
+bool listdir(const std::string & path,
+		std::vector < std::string > &entries,
+		mode_t type = 0);
 bool loadfile(const std::string & file, std::vector < std::string > &lines);
 
 int splitlines(const std::string & s,
@@ -17,6 +20,17 @@ int splitlines(const std::string & s,
 		char separator = '\n');
 std::string get_string(const std::string & path, const std::string & def = "");
 
+/*
+ * numeric attributes: no heap allocation, no stdio, no locale.
+ * they return false (and leave their arguments alone) on malformed input
+ */
+ssize_t read_attribute(const std::string & path, void *buffer, size_t size);
+bool parse_number(const char *&s, const char *end,
+		unsigned long long &value, int base = 10);
+bool get_number(const std::string & path,
+		unsigned long long &value, int base = 10);
+unsigned long long get_be(const void *data, size_t len);
+
 std::string find_deventry(mode_t mode, dev_t device);
 
 #endif
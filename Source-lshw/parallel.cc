@@ -0,0 +1,96 @@
+#include "parallel.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#define PARALLEL_MAXWORKERS 64
+
+static unsigned int limit = 0;
+
+struct parallel_loop
+{
+  pthread_mutex_t lock;
+  unsigned int next;
+  unsigned int count;
+  parallel_task task;
+  void *data;
+};
+
+/*
+ * pieces are handed out one at a time, so that threads which finish
+ * early pick up the remaining work
+ */
+static void *run(void *arg)
+{
+  parallel_loop *loop = (parallel_loop *) arg;
+
+  while (true)
+  {
+    unsigned int i = 0;
+
+    pthread_mutex_lock(&loop->lock);
+    i = loop->next++;
+    pthread_mutex_unlock(&loop->lock);
+
+    if (i >= loop->count)
+      break;
+
+    loop->task(i, loop->data);
+  }
+
+  return NULL;
+}
+
+unsigned int parallel_workers()
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (n < 1)
+    return 1;
+  if ((limit > 0) && (n > (long) limit))
+    return limit;
+  if (n > PARALLEL_MAXWORKERS)
+    return PARALLEL_MAXWORKERS;
+
+  return n;
+}
+
+void parallel_limit(unsigned int workers)
+{
+  limit = workers;
+}
+
+void parallel_for(unsigned int count,
+		  parallel_task task,
+		  void *data)
+{
+  pthread_t threads[PARALLEL_MAXWORKERS];
+  unsigned int nthreads = 0;
+  unsigned int workers = parallel_workers();
+  parallel_loop loop;
+
+  pthread_mutex_init(&loop.lock, NULL);
+  loop.next = 0;
+  loop.count = count;
+  loop.task = task;
+  loop.data = data;
+
+  if (workers > count)
+    workers = count;
+
+  // if threads can't be created, the calling thread does it all
+  while (nthreads + 1 < workers)
+  {
+    if (pthread_create(&threads[nthreads], NULL, run, &loop) != 0)
+      break;
+    nthreads++;
+  }
+
+  run(&loop);
+
+  for (unsigned int i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_mutex_destroy(&loop.lock);
+}
+
+static char *id = "@(#) $Id$";
@@ -0,0 +1,21 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+/*
+ * CPU-bound loops split into independent pieces (parsing chunks of a
+ * large file, decoding tables...) are spread over one thread per
+ * online processor. the calling thread takes part in the work.
+ */
+
+typedef void (*parallel_task) (unsigned int index,
+			       void *data);
+
+unsigned int parallel_workers();
+void parallel_limit(unsigned int workers);	// 0 for no limit
+
+// runs task(i, data) for every i < count, returns when all are done
+void parallel_for(unsigned int count,
+		  parallel_task task,
+		  void *data);
+
+#endif
@@ -1,26 +1,109 @@
 #include "pci.h"
 #include "osutils.h"
+#include "vfs.h"
+#include "pcidb.h"
+#include "parallel.h"
+#include <map>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
 
 #define PROC_BUS_PCI "/proc/bus/pci"
+#define SYS_BUS_PCI "/sys/bus/pci/devices"
 #define PCIID_PATH "/usr/local/share/pci.ids:/usr/share/pci.ids:/etc/pci.ids:/usr/share/hwdata/pci.ids"
 
-#define PCI_CLASS_REVISION      0x08	/* High 24 bits are class, low 8 revision */
-#define PCI_COMMAND             0x04	/* 16 bits */
-#define PCI_REVISION_ID         0x08	/* Revision ID */
-#define PCI_CLASS_PROG          0x09	/* Reg. Level Programming Interface */
-#define PCI_CLASS_DEVICE        0x0a	/* Device class */
-#define PCI_HEADER_TYPE         0x0e	/* 8 bits */
+#define PCI_CONFIG_SIZE         4096	/* with the PCI Express extended space */
+
+/*
+ * Configuration registers are described as fields: offset from the start
+ * of the header or capability, width of the register in bytes, and mask
+ * and shift of the field in it. Each table below is turned into
+ * constant pci_field descriptors, read with pci_regs.
+ */
+
+/* Header, all types */
+#define PCI_HEADER_FIELDS(F) \
+  F(PCI_VENDOR_ID,            0x00, 2, 0xffff, 0) \
+  F(PCI_DEVICE_ID,            0x02, 2, 0xffff, 0) \
+  F(PCI_COMMAND,              0x04, 2, 0xffff, 0) \
+  F(PCI_STATUS,               0x06, 2, 0xffff, 0) \
+  F(PCI_REVISION_ID,          0x08, 1, 0xff, 0) \
+  F(PCI_CLASS_PROG,           0x09, 1, 0xff, 0)	/* Programming Interface */ \
+  F(PCI_CLASS_DEVICE,         0x0a, 2, 0xffff, 0)	/* class and subclass */ \
+  F(PCI_HEADER_TYPE,          0x0e, 1, 0x7f, 0) \
+  F(PCI_MULTIFUNCTION,        0x0e, 1, 0x80, 7) \
+  F(PCI_SUBSYSTEM_ID,         0x2e, 2, 0xffff, 0) \
+  F(PCI_CAPABILITY_LIST,      0x34, 1, 0xfc, 0)	/* first capability */
+
+/* Header type 1 (PCI-to-PCI bridges) */
+#define PCI_BRIDGE_FIELDS(F) \
+  F(PCI_PRIMARY_BUS,          0x18, 1, 0xff, 0) \
+  F(PCI_SECONDARY_BUS,        0x19, 1, 0xff, 0) \
+  F(PCI_SUBORDINATE_BUS,      0x1a, 1, 0xff, 0)	/* highest bus behind */
+
+/* Header type 2 (CardBus bridges) */
+#define PCI_CARDBUS_FIELDS(F) \
+  F(PCI_CB_CAPABILITY_LIST,   0x14, 1, 0xfc, 0) \
+  F(PCI_CB_PRIMARY_BUS,       0x18, 1, 0xff, 0) \
+  F(PCI_CB_CARD_BUS,          0x19, 1, 0xff, 0) \
+  F(PCI_CB_SUBORDINATE_BUS,   0x1a, 1, 0xff, 0)
+
+/* Capability headers, from the start of the capability */
+#define PCI_CAP_FIELDS(F) \
+  F(PCI_CAP_LIST_ID,          0x00, 1, 0xff, 0) \
+  F(PCI_CAP_LIST_NEXT,        0x01, 1, 0xfc, 0) \
+  F(PCI_EXT_CAP_ID,           0x00, 4, 0x0000ffff, 0) \
+  F(PCI_EXT_CAP_VER,          0x00, 4, 0x000f0000, 16) \
+  F(PCI_EXT_CAP_NEXT,         0x00, 4, 0xffc00000, 20)
+
+/* PCI Express capability */
+#define PCI_EXP_FIELDS(F) \
+  F(PCI_EXP_FLAGS_VERS,       0x02, 2, 0x000f, 0)	/* version */ \
+  F(PCI_EXP_FLAGS_TYPE,       0x02, 2, 0x00f0, 4)	/* Device/Port type */ \
+  F(PCI_EXP_DEVCAP_PAYLOAD,   0x04, 4, 0x00000007, 0)	/* Max_Payload_Size */ \
+  F(PCI_EXP_DEVCTL_RELAX_EN,  0x08, 2, 0x0010, 4)	/* relaxed ordering */ \
+  F(PCI_EXP_DEVCTL_PAYLOAD,   0x08, 2, 0x00e0, 5)	/* Max_Payload_Size */ \
+  F(PCI_EXP_DEVCTL_NOSNOOP_EN, 0x08, 2, 0x0800, 11)	/* No Snoop */ \
+  F(PCI_EXP_DEVCTL_READRQ,    0x08, 2, 0x7000, 12)	/* Max_Read_Request */ \
+  F(PCI_EXP_LNKCAP_SLS,       0x0c, 4, 0x0000000f, 0)	/* Link Speeds */ \
+  F(PCI_EXP_LNKCAP_MLW,       0x0c, 4, 0x000003f0, 4)	/* Maximum Link Width */ \
+  F(PCI_EXP_LNKCAP_ASPMS,     0x0c, 4, 0x00000c00, 10)	/* ASPM Support */ \
+  F(PCI_EXP_LNKCAP_L0SEL,     0x0c, 4, 0x00007000, 12)	/* L0s Exit Latency */ \
+  F(PCI_EXP_LNKCAP_L1EL,      0x0c, 4, 0x00038000, 15)	/* L1 Exit Latency */ \
+  F(PCI_EXP_LNKCTL_ASPMC,     0x10, 2, 0x0003, 0)	/* ASPM Control */ \
+  F(PCI_EXP_LNKSTA_CLS,       0x12, 2, 0x000f, 0)	/* Current Link Speed */ \
+  F(PCI_EXP_LNKSTA_NLW,       0x12, 2, 0x03f0, 4)	/* Negotiated Width */ \
+  F(PCI_EXP_LNKCAP2_SLS,      0x2c, 4, 0x000000fe, 1)	/* Link Speeds Vector */
+
+/* Advanced Error Reporting */
+#define PCI_ERR_FIELDS(F) \
+  F(PCI_ERR_UNCOR_STATUS,     0x04, 4, 0xffffffff, 0) \
+  F(PCI_ERR_COR_STATUS,       0x10, 4, 0xffffffff, 0)
+
+/* Resizable BAR, from the start of the capability + 8 * n for BAR n */
+#define PCI_REBAR_FIELDS(F) \
+  F(PCI_REBAR_CAP_SIZES,      0x04, 4, 0xfffffff0, 4)	/* 1 MB << bit */ \
+  F(PCI_REBAR_CTRL_BAR_IDX,   0x08, 4, 0x00000007, 0)	/* BAR index */ \
+  F(PCI_REBAR_CTRL_NBAR,      0x08, 4, 0x000000e0, 5)	/* resizable BARs */ \
+  F(PCI_REBAR_CTRL_BAR_SIZE,  0x08, 4, 0x00003f00, 8)	/* 1 MB << n */
+
+/* Single Root I/O Virtualization */
+#define PCI_SRIOV_FIELDS(F) \
+  F(PCI_SRIOV_CTRL_VFE,       0x08, 2, 0x0001, 0)	/* VF Enable */ \
+  F(PCI_SRIOV_INITIAL_VF,     0x0c, 2, 0xffff, 0) \
+  F(PCI_SRIOV_TOTAL_VF,       0x0e, 2, 0xffff, 0) \
+  F(PCI_SRIOV_NUM_VF,         0x10, 2, 0xffff, 0) \
+  F(PCI_SRIOV_VF_OFFSET,      0x14, 2, 0xffff, 0)	/* First VF Offset */ \
+  F(PCI_SRIOV_VF_STRIDE,      0x16, 2, 0xffff, 0) \
+  F(PCI_SRIOV_VF_DID,         0x1a, 2, 0xffff, 0)	/* VF Device ID */
+
 #define  PCI_HEADER_TYPE_NORMAL 0
 #define  PCI_HEADER_TYPE_BRIDGE 1
 #define  PCI_HEADER_TYPE_CARDBUS 2
-#define PCI_PRIMARY_BUS         0x18	/* Primary bus number */
-#define PCI_SECONDARY_BUS       0x19	/* Secondary bus number */
-#define PCI_STATUS              0x06	/* 16 bits */
 #define PCI_STATUS_66MHZ       0x20	/* Support 66 Mhz PCI 2.1 bus */
 #define PCI_STATUS_CAP_LIST    0x10	/* Support Capability List */
 #define PCI_COMMAND_IO         0x1	/* Enable response in I/O space */
@@ -34,6 +117,36 @@
 #define PCI_COMMAND_SERR       0x100	/* Enable SERR */
 #define PCI_COMMAND_FAST_BACK  0x200	/* Enable back-to-back writes */
 
+#define PCI_BASE_ADDRESS_0      0x10	/* 32 bits */
+#define  PCI_BASE_ADDRESS_SPACE_IO 0x01
+#define  PCI_BASE_ADDRESS_MEM_TYPE_MASK 0x06
+#define  PCI_BASE_ADDRESS_MEM_TYPE_64 0x04	/* 64 bit address */
+#define  PCI_BASE_ADDRESS_MEM_PREFETCH 0x08	/* prefetchable? */
+
+#define PCI_CAP_ID_EXP          0x10	/* PCI Express */
+
+/* PCI Express Device/Port types */
+#define   PCI_EXP_TYPE_ENDPOINT  0x0	/* Express Endpoint */
+#define   PCI_EXP_TYPE_LEG_END   0x1	/* Legacy Endpoint */
+#define   PCI_EXP_TYPE_ROOT_PORT 0x4	/* Root Port */
+#define   PCI_EXP_TYPE_UPSTREAM  0x5	/* Upstream Port */
+#define   PCI_EXP_TYPE_DOWNSTREAM 0x6	/* Downstream Port */
+#define   PCI_EXP_TYPE_PCI_BRIDGE 0x7	/* PCI/PCI-X Bridge */
+#define   PCI_EXP_TYPE_PCIE_BRIDGE 0x8	/* PCI/PCI-X to PCIE Bridge */
+#define   PCI_EXP_TYPE_RC_END    0x9	/* Root Complex Integrated Endpoint */
+#define   PCI_EXP_TYPE_RC_EC     0xa	/* Root Complex Event Collector */
+
+/* virtio: 0x1000-0x103f are transitional devices, 0x1040 + type modern ones */
+#define PCI_VENDOR_ID_VIRTIO    0x1af4
+#define  PCI_DEVICE_ID_VIRTIO_TRANS 0x1000
+#define  PCI_DEVICE_ID_VIRTIO_MODERN 0x1040
+#define  PCI_DEVICE_ID_VIRTIO_END 0x1080
+
+/* Extended capabilities (PCI Express only), from offset 0x100 */
+#define PCI_EXT_CAP_ID_ERR      0x01	/* Advanced Error Reporting */
+#define PCI_EXT_CAP_ID_SRIOV    0x10	/* Single Root I/O Virtualization */
+#define PCI_EXT_CAP_ID_REBAR    0x15	/* Resizable BAR */
+
 /*
  * The PCI interface treats multi-function devices as independent
  * devices.  The slot/function address of each device is encoded
@@ -129,23 +242,15 @@
 #define PCI_CLASS_SERIAL_USB		0x0c03
 #define PCI_CLASS_SERIAL_FIBER		0x0c04
 
+#define PCI_BASE_CLASS_ACCELERATOR	0x12
+
 #define PCI_CLASS_OTHERS		0xff
 
 typedef unsigned long long pciaddr_t;
-typedef enum
-{ pcidevice,
-  pcisubdevice,
-  pcisubsystem,
-  pciclass,
-  pcisubclass,
-  pcivendor,
-  pcisubvendor,
-  pciprogif
-}
-catalog;
 
 struct pci_dev
 {
+  u_int32_t domain;		/* PCI domain (segment) */
   u_int16_t bus;		/* Higher byte can select host bridges */
   u_int8_t dev, func;		/* Device and function */
 
@@ -156,97 +261,95 @@ struct pci_dev
   pciaddr_t rom_base_addr;	/* Expansion ROM base address */
   pciaddr_t rom_size;		/* Expansion ROM size */
 
-  u_int8_t config[64];		/* we only use 64 bytes */
-  u_int8_t unusedconfig[256 - 64];	/* of the 256 bytes available */
+  int numa_node;		/* -1 when unknown */
+
+  u_int8_t config[PCI_CONFIG_SIZE];	/* configuration space */
 };
 
-struct pci_entry
+struct pci_field
 {
-  long ids[4];
-  string description;
-
-    pci_entry(const string & description,
-	      long u1 = -1,
-	      long u2 = -1,
-	      long u3 = -1,
-	      long u4 = -1);
-
-  unsigned int matches(long u1 = -1,
-		       long u2 = -1,
-		       long u3 = -1,
-		       long u4 = -1) const;
+  u_int16_t offset;
+  u_int8_t width;		// 1, 2 or 4 bytes
+  u_int32_t mask;
+  u_int8_t shift;
 };
 
-static vector < pci_entry > pci_devices;
-static vector < pci_entry > pci_classes;
-
-pci_entry::pci_entry(const string & d,
-		     long u1,
-		     long u2,
-		     long u3,
-		     long u4)
-{
-  description = d;
-  ids[0] = u1;
-  ids[1] = u2;
-  ids[2] = u3;
-  ids[3] = u4;
-}
+#define PCI_FIELD(name, offset, width, mask, shift) \
+  static const pci_field name = { offset, width, mask, shift };
+PCI_HEADER_FIELDS(PCI_FIELD)
+PCI_BRIDGE_FIELDS(PCI_FIELD)
+PCI_CARDBUS_FIELDS(PCI_FIELD)
+PCI_CAP_FIELDS(PCI_FIELD)
+PCI_EXP_FIELDS(PCI_FIELD)
+PCI_ERR_FIELDS(PCI_FIELD)
+PCI_REBAR_FIELDS(PCI_FIELD)
+PCI_SRIOV_FIELDS(PCI_FIELD)
+#undef PCI_FIELD
 
-unsigned int pci_entry::matches(long u1,
-				long u2,
-				long u3,
-				long u4) const
+/*
+ * configuration space of a device, from the start of its header or of
+ * one of its capabilities: it reads the device's own buffer, fields
+ * outside of it read as 0
+ */
+struct pci_regs
 {
-  unsigned int result = 0;
+  const u_int8_t *config;
+  unsigned int base;
 
-  if (ids[0] == u1)
+  pci_regs(const pci_dev & d,
+	   unsigned int start = 0):config(d.config), base(start)
   {
-    result++;
-    if (ids[1] == u2)
-    {
-      result++;
-      if (ids[2] == u3)
-      {
-	result++;
-	if (ids[3] == u4)
-	  result++;
-      }
-    }
   }
 
-  return result;
-}
-
-static bool find_best_match(const vector < pci_entry > &list,
-			    pci_entry & result,
-			    long u1 = -1,
-			    long u2 = -1,
-			    long u3 = -1,
-			    long u4 = -1)
-{
-  int lastmatch = -1;
-  unsigned int lastscore = 0;
-
-  for (int i = 0; i < list.size(); i++)
+  u_int32_t operator[] (const pci_field & f) const
   {
-    unsigned int currentscore = list[i].matches(u1, u2, u3, u4);
+    unsigned int pos = base + f.offset;
+    u_int32_t value = 0;
 
-    if (currentscore > lastscore)
-    {
-      lastscore = currentscore;
-      lastmatch = i;
-    }
-  }
+    if (pos + f.width > PCI_CONFIG_SIZE)
+      return 0;
+    for (unsigned int i = 0; i < f.width; i++)
+      value |= (u_int32_t) config[pos + i] << (8 * i);
 
-  if (lastmatch >= 0)
-  {
-    result = list[lastmatch];
-    return true;
+    return (value & f.mask) >> f.shift;
   }
+};
 
-  return false;
-}
+/*
+ * a device as enumerated, before it gets described
+ */
+struct pci_entry
+{
+  pci_dev d;
+  string name;			// dddd:bb:dd.f
+  string driver;
+  string parent;		// name of the upstream bridge, "" if unknown
+  const pci_entry *upstream;	// the bridge above, NULL for root devices
+  string physfnname;		// physical function of a VF, from sysfs
+  int physfn;			// index of the physical function, -1 if none
+  string iommugroup;		// "" without an IOMMU
+  string localcpus;		// CPUs close to the device (cpulist format)
+  int socket;			// package of these CPUs, -1 when unknown
+  bool aer;			// sysfs has AER counters
+  unsigned long long errors[3];	// correctable, non-fatal, fatal
+  string errorkinds;		// non-zero counters, as kind:count,...
+  unsigned long long sample[3];	// same counters, at the end of a sample
+  double rates[3];		// errors per second, < 0 when not sampled
+  int queues;			// virtqueues in use (virtio), -1 if unknown
+  bool valid;
+};
+
+static const char *aer_files[] = {
+  "aer_dev_correctable",
+  "aer_dev_nonfatal",
+  "aer_dev_fatal",
+};
+
+static const char *aer_names[] = {
+  "correctable",
+  "nonfatal",
+  "fatal",
+};
 
 static const char *get_class_name(unsigned int c)
 {
@@ -313,444 +416,1495 @@ static const char *get_class_name(unsigned int c)
   return "generic";
 }
 
-static bool parse_pcidb(vector < string > &list)
+static string get_class_description(long c,
+				    long pi = -1)
 {
-  long u[4];
-  string line = "";
-  catalog current_catalog = pcivendor;
-  int level = 0;
+  return pcidb_class(c >> 8, c & 0xff, pi);
+}
 
-  memset(u, 0, sizeof(u));
+static string get_device_description(long u1,
+				     long u2 = -1,
+				     long u3 = -1,
+				     long u4 = -1)
+{
+  return pcidb_device(u1, u2, u3, u4);
+}
 
-  for (int i = 0; i < list.size(); i++)
-  {
-    line = hw::strip(list[i]);
+static u_int32_t get_conf_long(const pci_dev & d,
+			       unsigned int pos)
+{
+  if (pos + 4 > sizeof(d.config))
+    return 0;
 
-    // ignore empty or commented-out lines
-    if (line.length() == 0 || line[0] == '#')
-      continue;
+  return d.config[pos] | (d.config[pos + 1] << 8) |
+    (d.config[pos + 2] << 16) | ((u_int32_t) d.config[pos + 3] << 24);
+}
 
-    level = 0;
-    while ((level < list[i].length()) && (list[i][level] == '\t'))
-      level++;
+/*
+ * returns the offset of a capability in configuration space, 0 if the
+ * device doesn't have it
+ */
+static unsigned int find_capability(const pci_dev & d,
+				    u_int8_t id)
+{
+  unsigned int pos = 0;
+  int ttl = 48;			// in case the list loops
 
-    switch (level)
-    {
-    case 0:
-      if ((line[0] == 'C') && (line.length() > 1) && (line[1] == ' '))
-      {
-	current_catalog = pciclass;
-	line = line.substr(2);	// get rid of 'C '
-
-	if ((line.length() < 3) || (line[2] != ' '))
-	  return false;
-	if (sscanf(line.c_str(), "%x", &u[0]) != 1)
-	  return false;
-	line = line.substr(3);
-	line = hw::strip(line);
-      }
-      else
-      {
-	current_catalog = pcivendor;
-
-	if ((line.length() < 5) || (line[4] != ' '))
-	  return false;
-	if (sscanf(line.c_str(), "%x", &u[0]) != 1)
-	  return false;
-	line = line.substr(5);
-	line = hw::strip(line);
-      }
-      u[1] = u[2] = u[3] = -1;
-      break;
-    case 1:
-      if ((current_catalog == pciclass) || (current_catalog == pcisubclass)
-	  || (current_catalog == pciprogif))
-      {
-	current_catalog = pcisubclass;
-
-	if ((line.length() < 3) || (line[2] != ' '))
-	  return false;
-	if (sscanf(line.c_str(), "%x", &u[1]) != 1)
-	  return false;
-	line = line.substr(3);
-	line = hw::strip(line);
-      }
-      else
-      {
-	current_catalog = pcidevice;
-
-	if ((line.length() < 5) || (line[4] != ' '))
-	  return false;
-	if (sscanf(line.c_str(), "%x", &u[1]) != 1)
-	  return false;
-	line = line.substr(5);
-	line = hw::strip(line);
-      }
-      u[2] = u[3] = -1;
-      break;
-    case 2:
-      if ((current_catalog != pcidevice) && (current_catalog != pcisubvendor)
-	  && (current_catalog != pcisubclass)
-	  && (current_catalog != pciprogif))
-	return false;
-      if ((current_catalog == pcisubclass) || (current_catalog == pciprogif))
-      {
-	current_catalog = pciprogif;
-	if ((line.length() < 3) || (line[2] != ' '))
-	  return false;
-	if (sscanf(line.c_str(), "%x", &u[2]) != 1)
-	  return false;
-	u[3] = -1;
-	line = line.substr(2);
-	line = hw::strip(line);
-      }
-      else
-      {
-	current_catalog = pcisubvendor;
-	if ((line.length() < 10) || (line[4] != ' ') || (line[9] != ' '))
-	  return false;
-	if (sscanf(line.c_str(), "%x%x", &u[2], &u[3]) != 2)
-	  return false;
-	line = line.substr(9);
-	line = hw::strip(line);
-      }
-      break;
-    default:
-      return false;
-    }
+  if (!(pci_regs(d)[PCI_STATUS] & PCI_STATUS_CAP_LIST))
+    return 0;
 
-    //printf("%04x %04x %04x %04x %s\n", u[0], u[1], u[2], u[3], line.c_str());
-    if ((current_catalog == pciclass) ||
-	(current_catalog == pcisubclass) || (current_catalog == pciprogif))
-    {
-      pci_classes.push_back(pci_entry(line, u[0], u[1], u[2], u[3]));
-    }
-    else
-    {
-      pci_devices.push_back(pci_entry(line, u[0], u[1], u[2], u[3]));
-    }
+  pos = pci_regs(d)[PCI_CAPABILITY_LIST];
+  while ((pos >= 0x40) && (pos < 0x100) && (ttl-- > 0))
+  {
+    pci_regs cap(d, pos);
+
+    if (cap[PCI_CAP_LIST_ID] == id)
+      return pos;
+    pos = cap[PCI_CAP_LIST_NEXT];
   }
-  return true;
+
+  return 0;
 }
 
-static bool load_pcidb()
+/*
+ * same as find_capability() for the extended capabilities of PCI
+ * Express devices (0 when config space was read only partially)
+ */
+static unsigned int find_ext_capability(const pci_dev & d,
+					u_int16_t id)
 {
-  vector < string > lines;
-  vector < string > filenames;
+  unsigned int pos = 0x100;
+  int ttl = (sizeof(d.config) - 0x100) / 8;
 
-  splitlines(PCIID_PATH, filenames, ':');
-  for (int i = filenames.size() - 1; i >= 0; i--)
+  while ((pos >= 0x100) && (pos + 4 <= sizeof(d.config)) && (ttl-- > 0))
   {
-    lines.clear();
-    if (loadfile(filenames[i], lines))
-      parse_pcidb(lines);
+    u_int32_t header = get_conf_long(d, pos);
+
+    if ((header == 0) || (header == 0xffffffff))
+      return 0;
+    if (pci_regs(d, pos)[PCI_EXT_CAP_ID] == id)
+      return pos;
+    pos = pci_regs(d, pos)[PCI_EXT_CAP_NEXT];
   }
 
-  if (lines.size() == 0)
+  return 0;
+}
+
+struct pcie_link
+{
+  unsigned int cap;		// offset of the capability
+  u_int8_t type;		// device/port type
+  u_int8_t speed, width;	// as trained, width is 0 when the link is down
+  u_int8_t maxspeed, maxwidth;
+};
+
+static bool get_pcie_link(const pci_dev & d,
+			  pcie_link & link)
+{
+  unsigned int cap = find_capability(d, PCI_CAP_ID_EXP);
+  pci_regs exp(d, cap);
+
+  memset(&link, 0, sizeof(link));
+  if (cap == 0)
     return false;
 
+  link.cap = cap;
+  link.type = exp[PCI_EXP_FLAGS_TYPE];
+  link.speed = exp[PCI_EXP_LNKSTA_CLS];
+  link.width = exp[PCI_EXP_LNKSTA_NLW];
+  link.maxspeed = exp[PCI_EXP_LNKCAP_SLS];
+  link.maxwidth = exp[PCI_EXP_LNKCAP_MLW];
+
+  // since 3.0, the fastest speed is the highest bit of the vector
+  if (exp[PCI_EXP_FLAGS_VERS] >= 2)
+  {
+    u_int32_t speeds = exp[PCI_EXP_LNKCAP2_SLS];
+
+    if (speeds)
+      for (link.maxspeed = 0; speeds; speeds >>= 1)
+	link.maxspeed++;
+  }
+
   return true;
 }
 
-static string get_class_description(long c,
-				    long pi = -1)
+static bool haslink(const pcie_link & link)
 {
-  pci_entry result("");
+  return (link.type != PCI_EXP_TYPE_RC_END) &&
+    (link.type != PCI_EXP_TYPE_RC_EC);
+}
 
-  if (find_best_match(pci_classes, result, c >> 8, c & 0xff, pi))
-    return result.description;
-  else
-    return "";
+// does the link go up towards the root complex?
+static bool upstream_link(const pcie_link & link)
+{
+  return (link.type == PCI_EXP_TYPE_ENDPOINT) ||
+    (link.type == PCI_EXP_TYPE_LEG_END) ||
+    (link.type == PCI_EXP_TYPE_UPSTREAM) ||
+    (link.type == PCI_EXP_TYPE_PCI_BRIDGE);
 }
 
-static string get_device_description(long u1,
-				     long u2 = -1,
-				     long u3 = -1,
-				     long u4 = -1)
+static string link_speed(u_int8_t speed)
 {
-  pci_entry result("");
+  switch (speed)
+  {
+  case 1:
+    return "2.5GT/s";
+  case 2:
+    return "5GT/s";
+  case 3:
+    return "8GT/s";
+  case 4:
+    return "16GT/s";
+  case 5:
+    return "32GT/s";
+  case 6:
+    return "64GT/s";
+  }
 
-  if (find_best_match(pci_devices, result, u1, u2, u3, u4))
-    return result.description;
-  else
-    return "";
+  return "";
 }
 
-static u_int16_t get_conf_word(struct pci_dev d,
-			       unsigned int pos)
+static string link_width(u_int8_t width)
 {
-  if (pos > sizeof(d.config))
-    return 0;
+  char buffer[10];
+
+  snprintf(buffer, sizeof(buffer), "x%d", width);
 
-  return d.config[pos] | (d.config[pos + 1] << 8);
+  return string(buffer);
 }
 
-static u_int8_t get_conf_byte(struct pci_dev d,
-			      unsigned int pos)
+/*
+ * reports the trained link against what the device can do. when the
+ * port above it (the other end of the link) is what holds it back, that
+ * is reported separately: a x16 card in a x4 slot is not a fault.
+ */
+static void describe_link(hwNode & device,
+			  const pcie_link & link,
+			  const pci_dev * upstream)
 {
-  if (pos > sizeof(d.config))
-    return 0;
+  pcie_link port;
+  bool byport = true;
+  string downtrained = "";
 
-  return d.config[pos];
+  if (link_speed(link.maxspeed) != "")
+    device.setConfig("maxlinkspeed", link_speed(link.maxspeed));
+  if (link.maxwidth)
+    device.setConfig("maxlinkwidth", link_width(link.maxwidth));
+
+  if (link.width == 0)
+    return;			// link down, nothing behind this port
+
+  if (link_speed(link.speed) != "")
+    device.setConfig("linkspeed", link_speed(link.speed));
+  device.setConfig("linkwidth", link_width(link.width));
+
+  // a downstream port is only as wide as what's plugged into it
+  if (!upstream_link(link))
+    return;
+
+  memset(&port, 0, sizeof(port));
+  if (!upstream || !get_pcie_link(*upstream, port) || !haslink(port))
+    byport = false;
+
+  if (link.speed < link.maxspeed)
+  {
+    downtrained = "speed";
+    if (!port.maxspeed || (port.maxspeed > link.speed))
+      byport = false;
+  }
+  if (link.width < link.maxwidth)
+  {
+    downtrained += string((downtrained != "") ? "," : "") + "width";
+    if (!port.maxwidth || (port.maxwidth > link.width))
+      byport = false;
+  }
+
+  if (downtrained == "")
+    return;
+
+  device.setConfig("downtrained", downtrained);
+  if (byport)
+    device.setConfig("limitedby", "port");
 }
 
-static string pci_bushandle(u_int8_t bus)
+// payload and read request sizes are encoded as 128 << n
+static unsigned int payload(unsigned int n)
 {
-  char buffer[10];
+  return 128 << n;
+}
 
-  snprintf(buffer, sizeof(buffer), "%02x", bus);
+static string aspm_states(unsigned int aspm)
+{
+  switch (aspm & 3)
+  {
+  case 1:
+    return "L0s";
+  case 2:
+    return "L1";
+  case 3:
+    return "L0s,L1";
+  }
 
-  return "PCIBUS:" + string(buffer);
+  return "off";
 }
 
-static string cardbushandle(u_int8_t bus)
+static const char *l0s_latency(unsigned int n)
 {
-  char buffer[10];
+  static const char *latencies[] = {
+    "<64ns", "64-128ns", "128-256ns", "256-512ns", "512ns-1us", "1-2us",
+    "2-4us", ">4us"
+  };
 
-  snprintf(buffer, sizeof(buffer), "%02x", bus);
+  return latencies[n & 7];
+}
 
-  return "CARDBUS:" + string(buffer);
+static const char *l1_latency(unsigned int n)
+{
+  static const char *latencies[] = {
+    "<1us", "1-2us", "2-4us", "4-8us", "8-16us", "16-32us", "32-64us",
+    ">64us"
+  };
+
+  return latencies[n & 7];
 }
 
-static string pci_handle(u_int16_t bus,
-			 u_int8_t dev,
-			 u_int8_t fct)
+static string number(unsigned long long n)
 {
-  char buffer[20];
+  char buffer[30];
 
-  snprintf(buffer, sizeof(buffer), "PCI:%02x:%02x.%x", bus, dev, fct);
+  snprintf(buffer, sizeof(buffer), "%llu", n);
 
   return string(buffer);
 }
 
-static void add_pci(hwNode & n,
-		    hwNode & core)
+/*
+ * reports the Device Control and Link Control settings next to what the
+ * device and the ports above it support. everything on a path should
+ * use the same payload size, and power saving states add latency that
+ * network adapters can't afford.
+ */
+static void describe_control(hwNode & device,
+			     const pci_entry & entry,
+			     const pcie_link & link)
 {
+  const pci_dev & d = entry.d;
+  pci_regs exp(d, link.cap);
+  unsigned int mps = exp[PCI_EXP_DEVCTL_PAYLOAD];
+  unsigned int mpscap = exp[PCI_EXP_DEVCAP_PAYLOAD];
+  unsigned int pathmps = mpscap;
+  string misconfigured = "";
+  int depth = 0;
+
+  device.setConfig("mps", number(payload(mps)));
+  device.setConfig("mpscap", number(payload(mpscap)));
+  device.setConfig("mrrs", number(payload(exp[PCI_EXP_DEVCTL_READRQ])));
+  device.setConfig("relaxedordering",
+		   exp[PCI_EXP_DEVCTL_RELAX_EN] ? "on" : "off");
+  device.setConfig("nosnoop", exp[PCI_EXP_DEVCTL_NOSNOOP_EN] ? "on" : "off");
+
+  // the largest payload every port up to the root complex could take
+  for (const pci_entry * up = entry.upstream; up && (depth < 32);
+       up = up->upstream, depth++)
+  {
+    pcie_link port;
+
+    if (!get_pcie_link(up->d, port))
+      break;
+
+    pci_regs portexp(up->d, port.cap);
+
+    if (portexp[PCI_EXP_DEVCAP_PAYLOAD] < pathmps)
+      pathmps = portexp[PCI_EXP_DEVCAP_PAYLOAD];
+    if ((up == entry.upstream) && (portexp[PCI_EXP_DEVCTL_PAYLOAD] != mps))
+      misconfigured = "mps";
+  }
+  if (entry.upstream)
+    device.setConfig("pathmps", number(payload(pathmps)));
+
+  if (haslink(link))
+  {
+    unsigned int aspmcap = exp[PCI_EXP_LNKCAP_ASPMS];
+
+    device.setConfig("aspm", aspm_states(exp[PCI_EXP_LNKCTL_ASPMC]));
+    device.setConfig("aspmcap", aspm_states(aspmcap));
+    if (aspmcap & 1)
+      device.setConfig("l0sexit", l0s_latency(exp[PCI_EXP_LNKCAP_L0SEL]));
+    if (aspmcap & 2)
+      device.setConfig("l1exit", l1_latency(exp[PCI_EXP_LNKCAP_L1EL]));
+
+    if (((pci_regs(d)[PCI_CLASS_DEVICE] >> 8) == PCI_BASE_CLASS_NETWORK)
+	&& exp[PCI_EXP_LNKCTL_ASPMC])
+      misconfigured += string((misconfigured != "") ? "," : "") + "aspm";
+  }
+
+  if (misconfigured != "")
+    device.setConfig("misconfigured", misconfigured);
 }
 
-bool scan_pci(hwNode & n)
+static string bar_size(unsigned long long size)
 {
-  FILE *f;
-  hwNode host("pci",
-	      hw::bridge);
+  const char *prefixes = "KMGTPE";
+  int i = 0;
+  char buffer[30];
+
+  while ((size >= 1024) && (size % 1024 == 0) && (i < 6))
+  {
+    size >>= 10;
+    i++;
+  }
+
+  snprintf(buffer, sizeof(buffer), "%llu%sB", size,
+	   (i > 0) ? string(1, prefixes[i - 1]).c_str() : "");
 
-  // always consider the host bridge as PCI bus 00:
-  host.setHandle(pci_bushandle(0));
+  return string(buffer);
+}
 
-  load_pcidb();
+/*
+ * base address registers, as bar<n>=<type>[,prefetchable],<size>:
+ * resizable ones also give their largest possible size and are flagged
+ * when they are set smaller than that
+ */
+static void describe_bars(hwNode & device,
+			  const pci_dev & d)
+{
+  unsigned int rebar = find_ext_capability(d, PCI_EXT_CAP_ID_REBAR);
+  unsigned int nrebar = 0;
+  int count = 0;
 
-  f = fopen(PROC_BUS_PCI "/devices", "r");
-  if (f)
+  switch (pci_regs(d)[PCI_HEADER_TYPE])
   {
-    char buf[512];
+  case PCI_HEADER_TYPE_NORMAL:
+    count = 6;
+    break;
+  case PCI_HEADER_TYPE_BRIDGE:
+    count = 2;
+    break;
+  case PCI_HEADER_TYPE_CARDBUS:
+    count = 1;
+    break;
+  }
 
-    while (fgets(buf, sizeof(buf) - 1, f))
+  if (rebar)
+    nrebar = pci_regs(d, rebar)[PCI_REBAR_CTRL_NBAR];
+
+  for (int j = 0; j < count; j++)
+  {
+    u_int32_t bar = get_conf_long(d, PCI_BASE_ADDRESS_0 + 4 * j);
+    string description = "";
+    int index = j;
+
+    if ((bar & PCI_BASE_ADDRESS_SPACE_IO) == PCI_BASE_ADDRESS_SPACE_IO)
+      description = "io";
+    else if ((bar & PCI_BASE_ADDRESS_MEM_TYPE_MASK) ==
+	     PCI_BASE_ADDRESS_MEM_TYPE_64)
     {
-      unsigned int dfn, vend, cnt, known;
-      struct pci_dev d;
-      int fd = -1;
-      string devicepath = "";
-      char devicename[20];
-      char driver[50];
-      hwNode *device = NULL;
-
-      memset(&d, 0, sizeof(d));
-      memset(driver, 0, sizeof(driver));
-      cnt = sscanf(buf,
-		   "%x %x %x %llx %llx %llx %llx %llx %llx %llx %llx %llx %llx %llx %llx %llx %llx %s",
-		   &dfn,
-		   &vend,
-		   &d.irq,
-		   &d.base_addr[0],
-		   &d.base_addr[1],
-		   &d.base_addr[2],
-		   &d.base_addr[3],
-		   &d.base_addr[4],
-		   &d.base_addr[5],
-		   &d.rom_base_addr,
-		   &d.size[0],
-		   &d.size[1],
-		   &d.size[2],
-		   &d.size[3], &d.size[4], &d.size[5], &d.rom_size, driver);
-
-      if (cnt != 9 && cnt != 10 && cnt != 17 && cnt != 18)
-	break;
+      description = "mem64";
+      j++;			// the upper half is in the next register
+    }
+    else
+      description = "mem32";
 
-      d.bus = dfn >> 8;
-      d.dev = PCI_SLOT(dfn & 0xff);
-      d.func = PCI_FUNC(dfn & 0xff);
-      d.vendor_id = vend >> 16;
-      d.device_id = vend & 0xffff;
+    if (d.size[index] == 0)
+      continue;			// not implemented
 
-      snprintf(devicename, sizeof(devicename), "%02x/%02x.%x", d.bus, d.dev,
-	       d.func);
-      devicepath = string(PROC_BUS_PCI) + "/" + string(devicename);
+    if (!(bar & PCI_BASE_ADDRESS_SPACE_IO) &&
+	(bar & PCI_BASE_ADDRESS_MEM_PREFETCH))
+      description += ",prefetchable";
+    description += "," + bar_size(d.size[index]);
 
-      fd = open(devicepath.c_str(), O_RDONLY);
-      if (fd >= 0)
-      {
-	read(fd, d.config, sizeof(d.config));
-	close(fd);
-      }
+    for (unsigned int k = 0; k < nrebar; k++)
+    {
+      pci_regs resizable(d, rebar + 8 * k);
+      u_int32_t sizes = resizable[PCI_REBAR_CAP_SIZES];
+      unsigned int current = resizable[PCI_REBAR_CTRL_BAR_SIZE];
+      unsigned int largest = 0;
+
+      if ((int) resizable[PCI_REBAR_CTRL_BAR_IDX] != index)
+	continue;
+
+      while (sizes >> (largest + 1))
+	largest++;
+      description += "/" + bar_size((1ULL << 20) << largest);
+      if (current < largest)
+	description += ",undersized";
+    }
+
+    device.setConfig("bar" + number(index), description);
+  }
+}
 
-      u_int16_t dclass = get_conf_word(d, PCI_CLASS_DEVICE);
-      u_int16_t cmd = get_conf_word(d, PCI_COMMAND);
-      u_int16_t status = get_conf_word(d, PCI_STATUS);
-      u_int8_t progif = get_conf_byte(d, PCI_CLASS_PROG);
-      u_int8_t rev = get_conf_byte(d, PCI_REVISION_ID);
-      u_int8_t htype = get_conf_byte(d, PCI_HEADER_TYPE) & 0x7f;
+static string aer_status(u_int32_t status,
+			 const char **names)
+{
+  string result = "";
 
-      char revision[10];
-      snprintf(revision, sizeof(revision), "%02x", rev);
-      string moredescription = get_class_description(dclass, progif);
-      string drivername = hw::strip(driver);
+  for (unsigned int bit = 0; bit < 32; bit++)
+    if ((status & (1U << bit)) && names[bit])
+      result += string((result != "") ? "," : "") + names[bit];
 
-      if (dclass == PCI_CLASS_BRIDGE_HOST)
-      {
-	host.setDescription(get_class_description(dclass, progif));
-	host.setVendor(get_device_description(d.vendor_id));
-	host.setProduct(get_device_description(d.vendor_id, d.device_id));
-	host.setHandle(pci_bushandle(d.bus));
-	host.setVersion(revision);
-	host.claim();
-
-	if (moredescription != "" && moredescription != host.getDescription())
-	{
-	  host.addCapability(moredescription);
-	  host.setDescription(device->getDescription() + " (" +
-			      moredescription + ")");
-	}
+  return result;
+}
 
-	if (status & PCI_STATUS_66MHZ)
-	  host.setClock(66000000UL);	// 66MHz
-	else
-	  host.setClock(33000000UL);	// 33MHz
-      }
-      else
-      {
-	hw::hwClass deviceclass = hw::generic;
-	string devicename = "generic";
+/*
+ * virtio devices are all alike to the PCI IDs: their type is in the
+ * device ID, or in the subsystem ID for transitional devices
+ */
+static void describe_virtio(hwNode & device,
+			    const pci_entry & entry)
+{
+  static const char *types[] = {
+    NULL, "network", "block", "console", "entropy", "balloon", "iomemory",
+    "rpmsg", "scsi", "9p", "mac80211", "rprocserial", "caif", "balloon",
+    NULL, NULL, "gpu", "clock", "input", "vsock", "crypto", "sdm",
+    "pstore", "iommu", "memory", "sound", "filesystem", "pmem",
+  };
+  const pci_dev & d = entry.d;
+  unsigned int type = 0;
+
+  if (d.vendor_id != PCI_VENDOR_ID_VIRTIO)
+    return;
+
+  if ((d.device_id >= PCI_DEVICE_ID_VIRTIO_TRANS)
+      && (d.device_id < PCI_DEVICE_ID_VIRTIO_MODERN))
+    type = pci_regs(d)[PCI_SUBSYSTEM_ID];
+  else if ((d.device_id >= PCI_DEVICE_ID_VIRTIO_MODERN)
+	   && (d.device_id < PCI_DEVICE_ID_VIRTIO_END))
+    type = d.device_id - PCI_DEVICE_ID_VIRTIO_MODERN;
+  else
+    return;
 
-	switch (dclass >> 8)
-	{
-	case PCI_BASE_CLASS_STORAGE:
-	  deviceclass = hw::storage;
-	  break;
-	case PCI_BASE_CLASS_NETWORK:
-	  deviceclass = hw::network;
-	  break;
-	case PCI_BASE_CLASS_MEMORY:
-	  deviceclass = hw::memory;
-	  break;
-	case PCI_BASE_CLASS_BRIDGE:
-	  deviceclass = hw::bridge;
-	  break;
-	case PCI_BASE_CLASS_MULTIMEDIA:
-	  deviceclass = hw::multimedia;
-	  break;
-	case PCI_BASE_CLASS_DISPLAY:
-	  deviceclass = hw::display;
-	  break;
-	case PCI_BASE_CLASS_COMMUNICATION:
-	  deviceclass = hw::communication;
-	  break;
-	case PCI_BASE_CLASS_SYSTEM:
-	  deviceclass = hw::system;
-	  break;
-	case PCI_BASE_CLASS_INPUT:
-	  deviceclass = hw::input;
-	  break;
-	case PCI_BASE_CLASS_PROCESSOR:
-	  deviceclass = hw::processor;
-	  break;
-	case PCI_BASE_CLASS_SERIAL:
-	  deviceclass = hw::bus;
-	  break;
-	}
+  if ((type < sizeof(types) / sizeof(types[0])) && types[type])
+  {
+    device.setConfig("virtio", types[type]);
+    if (device.getProduct() == "")
+      device.setProduct(string("Virtio ") + types[type] + " device");
+  }
+  else
+    device.setConfig("virtio", number(type));
 
-	devicename = get_class_name(dclass);
-	device = new hwNode(devicename, deviceclass);
+  if (entry.queues >= 0)
+    device.setConfig("queues", number(entry.queues));
+}
 
-	if (device)
-	{
-	  if (devicename == "pcmcia")
-	    device->addCapability("pcmcia");
-
-	  if (deviceclass == hw::display)
-	    for (int j = 0; j < 6; j++)
-	      if ((d.size[j] != 0xffffffff)
-		  && (d.size[j] > device->getSize()))
-		device->setSize(d.size[j]);
-
-	  if (dclass == PCI_CLASS_BRIDGE_PCI)
-	  {
-	    device->
-	      setHandle(pci_bushandle(get_conf_byte(d, PCI_SECONDARY_BUS)));
-	    device->claim();
-	  }
-	  else
-	  {
-	    char irq[10];
-
-	    snprintf(irq, sizeof(irq), "%d", d.irq);
-	    device->setHandle(pci_handle(d.bus, d.dev, d.func));
-	    if (d.irq != 0)
-	      device->setConfig("irq", irq);
-	  }
-	  device->setDescription(get_class_description(dclass));
-
-	  if (moredescription != ""
-	      && moredescription != device->getDescription())
-	  {
-	    device->addCapability(moredescription);
-	    device->setDescription(device->getDescription() + " (" +
-				   moredescription + ")");
-	  }
-	  device->setVendor(get_device_description(d.vendor_id));
-	  device->setVersion(revision);
-	  device->
-	    setProduct(get_device_description(d.vendor_id, d.device_id));
-
-	  if (cmd & PCI_COMMAND_MASTER)
-	    device->addCapability("bus master");
-	  if (cmd & PCI_COMMAND_VGA_PALETTE)
-	    device->addCapability("VGA palette");
-	  if (status & PCI_STATUS_CAP_LIST)
-	    device->addCapability("cap list");
-	  if (status & PCI_STATUS_66MHZ)
-	    device->setClock(66000000UL);	// 66MHz
-	  else
-	    device->setClock(33000000UL);	// 33MHz
-
-	  if (drivername != "")
-	  {
-	    device->setConfig("driver", drivername);
-	    device->claim();
-	  }
-
-	  hwNode *bus = host.findChildByHandle(pci_bushandle(d.bus));
-
-	  if (bus)
-	    bus->addChild(*device);
-	  else
-	    host.addChild(*device);
-	  free(device);
-	}
-      }
+/*
+ * errors seen on the device, so that flaky links can be told from the
+ * link state: the sticky status bits of the AER capability (root only)
+ * and the counters the kernel keeps
+ */
+static void describe_errors(hwNode & device,
+			    const pci_entry & entry)
+{
+  static const char *uncorrectable[32] = {
+    NULL, NULL, NULL, NULL, "DLP", "SDES", NULL, NULL,
+    NULL, NULL, NULL, NULL, "PoisonedTLP", "FCP", "CmpltTO", "CmpltAbrt",
+    "UnxCmplt", "RxOF", "MalfTLP", "ECRC", "UnsupReq", "ACSViol",
+    "UncorrIntErr", "BlockedTLP", "AtomicOpBlocked", "TLPBlockedErr",
+    NULL, NULL, NULL, NULL, NULL, NULL,
+  };
+  static const char *correctable[32] = {
+    "RxErr", NULL, NULL, NULL, NULL, NULL, "BadTLP", "BadDLLP",
+    "Rollover", NULL, NULL, NULL, "Timeout", "NonFatalErr", "CorrIntErr",
+    "HeaderOF",
+  };
+  unsigned int cap = find_ext_capability(entry.d, PCI_EXT_CAP_ID_ERR);
+
+  if (cap)
+  {
+    string status =
+      aer_status(pci_regs(entry.d, cap)[PCI_ERR_UNCOR_STATUS], uncorrectable);
+    string corrected =
+      aer_status(pci_regs(entry.d, cap)[PCI_ERR_COR_STATUS], correctable);
+
+    device.addCapability("AER");
+    if (corrected != "")
+      status += string((status != "") ? "," : "") + corrected;
+    if (status != "")
+      device.setConfig("aerstatus", status);
+  }
 
-    }
-    fclose(f);
+  if (!entry.aer)
+    return;
 
-    hwNode *core = n.getChild("core");
-    if (!core)
+  for (unsigned int k = 0; k < 3; k++)
+  {
+    device.setConfig(aer_names[k], number(entry.errors[k]));
+    if (entry.rates[k] >= 0)
     {
-      n.addChild(hwNode("core", hw::system));
-      core = n.getChild("core");
-    }
+      char rate[30];
 
-    if (core)
-      core->addChild(host);
+      snprintf(rate, sizeof(rate), "%.2f/s", entry.rates[k]);
+      device.setConfig(string(aer_names[k]) + "rate", rate);
+    }
   }
+  if (entry.errorkinds != "")
+    device.setConfig("errors", entry.errorkinds);
+}
+
+static string pci_bushandle(u_int8_t bus,
+			    u_int32_t domain = 0)
+{
+  char buffer[20];
+
+  // domain 0 keeps the short form other modules rely on
+  if (domain == 0)
+    snprintf(buffer, sizeof(buffer), "%02x", bus);
+  else
+    snprintf(buffer, sizeof(buffer), "%04x:%02x", domain, bus);
+
+  return "PCIBUS:" + string(buffer);
+}
+
+static string cardbushandle(u_int8_t bus)
+{
+  char buffer[10];
+
+  snprintf(buffer, sizeof(buffer), "%02x", bus);
+
+  return "CARDBUS:" + string(buffer);
+}
+
+static string pci_handle(u_int16_t bus,
+			 u_int8_t dev,
+			 u_int8_t fct,
+			 u_int32_t domain = 0)
+{
+  char buffer[30];
+
+  if (domain == 0)
+    snprintf(buffer, sizeof(buffer), "PCI:%02x:%02x.%x", bus, dev, fct);
+  else
+    snprintf(buffer, sizeof(buffer), "PCI:%04x:%02x:%02x.%x", domain, bus,
+	     dev, fct);
+
+  return string(buffer);
+}
+
+static void add_pci(hwNode & n,
+		    hwNode & core)
+{
+}
+
+/*
+ * parses a line of /proc/bus/pci/devices and reads the configuration
+ * space of the device it describes
+ */
+static bool parse_pci_device(const string & line,
+			     pci_entry & entry)
+{
+  pci_dev & d = entry.d;
+  const char *buf = line.c_str();
+  const char *end = buf + line.length();
+  unsigned long long fields[17];
+  unsigned int dfn, vend, cnt;
+  int fd = -1;
+  char devicename[20];
+
+  memset(&d, 0, sizeof(d));
+  memset(fields, 0, sizeof(fields));
+  entry.driver = "";
+  entry.parent = "";
+  entry.localcpus = "";
+  entry.socket = -1;
+  entry.physfnname = "";
+  entry.iommugroup = "";
+  entry.aer = false;
+  entry.rates[0] = entry.rates[1] = entry.rates[2] = -1;
+  entry.queues = -1;
+  d.numa_node = -1;
+
+  // bus/devfn, vendor/device, irq, 7 base addresses, then optionally
+  // 7 sizes and the driver name
+  for (cnt = 0; cnt < 17; cnt++)
+    if (!parse_number(buf, end, fields[cnt], 16))
+      break;
+  if (cnt == 17)
+  {
+    entry.driver = hw::strip(string(buf, end - buf));
+    if (entry.driver != "")
+      cnt++;
+  }
+
+  if (cnt != 9 && cnt != 10 && cnt != 17 && cnt != 18)
+    return false;
+
+  dfn = fields[0];
+  vend = fields[1];
+  d.irq = fields[2];
+  for (int j = 0; j < 6; j++)
+  {
+    d.base_addr[j] = fields[3 + j];
+    d.size[j] = fields[10 + j];
+  }
+  d.rom_base_addr = fields[9];
+  d.rom_size = fields[16];
+
+  d.bus = dfn >> 8;
+  d.dev = PCI_SLOT(dfn & 0xff);
+  d.func = PCI_FUNC(dfn & 0xff);
+  d.vendor_id = vend >> 16;
+  d.device_id = vend & 0xffff;
+
+  snprintf(devicename, sizeof(devicename), "%02x/%02x.%x", d.bus, d.dev,
+	   d.func);
+
+  fd = vfs_open(string(PROC_BUS_PCI) + "/" + string(devicename), O_RDONLY);
+  if (fd >= 0)
+  {
+    vfs_read(fd, d.config, 256);	// no extended space in /proc
+    vfs_close(fd);
+  }
+
+  snprintf(devicename, sizeof(devicename), "0000:%02x:%02x.%x", d.bus,
+	   d.dev, d.func);
+  entry.name = devicename;
+  entry.valid = true;
+
+  return true;
+}
+
+static bool scan_proc(vector < pci_entry > &entries)
+{
+  vector < string > lines;
+
+  if (!loadfile(PROC_BUS_PCI "/devices", lines))
+    return false;
+
+  for (unsigned int i = 0; i < lines.size(); i++)
+  {
+    pci_entry entry;
+
+    if (!parse_pci_device(lines[i], entry))
+      break;
+    entries.push_back(entry);
+  }
+
+  return true;
+}
+
+/*
+ * sysfs names devices after their domain:bus:device.function address
+ */
+static bool parse_address(const string & name,
+			  pci_dev & d)
+{
+  unsigned int domain = 0, bus = 0, dev = 0, func = 0;
+  char extra = 0;
+
+  if (sscanf(name.c_str(), "%x:%x:%x.%x%c", &domain, &bus, &dev, &func,
+	     &extra) != 4)
+    return false;
+
+  d.domain = domain;
+  d.bus = bus;
+  d.dev = dev;
+  d.func = func;
+
+  return true;
+}
+
+static string lastcomponent(const string & path)
+{
+  size_t pos = path.rfind('/');
+
+  if (pos == string::npos)
+    return path;
+
+  return path.substr(pos + 1);
+}
+
+/*
+ * the upstream bridge is the component before the device in its
+ * canonical path (root devices sit under a "pciDDDD:BB" node instead)
+ */
+static string sysfs_parent(const string & name)
+{
+  string target = "";
+  size_t pos = string::npos;
+  string parent = "";
+  pci_dev d;
+
+  if (vfs_readlink(string(SYS_BUS_PCI) + "/" + name, target) != 0)
+    return "";
+
+  pos = target.rfind('/');
+  if ((pos == string::npos) || (pos == 0))
+    return "";
+  parent = lastcomponent(target.substr(0, pos));
+
+  if (!parse_address(parent, d))
+    return "";
+
+  return parent;
+}
+
+/*
+ * the socket a device hangs off is the one of the CPUs local to it
+ */
+static int cpu_socket(const string & cpulist)
+{
+  const char *p = cpulist.c_str();
+  unsigned long long cpu = 0, package = 0;
+  char path[80];
+
+  if (!parse_number(p, p + cpulist.length(), cpu))
+    return -1;
+
+  snprintf(path, sizeof(path),
+	   "/sys/devices/system/cpu/cpu%llu/topology/physical_package_id",
+	   cpu);
+  if (!get_number(path, package))
+    return -1;
+
+  return package;
+}
+
+/*
+ * the kernel's AER counters: one "kind count" line per error kind and a
+ * TOTAL_ERR_* line per file
+ */
+static bool read_aer(const string & path,
+		     unsigned long long *errors,
+		     string & kinds)
+{
+  kinds = "";
+
+  for (unsigned int k = 0; k < 3; k++)
+  {
+    vector < string > lines;
+
+    errors[k] = 0;
+    if (!loadfile(path + "/" + aer_files[k], lines))
+      return false;
+
+    for (unsigned int j = 0; j < lines.size(); j++)
+    {
+      string::size_type space = lines[j].find(' ');
+      string kind = lines[j].substr(0, space);
+      unsigned long long count = 0;
+
+      if ((space == string::npos) ||
+	  (sscanf(lines[j].c_str() + space, "%llu", &count) != 1))
+	continue;
+
+      if (kind.compare(0, 10, "TOTAL_ERR_") == 0)
+	errors[k] = count;
+      else if (count > 0)
+      {
+	char buffer[30];
+
+	snprintf(buffer, sizeof(buffer), ":%llu", count);
+	kinds += string((kinds != "") ? "," : "") + kind + buffer;
+      }
+    }
+  }
+
+  return true;
+}
+
+static void sample_aer(unsigned int i,
+		       void *data)
+{
+  pci_entry & entry = ((pci_entry *) data)[i];
+  string kinds = "";
+
+  if (entry.aer &&
+      !read_aer(string(SYS_BUS_PCI) + "/" + entry.name, entry.sample, kinds))
+    memcpy(entry.sample, entry.errors, sizeof(entry.sample));
+}
+
+/*
+ * the virtqueues a virtio driver uses: the network and block drivers
+ * list theirs, otherwise each queue gets an MSI-X vector of its own
+ * besides the one for configuration changes
+ */
+static int virtio_queues(const string & path)
+{
+  vector < string > names;
+  vector < string > queues;
+  string virtio = "";
+
+  if (!listdir(path, names))
+    return -1;
+  for (unsigned int i = 0; i < names.size(); i++)
+    if (names[i].compare(0, 6, "virtio") == 0)
+      virtio = path + "/" + names[i];
+  if (virtio == "")
+    return -1;			// no driver
+
+  if (listdir(virtio + "/net", names) && !names.empty()
+      && listdir(virtio + "/net/" + names[0] + "/queues", queues))
+    return queues.size();	// rx-N and tx-N
+  if (listdir(virtio + "/block", names) && !names.empty()
+      && listdir(virtio + "/block/" + names[0] + "/mq", queues))
+    return queues.size();
+
+  if (listdir(path + "/msi_irqs", queues) && (queues.size() > 1))
+    return queues.size() - 1;
+
+  return -1;
+}
+
+struct sysfs_scan
+{
+  pci_entry *entries;
+  bool expandvfs;
+};
+
+/*
+ * runs on the thread pool: the attributes of all the devices are read
+ * in parallel
+ */
+static void read_sysfs_device(unsigned int i,
+			      void *data)
+{
+  sysfs_scan *scan = (sysfs_scan *) data;
+  pci_entry & entry = scan->entries[i];
+  pci_dev & d = entry.d;
+  string path = string(SYS_BUS_PCI) + "/" + entry.name;
+  vector < string > resources;
+  unsigned long long value = 0;
+  string driver = "";
+  string physfn = "";
+  string group = "";
+  size_t len = 0;
+  int fd = -1;
+
+  memset(&d, 0, sizeof(d));
+  entry.physfnname = "";
+  entry.aer = false;
+  entry.rates[0] = entry.rates[1] = entry.rates[2] = -1;
+  entry.queues = -1;
+  entry.valid = parse_address(entry.name, d);
+  if (!entry.valid)
+    return;
+
+  if (vfs_readlink(path + "/physfn", physfn) == 0)
+    entry.physfnname = lastcomponent(physfn);
+
+  // there can be thousands of virtual functions: unless they are to be
+  // listed individually, their driver is all we need
+  if ((entry.physfnname != "") && !scan->expandvfs)
+  {
+    if (vfs_readlink(path + "/driver", driver) == 0)
+      entry.driver = lastcomponent(driver);
+    d.numa_node = -1;
+    entry.socket = -1;
+    return;
+  }
+
+  // the whole 4 KB are only readable by root, everybody gets 64 bytes
+  fd = vfs_open(path + "/config", O_RDONLY);
+  if (fd >= 0)
+  {
+    ssize_t count = 0;
+
+    while ((len < sizeof(d.config)) &&
+	   ((count = vfs_read(fd, d.config + len, sizeof(d.config) - len)) > 0))
+      len += count;
+    vfs_close(fd);
+  }
+
+  if (len < 64)
+  {
+    unsigned long long vendor = 0, device = 0, c = 0;
+
+    if (!get_number(path + "/vendor", vendor, 16) ||
+	!get_number(path + "/device", device, 16) ||
+	!get_number(path + "/class", c, 16))
+    {
+      entry.valid = false;
+      return;
+    }
+
+    d.config[PCI_VENDOR_ID.offset] = vendor & 0xff;
+    d.config[PCI_VENDOR_ID.offset + 1] = (vendor >> 8) & 0xff;
+    d.config[PCI_DEVICE_ID.offset] = device & 0xff;
+    d.config[PCI_DEVICE_ID.offset + 1] = (device >> 8) & 0xff;
+    d.config[PCI_CLASS_PROG.offset] = c & 0xff;
+    d.config[PCI_CLASS_DEVICE.offset] = (c >> 8) & 0xff;
+    d.config[PCI_CLASS_DEVICE.offset + 1] = (c >> 16) & 0xff;
+  }
+  d.vendor_id = pci_regs(d)[PCI_VENDOR_ID];
+  d.device_id = pci_regs(d)[PCI_DEVICE_ID];
+
+  if (get_number(path + "/irq", value))
+    d.irq = value;
+
+  // start, end and flags of the 6 base addresses and of the ROM
+  if (loadfile(path + "/resource", resources))
+    for (unsigned int j = 0; (j < resources.size()) && (j < 7); j++)
+    {
+      const char *p = resources[j].c_str();
+      const char *end = p + resources[j].length();
+      unsigned long long start = 0, last = 0, flags = 0;
+      pciaddr_t size = 0;
+
+      if (!parse_number(p, end, start, 16) ||
+	  !parse_number(p, end, last, 16) || !parse_number(p, end, flags, 16))
+	break;
+
+      if (start || last)
+	size = last - start + 1;
+      if (j < 6)
+      {
+	d.base_addr[j] = start;
+	d.size[j] = size;
+      }
+      else
+      {
+	d.rom_base_addr = start;
+	d.rom_size = size;
+      }
+    }
+
+  if (vfs_readlink(path + "/driver", driver) == 0)
+    entry.driver = lastcomponent(driver);
+
+  d.numa_node = atoi(get_string(path + "/numa_node", "-1").c_str());
+
+  entry.iommugroup = "";
+  if (vfs_readlink(path + "/iommu_group", group) == 0)
+    entry.iommugroup = lastcomponent(group);
+
+  entry.localcpus = hw::strip(get_string(path + "/local_cpulist"));
+  entry.socket = cpu_socket(entry.localcpus);
+
+  entry.aer = read_aer(path, entry.errors, entry.errorkinds);
+
+  if (d.vendor_id == PCI_VENDOR_ID_VIRTIO)
+    entry.queues = virtio_queues(path);
+
+  entry.parent = sysfs_parent(entry.name);
+}
+
+static bool scan_sysfs(vector < pci_entry > &entries,
+		       bool expandvfs)
+{
+  vector < string > names;
+  sysfs_scan scan;
+
+  if (!listdir(SYS_BUS_PCI, names) || names.empty())
+    return false;
+
+  entries.resize(names.size());
+  for (unsigned int i = 0; i < names.size(); i++)
+    entries[i].name = names[i];
+
+  scan.entries = &entries[0];
+  scan.expandvfs = expandvfs;
+  parallel_for(entries.size(), read_sysfs_device, &scan);
+
+  for (unsigned int i = entries.size(); i > 0; i--)
+    if (!entries[i - 1].valid)
+      entries.erase(entries.begin() + i - 1);
+
+  return entries.size() > 0;
+}
+
+/*
+ * describes a device in result, or its host if it's the host bridge (in
+ * which case it returns false)
+ */
+static bool add_pci_device(hwNode & host,
+			   const pci_entry & entry,
+			   hwNode & result)
+{
+  const pci_dev & d = entry.d;
+  const pci_entry *upstream = entry.upstream;
+  pcie_link link;
+
+  pci_regs regs(d);
+  u_int16_t dclass = regs[PCI_CLASS_DEVICE];
+  u_int16_t cmd = regs[PCI_COMMAND];
+  u_int16_t status = regs[PCI_STATUS];
+  u_int8_t progif = regs[PCI_CLASS_PROG];
+  u_int8_t rev = regs[PCI_REVISION_ID];
+  u_int8_t htype = regs[PCI_HEADER_TYPE];
+
+  char revision[10];
+  snprintf(revision, sizeof(revision), "%02x", rev);
+  string moredescription = get_class_description(dclass, progif);
+  string drivername = hw::strip(entry.driver);
+
+  if (dclass == PCI_CLASS_BRIDGE_HOST)
+  {
+    host.setDescription(get_class_description(dclass, progif));
+    host.setVendor(get_device_description(d.vendor_id));
+    host.setProduct(get_device_description(d.vendor_id, d.device_id));
+    host.setHandle(pci_bushandle(d.bus, d.domain));
+    host.setVersion(revision);
+    host.claim();
+
+    if (moredescription != "" && moredescription != host.getDescription())
+    {
+      host.addCapability(moredescription);
+      host.setDescription(host.getDescription() + " (" +
+			  moredescription + ")");
+    }
+
+    if (status & PCI_STATUS_66MHZ)
+      host.setClock(66000000UL);	// 66MHz
+    else
+      host.setClock(33000000UL);	// 33MHz
+  }
+  else
+  {
+    hw::hwClass deviceclass = hw::generic;
+    string devicename = "generic";
+
+    switch (dclass >> 8)
+    {
+    case PCI_BASE_CLASS_STORAGE:
+      deviceclass = hw::storage;
+      break;
+    case PCI_BASE_CLASS_NETWORK:
+      deviceclass = hw::network;
+      break;
+    case PCI_BASE_CLASS_MEMORY:
+      deviceclass = hw::memory;
+      break;
+    case PCI_BASE_CLASS_BRIDGE:
+      deviceclass = hw::bridge;
+      break;
+    case PCI_BASE_CLASS_MULTIMEDIA:
+      deviceclass = hw::multimedia;
+      break;
+    case PCI_BASE_CLASS_DISPLAY:
+      deviceclass = hw::display;
+      break;
+    case PCI_BASE_CLASS_COMMUNICATION:
+      deviceclass = hw::communication;
+      break;
+    case PCI_BASE_CLASS_SYSTEM:
+      deviceclass = hw::system;
+      break;
+    case PCI_BASE_CLASS_INPUT:
+      deviceclass = hw::input;
+      break;
+    case PCI_BASE_CLASS_PROCESSOR:
+    case PCI_BASE_CLASS_ACCELERATOR:
+      deviceclass = hw::processor;
+      break;
+    case PCI_BASE_CLASS_SERIAL:
+      deviceclass = hw::bus;
+      break;
+    }
+
+    devicename = get_class_name(dclass);
+    hwNode device(devicename, deviceclass);
+
+    if (devicename == "pcmcia")
+      device.addCapability("pcmcia");
+
+    if (deviceclass == hw::display)
+      for (int j = 0; j < 6; j++)
+	if ((d.size[j] != 0xffffffff)
+	    && (d.size[j] > device.getSize()))
+	  device.setSize(d.size[j]);
+
+    if (dclass == PCI_CLASS_BRIDGE_PCI)
+    {
+      device.setHandle(pci_bushandle(regs[PCI_SECONDARY_BUS], d.domain));
+      device.claim();
+    }
+    else
+    {
+      char irq[10];
+
+      snprintf(irq, sizeof(irq), "%d", d.irq);
+      device.setHandle(pci_handle(d.bus, d.dev, d.func, d.domain));
+      if (d.irq != 0)
+	device.setConfig("irq", irq);
+    }
+    device.setDescription(get_class_description(dclass));
+
+    if (moredescription != ""
+	&& moredescription != device.getDescription())
+    {
+      device.addCapability(moredescription);
+      device.setDescription(device.getDescription() + " (" +
+			     moredescription + ")");
+    }
+    device.setVendor(get_device_description(d.vendor_id));
+    device.setVersion(revision);
+    device.setProduct(get_device_description(d.vendor_id, d.device_id));
+
+    if (cmd & PCI_COMMAND_MASTER)
+      device.addCapability("bus master");
+    if (cmd & PCI_COMMAND_VGA_PALETTE)
+      device.addCapability("VGA palette");
+    if (status & PCI_STATUS_CAP_LIST)
+      device.addCapability("cap list");
+
+    // PCI Express has no bus clock to speak of, its links have speeds
+    if (get_pcie_link(d, link))
+    {
+      device.addCapability("PCI Express");
+      if (haslink(link))
+	describe_link(device, link, upstream ? &upstream->d : NULL);
+      describe_control(device, entry, link);
+    }
+    else if (status & PCI_STATUS_66MHZ)
+      device.setClock(66000000UL);    // 66MHz
+    else
+      device.setClock(33000000UL);    // 33MHz
+
+    describe_bars(device, d);
+    describe_errors(device, entry);
+    describe_virtio(device, entry);
+    if (entry.iommugroup != "")
+      device.setConfig("iommugroup", entry.iommugroup);
+
+    if (d.numa_node >= 0)
+    {
+      device.setConfig("numa", number(d.numa_node));
+      if (entry.localcpus != "")
+	device.setConfig("cpus", entry.localcpus);
+      if (entry.socket >= 0)
+	device.setConfig("socket", number(entry.socket));
+    }
+
+    if (drivername != "")
+    {
+      device.setConfig("driver", drivername);
+      device.claim();
+    }
+
+    result.swap(device);
+  }
+
+  return dclass != PCI_CLASS_BRIDGE_HOST;
+}
+
+static string sriov_vf(const pci_dev & d,
+		       unsigned int cap,
+		       unsigned int n)
+{
+  pci_regs sriov(d, cap);
+  unsigned int rid = (d.bus << 8) + PCI_DEVFN(d.dev, d.func) +
+    sriov[PCI_SRIOV_VF_OFFSET] + n * sriov[PCI_SRIOV_VF_STRIDE];
+  char buffer[20];
+
+  snprintf(buffer, sizeof(buffer), "%04x:%02x:%02x.%x", d.domain,
+	   (rid >> 8) & 0xff, PCI_SLOT(rid & 0xff), PCI_FUNC(rid & 0xff));
+
+  return string(buffer);
+}
+
+/*
+ * the virtual functions of a physical function are summed up in a
+ * single node: listing thousands of them would make the tree unusable
+ */
+static void describe_sriov(hwNode & pf,
+			   const pci_entry & entry,
+			   const vector < pci_entry > &entries,
+			   const vector < unsigned int >&vfs,
+			   bool expandvfs)
+{
+  const pci_dev & d = entry.d;
+  unsigned int cap = find_ext_capability(d, PCI_EXT_CAP_ID_SRIOV);
+  map < string, unsigned int >drivers;
+  string list = "";
+  unsigned int unbound = 0;
+
+  if (cap)
+  {
+    pci_regs sriov(d, cap);
+
+    pf.addCapability("SR-IOV");
+    pf.setConfig("totalvfs", number(sriov[PCI_SRIOV_TOTAL_VF]));
+    pf.setConfig("initialvfs", number(sriov[PCI_SRIOV_INITIAL_VF]));
+    pf.setConfig("vfs", number(sriov[PCI_SRIOV_CTRL_VFE] ?
+			       sriov[PCI_SRIOV_NUM_VF] : 0));
+    pf.setConfig("vfoffset", number(sriov[PCI_SRIOV_VF_OFFSET]));
+    pf.setConfig("vfstride", number(sriov[PCI_SRIOV_VF_STRIDE]));
+  }
+
+  if (expandvfs || vfs.empty())
+    return;
+
+  hwNode table("virtual", pf.getClass());
+
+  table.setDescription("SR-IOV virtual functions");
+  table.setVendor(pf.getVendor());
+  if (cap)
+    table.setProduct(get_device_description(d.vendor_id,
+					    pci_regs(d, cap)[PCI_SRIOV_VF_DID]));
+
+  for (unsigned int i = 0; i < vfs.size(); i++)
+    if (entries[vfs[i]].driver != "")
+      drivers[entries[vfs[i]].driver]++;
+    else
+      unbound++;
+  for (map < string, unsigned int >::iterator i = drivers.begin();
+       i != drivers.end(); i++)
+    list += string((list != "") ? "," : "") + i->first + ":" +
+      number(i->second);
+
+  const pci_dev & first = entries[vfs[0]].d;
+  const pci_dev & last = entries[vfs[vfs.size() - 1]].d;
+
+  table.setConfig("count", number(vfs.size()));
+  table.setConfig("first",
+		  pci_handle(first.bus, first.dev, first.func, first.domain));
+  table.setConfig("last",
+		  pci_handle(last.bus, last.dev, last.func, last.domain));
+  if (list != "")
+    table.setConfig("drivers", list);
+  if (unbound)
+    table.setConfig("unbound", number(unbound));
+  else
+    table.claim();
+
+  pf.addChild(table);
+}
+
+/*
+ * moves devices (and, recursively, what is behind them) to a bus: all the
+ * devices of a bus are added before going down, while they are still small
+ */
+static void attach_pci(hwNode & bus,
+		       const vector < unsigned int >&devices,
+		       vector < hwNode > &nodes,
+		       const vector < vector < unsigned int > >&below,
+		       vector < bool > &attached)
+{
+  unsigned int first = bus.countChildren();
+  vector < unsigned int >added;
+
+  for (unsigned int k = 0; k < devices.size(); k++)
+    if (!attached[devices[k]])
+    {
+      attached[devices[k]] = true;
+      bus.moveChild(nodes[devices[k]]);
+      added.push_back(devices[k]);
+    }
+
+  // PCI devices attract nothing, so they are the last children of bus
+  for (unsigned int k = 0; k < added.size(); k++)
+    if (!below[added[k]].empty() && bus.getChild(first + k))
+      attach_pci(*bus.getChild(first + k), below[added[k]], nodes, below,
+		 attached);
+}
+
+bool scan_pci(hwNode & n,
+	      bool expandvfs,
+	      unsigned int sample)
+{
+  vector < pci_entry > entries;
+  map < string, unsigned int >names;
+  map < u_int32_t, vector < int > >bridges;	// by domain and secondary bus
+  map < unsigned int, vector < unsigned int > >vfs;	// by physical function
+  map < string, vector < unsigned int > >groups;	// by IOMMU group
+  vector < hwNode > hosts;	// one per PCI domain
+  vector < u_int32_t > domains;
+  vector < hwNode > nodes;	// flat, attached once all are described
+  vector < int >hostof;	// -1 when not described
+  vector < vector < unsigned int > >below;	// devices behind each bridge
+  vector < vector < unsigned int > >onhost;	// devices on each host bus
+  vector < bool > attached;
+
+  if (!scan_sysfs(entries, expandvfs))
+  {
+    entries.clear();
+    if (!scan_proc(entries))
+      return false;
+  }
+
+  // error rates: the counters are read again once the interval is over
+  if ((sample > 0) && !vfs_replaying())
+  {
+    struct timeval start, stop;
+    double elapsed = 0;
+
+    gettimeofday(&start, NULL);
+    sleep(sample / 1000);
+    usleep((sample % 1000) * 1000);
+    parallel_for(entries.size(), sample_aer, &entries[0]);
+    gettimeofday(&stop, NULL);
+
+    elapsed = (stop.tv_sec - start.tv_sec) +
+      (stop.tv_usec - start.tv_usec) / 1000000.0;
+    if (elapsed > 0)
+      for (unsigned int i = 0; i < entries.size(); i++)
+	if (entries[i].aer)
+	  for (unsigned int k = 0; k < 3; k++)
+	    entries[i].rates[k] =
+	      (entries[i].sample[k] >= entries[i].errors[k]) ?
+	      (entries[i].sample[k] - entries[i].errors[k]) / elapsed : 0;
+  }
+
+  // only look up the ids that are actually needed
+  for (unsigned int i = 0; i < entries.size(); i++)
+  {
+    if (entries[i].d.vendor_id)
+      pcidb_want(entries[i].d.vendor_id, entries[i].d.device_id);
+    names[entries[i].name] = i;
+    entries[i].physfn = -1;
+    if (pci_regs(entries[i].d)[PCI_HEADER_TYPE] == PCI_HEADER_TYPE_BRIDGE)
+    {
+      vector < int >&buses = bridges[entries[i].d.domain];
+
+      if (buses.empty())
+	buses.resize(256, -1);
+      buses[pci_regs(entries[i].d)[PCI_SECONDARY_BUS]] = i;
+    }
+  }
+
+  // virtual functions are linked to their physical function by sysfs,
+  // or found from the routing ids given by the SR-IOV capability
+  for (unsigned int i = 0; i < entries.size(); i++)
+  {
+    map < string, unsigned int >::iterator pf =
+      names.find(entries[i].physfnname);
+
+    if ((pf != names.end()) && (pf->second != i))
+      entries[i].physfn = pf->second;
+  }
+  for (unsigned int i = 0; i < entries.size(); i++)
+  {
+    const pci_dev & d = entries[i].d;
+    unsigned int cap = find_ext_capability(d, PCI_EXT_CAP_ID_SRIOV);
+
+    if (cap == 0)
+      continue;
+
+    pci_regs sriov(d, cap);
+
+    pcidb_want(d.vendor_id, sriov[PCI_SRIOV_VF_DID]);
+    if (sriov[PCI_SRIOV_CTRL_VFE])
+      for (unsigned int k = 0; k < sriov[PCI_SRIOV_NUM_VF]; k++)
+      {
+	map < string, unsigned int >::iterator vf =
+	  names.find(sriov_vf(d, cap, k));
+
+	if ((vf != names.end()) && (vf->second != i))
+	  entries[vf->second].physfn = i;
+      }
+  }
+  for (unsigned int i = 0; i < entries.size(); i++)
+  {
+    if (entries[i].physfn >= 0)
+      vfs[entries[i].physfn].push_back(i);
+    if (entries[i].iommugroup != "")
+      groups[entries[i].iommugroup].push_back(i);
+  }
+
+  pcidb_load(PCIID_PATH);
+
+  for (unsigned int i = 0; i < entries.size(); i++)
+  {
+    const pci_dev & d = entries[i].d;
+    map < string, unsigned int >::iterator parent =
+      names.find(entries[i].parent);
+    map < u_int32_t, vector < int > >::iterator buses =
+      bridges.find(d.domain);
+    const pci_entry *upstream = NULL;
+
+    // sysfs tells which bridge the device is behind, otherwise it's the
+    // one whose secondary bus the device is on
+    if (parent != names.end())
+      upstream = &entries[parent->second];
+    else if ((buses != bridges.end()) && (buses->second[d.bus] >= 0))
+      upstream = &entries[buses->second[d.bus]];
+    if (upstream == &entries[i])
+      upstream = NULL;
+
+    entries[i].upstream = upstream;
+  }
+
+  // first describe every device on its own...
+  nodes.assign(entries.size(), hwNode(""));
+  hostof.assign(entries.size(), -1);
+  for (unsigned int i = 0; i < entries.size(); i++)
+  {
+    const pci_dev & d = entries[i].d;
+    hwNode & device = nodes[i];
+    unsigned int h = 0;
+
+    if ((entries[i].physfn >= 0) && !expandvfs)
+      continue;			// summed up under their physical function
+
+    while ((h < domains.size()) && (domains[h] != d.domain))
+      h++;
+    if (h == domains.size())
+    {
+      hosts.push_back(hwNode("pci", hw::bridge));
+      // always consider the host bridge as PCI bus 00:
+      hosts.back().setHandle(pci_bushandle(0, d.domain));
+      domains.push_back(d.domain);
+    }
+
+    if (!add_pci_device(hosts[h], entries[i], device))
+      continue;
+    hostof[i] = h;
+
+    if (entries[i].physfn >= 0)
+    {
+      const pci_dev & pf = entries[entries[i].physfn].d;
+
+      device.setConfig("physfn",
+		       pci_handle(pf.bus, pf.dev, pf.func, pf.domain));
+    }
+    describe_sriov(device, entries[i], entries, vfs[i], expandvfs);
+
+    // devices sharing an IOMMU group can only be assigned together
+    if (entries[i].iommugroup != "")
+    {
+      vector < unsigned int >&group = groups[entries[i].iommugroup];
+      string peers = "";
+
+      for (unsigned int j = 0; j < group.size(); j++)
+	if (group[j] != i)
+	{
+	  const pci_dev & peer = entries[group[j]].d;
+
+	  peers += string((peers != "") ? "," : "") +
+	    pci_handle(peer.bus, peer.dev, peer.func, peer.domain);
+	}
+      if (peers != "")
+	device.setConfig("iommupeers", peers);
+    }
+  }
+
+  // ...then hang them below the PCI bridge they are behind, going down
+  // from the host busses instead of looking each bus up in the tree
+  below.resize(entries.size());
+  onhost.resize(hosts.size());
+  attached.assign(entries.size(), false);
+  for (unsigned int i = 0; i < entries.size(); i++)
+  {
+    const pci_entry *upstream = entries[i].upstream;
+    int up = upstream ? upstream - &entries[0] : -1;
+
+    if (hostof[i] < 0)
+      continue;			// not described
+    if ((up >= 0) && (hostof[up] >= 0) &&
+	(nodes[up].getHandle() ==
+	 pci_bushandle(pci_regs(upstream->d)[PCI_SECONDARY_BUS],
+		       upstream->d.domain)))
+      below[up].push_back(i);
+    else
+      onhost[hostof[i]].push_back(i);
+  }
+  for (unsigned int h = 0; h < hosts.size(); h++)
+    attach_pci(hosts[h], onhost[h], nodes, below, attached);
+  // bridges whose bus numbers loop on each other can't be reached
+  for (unsigned int i = 0; i < entries.size(); i++)
+    if ((hostof[i] >= 0) && !attached[i])
+      attach_pci(hosts[hostof[i]], vector < unsigned int >(1, i), nodes,
+		 below, attached);
+
+  hwNode *core = n.getChild("core");
+  if (!core)
+  {
+    n.addChild(hwNode("core", hw::system));
+    core = n.getChild("core");
+  }
+
+  if (core)
+    for (unsigned int h = 0; h < hosts.size(); h++)
+      core->moveChild(hosts[h]);
 
   return false;
 }
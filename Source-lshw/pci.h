@@ -3,6 +3,12 @@
 
 #include "hw.h"
 
-bool scan_pci(hwNode & n);
+/*
+ * expandvfs: one node per SR-IOV VF
+ * sample: milliseconds over which to measure the AER error rates, 0 for none
+ */
+bool scan_pci(hwNode & n,
+	      bool expandvfs = false,
+	      unsigned int sample = 0);
 
 #endif
@@ -0,0 +1,838 @@
+#include "pcidb.h"
+#include "osutils.h"
+#include "parallel.h"
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+using namespace std;
+
+#define PCIDB_MAGIC "lshw-pcidb 1"
+#define PCIDB_CHUNK (64*1024)	/* smallest piece parsed by a thread */
+
+typedef enum
+{ pcidevice,
+  pcisubdevice,
+  pcisubsystem,
+  pciclass,
+  pcisubclass,
+  pcivendor,
+  pcisubvendor,
+  pciprogif
+}
+catalog;
+
+/*
+ * cache file layout: this header, the key (description of the source
+ * files, padded to 4 bytes), the device records, the class records and
+ * the string pool. everything is in host byte order.
+ */
+struct pcidb_header
+{
+  char magic[16];
+  u_int32_t keylength;
+  u_int32_t devices;
+  u_int32_t classes;
+  u_int32_t strings;
+};
+
+/*
+ * read-only view of an index, either mapped from the cache or built in
+ * memory
+ */
+struct pcidb_index
+{
+  const pcidb_record *devices;
+  size_t ndevices;
+  const pcidb_record *classes;
+  size_t nclasses;
+  const char *strings;
+  size_t nstrings;
+};
+
+static pcidb_index db;
+static pcidb_index builtin;
+
+// storage for an index built in memory
+static vector < pcidb_record > devices;
+static vector < pcidb_record > classes;
+static string strings;
+
+/*
+ * ids the caller is going to look up: when the index can't be cached,
+ * only their entries are kept and the other vendors are skipped
+ */
+static set < long >wantedvendors;
+static set < long >wanteddevices;	// vendor << 16 | device
+static bool lazy = false;
+
+// records parsed from a piece of pci.ids, with their own string pool
+struct pcidb_table
+{
+  vector < pcidb_record > devices;
+  vector < pcidb_record > classes;
+  string strings;
+};
+
+struct pcidb_chunk
+{
+  const char *data;
+  size_t len;
+  pcidb_table table;
+  bool result;
+};
+
+static bool record_less(const pcidb_record & a,
+			const pcidb_record & b)
+{
+  for (int i = 0; i < 4; i++)
+    if (a.ids[i] != b.ids[i])
+      return a.ids[i] < b.ids[i];
+
+  return false;
+}
+
+/*
+ * orders records on their first ids only
+ */
+class prefix_less
+{
+  public:
+  prefix_less(int l):length(l)
+  {
+  }
+
+  bool operator() (const pcidb_record & a, const pcidb_record & b) const
+  {
+    for (int i = 0; i < length; i++)
+      if (a.ids[i] != b.ids[i])
+	return a.ids[i] < b.ids[i];
+
+    return false;
+  }
+
+  private:
+  int length;
+};
+
+/*
+ * finds the entry sharing the longest prefix of ids with the query (the
+ * most generic one on ties, which is also the first one in pci.ids)
+ */
+static const char *lookup(const pcidb_record * records,
+			  size_t count,
+			  long u1,
+			  long u2,
+			  long u3,
+			  long u4)
+{
+  pcidb_record key;
+
+  key.ids[0] = u1;
+  key.ids[1] = u2;
+  key.ids[2] = u3;
+  key.ids[3] = u4;
+
+  for (int length = 4; length > 0; length--)
+  {
+    prefix_less less(length);
+    const pcidb_record *i =
+      lower_bound(records, records + count, key, less);
+
+    if ((i != records + count) && !less(key, *i))
+      return db.strings + i->description;
+  }
+
+  return NULL;
+}
+
+static void add_record(vector < pcidb_record > &list,
+		       string & strings,
+		       const long *u,
+		       const char *description,
+		       const char *end)
+{
+  pcidb_record r;
+
+  for (int i = 0; i < 4; i++)
+    r.ids[i] = u[i];
+  r.description = strings.length();
+  strings.append(description, end - description);
+  strings += '\0';
+
+  list.push_back(r);
+}
+
+/*
+ * reads exactly `width' hex digits followed by a space
+ */
+static bool parse_id(const char *&p,
+		     const char *end,
+		     int width,
+		     long &id)
+{
+  const char *start = p;
+  unsigned long long value = 0;
+
+  if ((end - p <= width) || (p[width] != ' '))
+    return false;
+  if (!parse_number(p, start + width, value, 16) || (p != start + width))
+  {
+    p = start;
+    return false;
+  }
+
+  id = value;
+  p++;
+  return true;
+}
+
+/*
+ * returns the first line that isn't indented by at least `level' tabs,
+ * without parsing anything on the way
+ */
+static const char *skip_block(const char *line,
+			      const char *end,
+			      int level)
+{
+  while (line < end)
+  {
+    const char *eol = NULL;
+    int i = 0;
+
+    while ((i < level) && (line + i < end) && (line[i] == '\t'))
+      i++;
+    if (i < level)
+      break;
+
+    eol = (const char *) memchr(line, '\n', end - line);
+    line = eol ? eol + 1 : end;
+  }
+
+  return line;
+}
+
+static bool parse_pcidb(const char *data,
+			size_t len,
+			pcidb_table & table)
+{
+  long u[4];
+  catalog current_catalog = pcivendor;
+  const char *end = data + len;
+  const char *next = NULL;
+
+  memset(u, 0, sizeof(u));
+
+  for (const char *line = data; line < end; line = next)
+  {
+    const char *eol = (const char *) memchr(line, '\n', end - line);
+    const char *p = line;
+    int level = 0;
+
+    if (!eol)
+      eol = end;
+    next = (eol < end) ? eol + 1 : end;
+
+    while ((p < eol) && (*p == '\t'))
+    {
+      level++;
+      p++;
+    }
+    while ((p < eol) && (*p <= ' '))
+      p++;
+    while ((eol > p) && (eol[-1] <= ' '))
+      eol--;
+
+    // ignore empty or commented-out lines
+    if ((p == eol) || (*p == '#'))
+      continue;
+
+    switch (level)
+    {
+    case 0:
+      if ((p[0] == 'C') && (eol - p > 1) && (p[1] == ' '))
+      {
+	current_catalog = pciclass;
+	p += 2;			// get rid of 'C '
+
+	if (!parse_id(p, eol, 2, u[0]))
+	  return false;
+      }
+      else
+      {
+	current_catalog = pcivendor;
+
+	if (!parse_id(p, eol, 4, u[0]))
+	  return false;
+
+	if (lazy && (wantedvendors.find(u[0]) == wantedvendors.end()))
+	{
+	  next = skip_block(next, end, 1);
+	  continue;
+	}
+      }
+      u[1] = u[2] = u[3] = -1;
+      break;
+    case 1:
+      if ((current_catalog == pciclass) || (current_catalog == pcisubclass)
+	  || (current_catalog == pciprogif))
+      {
+	current_catalog = pcisubclass;
+
+	if (!parse_id(p, eol, 2, u[1]))
+	  return false;
+      }
+      else
+      {
+	current_catalog = pcidevice;
+
+	if (!parse_id(p, eol, 4, u[1]))
+	  return false;
+
+	if (lazy
+	    && (wanteddevices.find((u[0] << 16) | u[1]) ==
+		wanteddevices.end()))
+	{
+	  next = skip_block(next, end, 2);
+	  continue;
+	}
+      }
+      u[2] = u[3] = -1;
+      break;
+    case 2:
+      if ((current_catalog != pcidevice) && (current_catalog != pcisubvendor)
+	  && (current_catalog != pcisubclass)
+	  && (current_catalog != pciprogif))
+	return false;
+      if ((current_catalog == pcisubclass) || (current_catalog == pciprogif))
+      {
+	current_catalog = pciprogif;
+	if (!parse_id(p, eol, 2, u[2]))
+	  return false;
+	u[3] = -1;
+      }
+      else
+      {
+	current_catalog = pcisubvendor;
+	if (!parse_id(p, eol, 4, u[2]) || !parse_id(p, eol, 4, u[3]))
+	  return false;
+      }
+      break;
+    default:
+      return false;
+    }
+
+    while ((p < eol) && (*p <= ' '))
+      p++;
+
+    if ((current_catalog == pciclass) ||
+	(current_catalog == pcisubclass) || (current_catalog == pciprogif))
+      add_record(table.classes, table.strings, u, p, eol);
+    else
+      add_record(table.devices, table.strings, u, p, eol);
+  }
+
+  return true;
+}
+
+/*
+ * vendor and class lines don't depend on what comes before them, so
+ * the file can be split in front of any of them
+ */
+static const char *next_toplevel(const char *p,
+				 const char *end)
+{
+  while (p < end)
+  {
+    const char *eol = (const char *) memchr(p, '\n', end - p);
+
+    if (!eol)
+      return end;
+    p = eol + 1;
+    if ((p < end) && isxdigit(*p))	// 'C' is a hex digit too
+      return p;
+  }
+
+  return end;
+}
+
+static void parse_chunk(unsigned int i,
+			void *data)
+{
+  pcidb_chunk *chunk = (pcidb_chunk *) data + i;
+
+  chunk->result = parse_pcidb(chunk->data, chunk->len, chunk->table);
+}
+
+/*
+ * parses the pieces in parallel, then appends their records in file
+ * order: a syntax error still drops everything that follows it
+ */
+static bool compile_pcidb(const string & filename)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  struct stat buf;
+  void *data = MAP_FAILED;
+  vector < pcidb_chunk > chunks;
+  unsigned int workers = parallel_workers();
+  size_t count = 1;
+  const char *start = NULL;
+  const char *end = NULL;
+  bool result = true;
+
+  if (fd < 0)
+    return false;
+
+  if ((fstat(fd, &buf) == 0) && (buf.st_size > 0))
+    data = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED)
+    return false;
+
+  start = (const char *) data;
+  end = start + buf.st_size;
+  if (workers > 1)
+    count = buf.st_size / PCIDB_CHUNK + 1;
+  if (count > 4 * workers)
+    count = 4 * workers;	// a few pieces per thread to even out the load
+
+  chunks.resize(count);
+  for (size_t i = 0; i < count; i++)
+  {
+    const char *next = end;
+
+    if (i + 1 < count)
+      next = next_toplevel((const char *) data +
+			   (buf.st_size / count) * (i + 1) - 1, end);
+
+    if (next < start)
+      next = start;
+    chunks[i].data = start;
+    chunks[i].len = next - start;
+    chunks[i].result = true;
+    start = next;
+  }
+
+  parallel_for(chunks.size(), parse_chunk, &chunks[0]);
+
+  for (size_t i = 0; (i < chunks.size()) && result; i++)
+  {
+    pcidb_table & table = chunks[i].table;
+    size_t base = strings.length();
+
+    strings += table.strings;
+    for (size_t j = 0; j < table.devices.size(); j++)
+    {
+      devices.push_back(table.devices[j]);
+      devices.back().description += base;
+    }
+    for (size_t j = 0; j < table.classes.size(); j++)
+    {
+      classes.push_back(table.classes[j]);
+      classes.back().description += base;
+    }
+
+    result = chunks[i].result;
+  }
+  munmap(data, buf.st_size);
+
+  return result;
+}
+
+static string cache_dir()
+{
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+
+  if (xdg && *xdg)
+    return string(xdg) + "/lshw";
+  if (home && *home)
+    return string(home) + "/.cache/lshw";
+
+  return "";
+}
+
+static size_t padded(size_t len)
+{
+  return (len + 3) & ~((size_t) 3);
+}
+
+/*
+ * FNV-1a, only used to name cache files after the source paths: sizes
+ * and modification times are checked against the key stored inside, so
+ * that a stale index simply gets replaced
+ */
+static unsigned long long keyhash(const string & s)
+{
+  unsigned long long h = 14695981039346656037ULL;
+
+  for (size_t i = 0; i < s.length(); i++)
+  {
+    h ^= (unsigned char) s[i];
+    h *= 1099511628211ULL;
+  }
+
+  return h;
+}
+
+static bool write_all(int fd,
+		      const void *data,
+		      size_t len)
+{
+  const char *p = (const char *) data;
+
+  while (len > 0)
+  {
+    ssize_t count = write(fd, p, len);
+
+    if (count <= 0)
+      return false;
+    p += count;
+    len -= count;
+  }
+
+  return true;
+}
+
+/*
+ * writes the index to a temporary file and renames it, so that
+ * concurrent runs never see a partial cache
+ */
+static bool save_index(const string & filename,
+		       const string & key)
+{
+  pcidb_header header;
+  vector < char >tmp(filename.begin(), filename.end());
+  string suffix = ".XXXXXX";
+  int fd = -1;
+  bool ok = true;
+
+  tmp.insert(tmp.end(), suffix.begin(), suffix.end());
+  tmp.push_back('\0');
+
+  fd = mkstemp(&tmp[0]);
+  if (fd < 0)
+    return false;
+
+  memset(&header, 0, sizeof(header));
+  strncpy(header.magic, PCIDB_MAGIC, sizeof(header.magic));
+  header.keylength = key.length();
+  header.devices = devices.size();
+  header.classes = classes.size();
+  header.strings = strings.length();
+
+  string paddedkey = key;
+  paddedkey.resize(padded(key.length()), '\0');
+
+  ok = write_all(fd, &header, sizeof(header)) &&
+    write_all(fd, paddedkey.data(), paddedkey.length()) &&
+    (devices.empty()
+     || write_all(fd, &devices[0], devices.size() * sizeof(pcidb_record)))
+    && (classes.empty()
+	|| write_all(fd, &classes[0], classes.size() * sizeof(pcidb_record)))
+    && write_all(fd, strings.data(), strings.length());
+
+  if ((close(fd) != 0) || !ok || (rename(&tmp[0], filename.c_str()) != 0))
+  {
+    unlink(&tmp[0]);
+    return false;
+  }
+
+  return true;
+}
+
+static bool valid_records(const pcidb_record * records,
+			  size_t count,
+			  size_t nstrings)
+{
+  for (size_t i = 0; i < count; i++)
+    if (records[i].description >= nstrings)
+      return false;
+
+  return true;
+}
+
+static bool map_index(const string & filename,
+		      const string & key)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  struct stat buf;
+  void *data = MAP_FAILED;
+  const pcidb_header *header = NULL;
+  const char *p = NULL;
+  size_t size = 0;
+
+  if (fd < 0)
+    return false;
+
+  if ((fstat(fd, &buf) == 0) && (buf.st_size >= (off_t) sizeof(pcidb_header)))
+    data = mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED)
+    return false;
+
+  header = (const pcidb_header *) data;
+  p = (const char *) data + sizeof(pcidb_header);
+  size = sizeof(pcidb_header) + padded(header->keylength) +
+    ((size_t) header->devices + header->classes) * sizeof(pcidb_record) +
+    header->strings;
+
+  if ((strncmp(header->magic, PCIDB_MAGIC, sizeof(header->magic)) != 0) ||
+      (header->keylength != key.length()) || (size != (size_t) buf.st_size) ||
+      (memcmp(p, key.data(), key.length()) != 0) || (header->strings == 0) ||
+      (((const char *) data)[size - 1] != '\0'))
+  {
+    munmap(data, buf.st_size);
+    return false;
+  }
+
+  p += padded(header->keylength);
+  db.devices = (const pcidb_record *) p;
+  db.ndevices = header->devices;
+  db.classes = db.devices + db.ndevices;
+  db.nclasses = header->classes;
+  db.strings = (const char *) (db.classes + db.nclasses);
+  db.nstrings = header->strings;
+
+  if (!valid_records(db.devices, db.ndevices, db.nstrings) ||
+      !valid_records(db.classes, db.nclasses, db.nstrings))
+  {
+    memset(&db, 0, sizeof(db));
+    munmap(data, buf.st_size);
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * lists the readable files of a colon-separated path, later ones first
+ * as they always were, and describes them in a cache key
+ */
+static void find_sources(const string & paths,
+			 vector < string > &sources,
+			 string & names,
+			 string & key)
+{
+  vector < string > filenames;
+
+  splitlines(paths, filenames, ':');
+  for (int i = filenames.size() - 1; i >= 0; i--)
+  {
+    struct stat buf;
+    char buffer[60];
+
+    if ((stat(filenames[i].c_str(), &buf) != 0) || !S_ISREG(buf.st_mode))
+      continue;
+
+    snprintf(buffer, sizeof(buffer), " %lld %lld\n",
+	     (long long) buf.st_size, (long long) buf.st_mtime);
+    key += filenames[i] + buffer;
+    names += filenames[i] + "\n";
+    sources.push_back(filenames[i]);
+  }
+}
+
+static void compile_sources(const vector < string > &sources)
+{
+  devices.clear();
+  classes.clear();
+  strings = "";
+  for (unsigned int i = 0; i < sources.size(); i++)
+    compile_pcidb(sources[i]);
+
+  stable_sort(devices.begin(), devices.end(), record_less);
+  stable_sort(classes.begin(), classes.end(), record_less);
+
+  db.devices = devices.empty()? NULL : &devices[0];
+  db.ndevices = devices.size();
+  db.classes = classes.empty()? NULL : &classes[0];
+  db.nclasses = classes.size();
+  db.strings = strings.data();
+  db.nstrings = strings.length();
+}
+
+bool pcidb_load(const string & paths)
+{
+  vector < string > sources;
+  string names = "";
+  string key = "";
+  string cachefile = "";
+  string dir = cache_dir();
+
+  find_sources(paths, sources, names, key);
+
+  if (sources.size() == 0)
+  {
+    // no pci.ids on this system: fall back to the built-in tables
+    db = builtin;
+    return (db.ndevices + db.nclasses) > 0;
+  }
+
+  if (dir != "")
+  {
+    char buffer[30];
+
+    snprintf(buffer, sizeof(buffer), "/pci.ids-%016llx", keyhash(names));
+    cachefile = dir + buffer;
+
+    if (map_index(cachefile, key))
+      return true;
+  }
+
+  if (cachefile != "")
+  {
+    mkdir(dir.substr(0, dir.rfind('/')).c_str(), 0755);	// ~/.cache
+    mkdir(dir.c_str(), 0755);
+    if (access(dir.c_str(), W_OK) != 0)
+      cachefile = "";
+  }
+
+  // the whole database is only worth compiling if it can be kept: for a
+  // single run, one pass that drops what won't be looked up is cheaper
+  lazy = (cachefile == "") && !wantedvendors.empty();
+  compile_sources(sources);
+  lazy = false;
+
+  if (cachefile != "")
+    save_index(cachefile, key);
+
+  return (db.ndevices + db.nclasses) > 0;
+}
+
+void pcidb_want(long vendor,
+		long device)
+{
+  wantedvendors.insert(vendor);
+  if (device >= 0)
+    wanteddevices.insert((vendor << 16) | device);
+}
+
+bool pcidb_builtin(const pcidb_record * d,
+		   size_t nd,
+		   const pcidb_record * c,
+		   size_t nc,
+		   const char *s,
+		   size_t ns)
+{
+  builtin.devices = d;
+  builtin.ndevices = nd;
+  builtin.classes = c;
+  builtin.nclasses = nc;
+  builtin.strings = s;
+  builtin.nstrings = ns;
+
+  return true;
+}
+
+static void embed_records(const char *name,
+			  const pcidb_record * records,
+			  size_t count,
+			  ostream & out)
+{
+  char buffer[80];
+
+  out << "static const pcidb_record " << name << "[] = {\n";
+  for (size_t i = 0; i < count; i++)
+  {
+    snprintf(buffer, sizeof(buffer), "  {{%d, %d, %d, %d}, %u},\n",
+	     records[i].ids[0], records[i].ids[1], records[i].ids[2],
+	     records[i].ids[3], records[i].description);
+    out << buffer;
+  }
+  if (count == 0)
+    out << "  {{0, 0, 0, 0}, 0}\n";	// no empty arrays in C++
+  out << "};\n\n";
+}
+
+/*
+ * writes the database as C++ tables, to be compiled into pciids.cc
+ */
+bool pcidb_embed(const string & paths,
+		 ostream & out)
+{
+  vector < string > sources;
+  string names = "";
+  string key = "";
+
+  find_sources(paths, sources, names, key);
+  if ((paths != "") && (sources.size() == 0))
+    return false;
+
+  compile_sources(sources);
+
+  out << "// generated by gen-pciids, do not edit\n";
+  out << "\n#include \"pcidb.h\"\n\n";
+  embed_records("devices", db.devices, db.ndevices, out);
+  embed_records("classes", db.classes, db.nclasses, out);
+
+  out << "static const char strings[] =\n  \"";
+  for (size_t i = 0; i < db.nstrings; i++)
+  {
+    unsigned char c = db.strings[i];
+    char buffer[10];
+
+    if (c == '\0')
+      out << ((i + 1 < db.nstrings) ? "\\0\"\n  \"" : "");
+    else if ((c == '"') || (c == '\\') || (c == '?'))
+      out << '\\' << c;
+    else if ((c < ' ') || (c >= 0x7f))
+    {
+      snprintf(buffer, sizeof(buffer), "\\%03o", c);
+      out << buffer;
+    }
+    else
+      out << c;
+  }
+  out << "\";\n\n";
+
+  out << "static bool registered = pcidb_builtin(devices, " << db.ndevices
+    << ", classes, " << db.nclasses << ",\n";
+  out << "\t\t\t\t\t   strings, sizeof(strings));\n";
+
+  return true;
+}
+
+size_t pcidb_parse(const string & filename)
+{
+  vector < string > sources;
+
+  sources.push_back(filename);
+  compile_sources(sources);
+
+  return db.ndevices + db.nclasses;
+}
+
+string pcidb_device(long vendor,
+		    long device,
+		    long subvendor,
+		    long subdevice)
+{
+  const char *result =
+    lookup(db.devices, db.ndevices, vendor, device, subvendor, subdevice);
+
+  return result ? string(result) : string("");
+}
+
+string pcidb_class(long c,
+		   long subclass,
+		   long progif)
+{
+  const char *result = lookup(db.classes, db.nclasses, c, subclass, progif,
+			      -1);
+
+  return result ? string(result) : string("");
+}
+
+static char *id = "@(#) $Id$";
@@ -0,0 +1,57 @@
+#ifndef _PCIDB_H_
+#define _PCIDB_H_
+
+#include <string>
+#include <iostream>
+#include <sys/types.h>
+
+/*
+ * PCI ID database (pci.ids): the text files are compiled into a sorted
+ * binary index which is cached on disk and mapped in memory, so that
+ * lookups are a few binary searches and runs pay no parsing cost.
+ */
+
+bool pcidb_load(const std::string & paths);	// colon-separated list
+
+/*
+ * declares ids that are going to be looked up, before pcidb_load(): if
+ * the index can't be cached, only their entries get loaded
+ */
+void pcidb_want(long vendor,
+		long device = -1);
+
+std::string pcidb_device(long vendor,
+			 long device = -1,
+			 long subvendor = -1,
+			 long subdevice = -1);
+std::string pcidb_class(long c,
+			long subclass = -1,
+			long progif = -1);
+
+/*
+ * built-in database, used when no pci.ids can be found: pciids.cc is
+ * generated at build time by gen-pciids (make PCI_IDS=/path/to/pci.ids)
+ * and registers its tables with pcidb_builtin()
+ */
+struct pcidb_record
+{
+  int32_t ids[4];		// -1 when not significant
+  u_int32_t description;	// offset in the string pool
+};
+
+bool pcidb_builtin(const pcidb_record * devices,
+		   size_t ndevices,
+		   const pcidb_record * classes,
+		   size_t nclasses,
+		   const char *strings,
+		   size_t nstrings);
+bool pcidb_embed(const std::string & paths,
+		 std::ostream & out);
+
+/*
+ * compiles a pci.ids file in memory, without looking at or writing the
+ * cache, and returns the number of records (for bench-pcidb)
+ */
+size_t pcidb_parse(const std::string & filename);
+
+#endif
@@ -1,5 +1,7 @@
 #include "pcmcia.h"
 #include "osutils.h"
+#include "vfs.h"
+#include "probe.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -756,48 +758,21 @@ ds_ioctl_arg_t;
 
 static int lookup_dev(char *name)
 {
-  FILE *f;
+  vector < string > devices;
   int n;
-  char s[32], t[32];
+  char t[32];
 
-  f = fopen("/proc/devices", "r");
-  if (f == NULL)
-    return -errno;
-  while (fgets(s, 32, f) != NULL)
+  if (!loadfile("/proc/devices", devices))
+    return -ENOENT;
+  for (int i = 0; i < devices.size(); i++)
   {
-    if (sscanf(s, "%d %s", &n, t) == 2)
+    if (sscanf(devices[i].c_str(), "%d %31s", &n, t) == 2)
       if (strcmp(name, t) == 0)
-	break;
+	return n;
   }
-  fclose(f);
-  if (strcmp(name, t) == 0)
-    return n;
-  else
-    return -ENODEV;
+  return -ENODEV;
 }				/* lookup_dev */
 
-static int open_dev(dev_t dev)
-{
-  static char *paths[] = {
-    "/var/lib/pcmcia", "/var/run", "/dev", "/tmp", NULL
-  };
-  char **p, fn[64];
-  int fd;
-
-  for (p = paths; *p; p++)
-  {
-    sprintf(fn, "%s/ci-%d", *p, getpid());
-    if (mknod(fn, (S_IFCHR | S_IREAD), dev) == 0)
-    {
-      fd = open(fn, O_RDONLY);
-      unlink(fn);
-      if (fd >= 0)
-	return fd;
-    }
-  }
-  return -1;
-}				/* open_dev */
-
 static string pcmcia_handle(int socket)
 {
   char buffer[20];
@@ -814,9 +789,9 @@ static int get_tuple(int fd,
   arg.tuple.DesiredTuple = code;
   arg.tuple.Attributes = TUPLE_RETURN_COMMON;
   arg.tuple.TupleOffset = 0;
-  if ((ioctl(fd, DS_GET_FIRST_TUPLE, &arg) == 0) &&
-      (ioctl(fd, DS_GET_TUPLE_DATA, &arg) == 0) &&
-      (ioctl(fd, DS_PARSE_TUPLE, &arg) == 0))
+  if ((vfs_ioctl(fd, DS_GET_FIRST_TUPLE, &arg, sizeof(arg)) == 0) &&
+      (vfs_ioctl(fd, DS_GET_TUPLE_DATA, &arg, sizeof(arg)) == 0) &&
+      (vfs_ioctl(fd, DS_PARSE_TUPLE, &arg, sizeof(arg)) == 0))
     return 0;
   else
     return -1;
@@ -824,7 +799,7 @@ static int get_tuple(int fd,
 
 static bool pcmcia_ident(int socket,
 			 int fd,
-			 hwNode * parent)
+			 hwNode & device)
 {
   ds_ioctl_arg_t arg;
   cistpl_vers_1_t *vers = &arg.tuple_parse.parse.version_1;
@@ -833,8 +808,6 @@ static bool pcmcia_ident(int socket,
   config_info_t config;
   bind_info_t bind;
   vector < string > product_info;
-  hwNode device("pccard",
-		hw::generic);
   char buffer[20];
   int i;
 
@@ -915,7 +888,7 @@ static bool pcmcia_ident(int socket,
   {
     memset(&config, 0, sizeof(config));
     config.Function = fct;
-    if (ioctl(fd, DS_GET_CONFIGURATION_INFO, &config) == 0)
+    if (vfs_ioctl(fd, DS_GET_CONFIGURATION_INFO, &config, sizeof(config)) == 0)
     {
       if (config.AssignedIRQ != 0)
       {
@@ -939,11 +912,39 @@ static bool pcmcia_ident(int socket,
   //printf("%s : %s -> %d\n", bind.dev_info, bind.name, errno);
 
   device.setHandle(pcmcia_handle(socket));
-  parent->addChild(device);
 
   return true;
 }
 
+struct pcmcia_probe
+{
+  int socket;
+  int fd;
+};
+
+/*
+ * runs on a probe worker (see probe.h) and closes the socket when done
+ */
+static bool probe_pcmcia(hwNode & device,
+			 void *data)
+{
+  pcmcia_probe *socket = (pcmcia_probe *) data;
+  cs_status_t status;
+  bool result = false;
+
+  // check that slot is populated
+  memset(&status, 0, sizeof(status));
+  status.Function = 0;
+
+  vfs_ioctl(socket->fd, DS_GET_STATUS, &status, sizeof(status));
+  if (status.CardState & CS_EVENT_CARD_DETECT)
+    result = pcmcia_ident(socket->socket, socket->fd, device);
+
+  vfs_close(socket->fd);
+
+  return result;
+}
+
 static bool is_cardbus(const hwNode * n)
 {
   return (n->getClass() == hw::bridge) && n->isCapable("pcmcia");
@@ -987,7 +988,7 @@ static hwNode *find_pcmciaparent(int slot,
 
 bool scan_pcmcia(hwNode & n)
 {
-  int fd[MAX_SOCK];
+  int probes[MAX_SOCK];
   int major = lookup_dev("pcmcia");
   int sockets = 0;
   int i;
@@ -996,39 +997,38 @@ bool scan_pcmcia(hwNode & n)
   if (major < 0)		// pcmcia support not loaded, there isn't much
     return false;		// we can do
 
-  memset(fd, 0, sizeof(fd));
-  for (i = 0; i < MAX_SOCK; i++)
+  for (sockets = 0; sockets < MAX_SOCK; sockets++)
   {
-    config_info_t cfg;
-    fd[i] = open_dev((dev_t) ((major << 8) + i));
-
-    if (fd[i] >= 0)
-    {
-      hwNode *parent = find_pcmciaparent(i, n);
-      cs_status_t status;
-      if (i >= sockets)
-	sockets = i + 1;
-
-      // check that slot is populated
-      memset(&status, 0, sizeof(status));
-      status.Function = 0;
-
-      ioctl(fd[i], DS_GET_STATUS, &status);
-      if (status.CardState & CS_EVENT_CARD_DETECT)
-      {
-	if (parent)
-	  pcmcia_ident(i, fd[i], parent);
-	else
-	  pcmcia_ident(i, fd[i], &n);
-      }
-    }
-    else
+    pcmcia_probe socket;
+    hwNode device("pccard",
+		  hw::generic);
+    char buffer[20];
+
+    socket.socket = sockets;
+    socket.fd = vfs_opendev((dev_t) ((major << 8) + sockets));
+    if (socket.fd < 0)
       break;
+
+    snprintf(buffer, sizeof(buffer), "Socket %d", sockets);
+    device.setSlot(buffer);
+    device.setHandle(pcmcia_handle(sockets));
+    probes[sockets] = probe_submit(device, probe_pcmcia, &socket,
+				   sizeof(socket));
   }
 
-  for (int j = 0; j < sockets; j++)
+  for (i = 0; i < sockets; i++)
   {
-    close(fd[j]);
+    hwNode *parent = find_pcmciaparent(i, n);
+    hwNode device("pccard",
+		  hw::generic);
+
+    if (probe_wait(probes[i], device) == probe_failed)
+      continue;
+
+    if (parent)
+      parent->addChild(device);
+    else
+      n.addChild(device);
   }
 
   if (loadfile(VARLIBPCMCIASTAB, stab))
@@ -2,6 +2,8 @@
 #include "version.h"
 #include <iostream>
 #include <iomanip>
+#include <map>
+#include <stdlib.h>
 
 static void tab(int level,
 		bool connect = true)
@@ -375,4 +377,84 @@ void print(hwNode & node,
   }
 }
 
+static string numacategory(hwNode & node)
+{
+  switch (node.getClass())
+  {
+  case hw::network:
+    return "network";
+  case hw::storage:
+    return "storage";
+  case hw::display:
+  case hw::processor:
+    return "accelerator";
+  default:
+    break;
+  }
+
+  return "";
+}
+
+static void numadevices(hwNode & node,
+			map < int, vector < hwNode * > >&devices)
+{
+  if ((node.getHandle().substr(0, 4) == "PCI:")
+      && (numacategory(node) != ""))
+  {
+    string numa = node.getConfig("numa");
+
+    devices[(numa != "") ? atoi(numa.c_str()) : -1].push_back(&node);
+  }
+
+  for (unsigned int i = 0; i < node.countChildren(); i++)
+    numadevices(*node.getChild(i), devices);
+}
+
+static void printnumanode(int numa,
+			  const vector < hwNode * >&devices)
+{
+  string cpus = devices[0]->getConfig("cpus");
+  string socket = devices[0]->getConfig("socket");
+
+  cout << "numa node ";
+  if (numa >= 0)
+    cout << numa;
+  else
+    cout << "unknown";
+  if (cpus != "")
+    cout << ", cpus " << cpus;
+  if (socket != "")
+    cout << ", socket " << socket;
+  cout << endl;
+
+  for (unsigned int i = 0; i < devices.size(); i++)
+  {
+    string product = devices[i]->getProduct();
+
+    if (product == "")
+      product = devices[i]->getDescription();
+    cout << "  " << setw(12) << left << numacategory(*devices[i]) <<
+      setw(0) << devices[i]->getHandle();
+    if (product != "")
+      cout << "  " << product;
+    cout << endl;
+  }
+}
+
+void printnuma(hwNode & node)
+{
+  map < int, vector < hwNode * > >devices;
+
+  numadevices(node, devices);
+
+  for (map < int, vector < hwNode * > >::iterator i = devices.begin();
+       i != devices.end(); i++)
+    if (i->first >= 0)
+      printnumanode(i->first, i->second);
+
+  // devices of unknown locality come last
+  if (devices.find(-1) != devices.end())
+    printnumanode(-1, devices[-1]);
+}
+
 static char *id = "@(#) $Id: print.cc,v 1.35 2003/02/28 22:06:04 ezix Exp $";
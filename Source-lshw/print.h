@@ -5,4 +5,7 @@
 
 void print(hwNode & node, bool html=true, int level = 0);
 
+// PCI network, storage and accelerator devices grouped by NUMA node
+void printnuma(hwNode & node);
+
 #endif
@@ -0,0 +1,352 @@
+#include "probe.h"
+#include <map>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+
+using namespace std;
+
+#define PROBE_SIGNAL SIGURG	/* ignored by default, just in case */
+
+struct probe_job
+{
+  hwNode node;
+  probe_function function;
+  vector < char > data;
+  bool started;
+  bool finished;		// the worker doesn't use the job any more
+  bool expired;			// the deadline has passed or the job was cancelled
+  bool abandoned;		// nobody will ever wait for the job
+  bool result;
+  struct timespec deadline;
+  pthread_t worker;
+
+    probe_job(const hwNode & n):node(n)
+  {
+  }
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static map < int, probe_job * >jobs;
+static deque < probe_job * >queue;
+static unsigned int maxworkers = PROBE_WORKERS;
+static unsigned int timeout = PROBE_TIMEOUT * 1000;
+static unsigned int workers = 0;	// running workers, not counting stuck ones
+static unsigned int idle = 0;
+static int nextid = 0;
+
+static void interrupted(int sig)
+{
+}
+
+static void *worker(void *)
+{
+  pthread_mutex_lock(&lock);
+
+  while (true)
+  {
+    while (queue.empty())
+    {
+      idle++;
+      pthread_cond_wait(&changed, &lock);
+      idle--;
+    }
+
+    probe_job *job = queue.front();
+    queue.pop_front();
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    job->deadline.tv_sec = now.tv_sec + timeout / 1000;
+    job->deadline.tv_nsec = now.tv_nsec + (timeout % 1000) * 1000000;
+    if (job->deadline.tv_nsec >= 1000000000)
+    {
+      job->deadline.tv_sec++;
+      job->deadline.tv_nsec -= 1000000000;
+    }
+    job->worker = pthread_self();
+    job->started = true;
+    pthread_cond_broadcast(&changed);	// waiters now have a deadline
+
+    hwNode node = job->node;
+    vector < char >data = job->data;
+    pthread_mutex_unlock(&lock);
+
+    bool result = job->function(node, data.empty()? NULL : &data[0]);
+
+    pthread_mutex_lock(&lock);
+    job->finished = true;
+    if (job->expired)
+    {
+      // too late: somebody else has already taken our place
+      if (job->abandoned)
+	delete job;
+      pthread_mutex_unlock(&lock);
+      return NULL;
+    }
+
+    job->node = node;
+    job->data = data;
+    job->result = result;
+    pthread_cond_broadcast(&changed);
+  }
+
+  return NULL;
+}
+
+static bool spawn()
+{
+  static bool initialized = false;
+  pthread_attr_t attr;
+  pthread_t thread;
+  bool result = false;
+
+  if (workers >= maxworkers)
+    return false;
+
+  if (!initialized)
+  {
+    struct sigaction sa;
+
+    // no SA_RESTART: signals interrupt blocking system calls
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = interrupted;
+    sigemptyset(&sa.sa_mask);
+    sigaction(PROBE_SIGNAL, &sa, NULL);
+    initialized = true;
+  }
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create(&thread, &attr, worker, NULL) == 0)
+  {
+    workers++;
+    result = true;
+  }
+  pthread_attr_destroy(&attr);
+
+  return result;
+}
+
+/*
+ * last resort when no thread can be created: run the job in the calling
+ * thread, without any deadline (the lock must be held)
+ */
+static void run(probe_job * job)
+{
+  for (deque < probe_job * >::iterator i = queue.begin(); i != queue.end();
+       i++)
+    if (*i == job)
+    {
+      queue.erase(i);
+      break;
+    }
+  job->started = true;
+  pthread_mutex_unlock(&lock);
+  job->result =
+    job->function(job->node, job->data.empty()? NULL : &job->data[0]);
+  pthread_mutex_lock(&lock);
+  job->finished = true;
+}
+
+/*
+ * give up on a running job: its worker is considered lost (we try to
+ * interrupt it) and is replaced so that the pool keeps its size
+ */
+static void expire(probe_job * job)
+{
+  job->expired = true;
+  workers--;
+  pthread_kill(job->worker, PROBE_SIGNAL);
+  if (queue.size() > idle)
+    spawn();
+  pthread_cond_broadcast(&changed);
+}
+
+/*
+ * expire running jobs whose deadline has passed and return the next
+ * deadline to wait for (NULL if there's none)
+ */
+static struct timespec *check_deadlines()
+{
+  struct timespec *next = NULL;
+  struct timespec now;
+
+  if (timeout == 0)
+    return NULL;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for (map < int, probe_job * >::iterator i = jobs.begin(); i != jobs.end();
+       i++)
+  {
+    probe_job *job = i->second;
+
+    if (!job->started || job->finished || job->expired)
+      continue;
+
+    if ((job->deadline.tv_sec < now.tv_sec) ||
+	((job->deadline.tv_sec == now.tv_sec) &&
+	 (job->deadline.tv_nsec <= now.tv_nsec)))
+      expire(job);
+    else if (!next || (job->deadline.tv_sec < next->tv_sec) ||
+	     ((job->deadline.tv_sec == next->tv_sec) &&
+	      (job->deadline.tv_nsec < next->tv_nsec)))
+      next = &job->deadline;
+  }
+
+  return next;
+}
+
+void probe_setup(unsigned int w,
+		 unsigned int t)
+{
+  static bool initialized = false;
+
+  pthread_mutex_lock(&lock);
+  if (!initialized)
+  {
+    pthread_condattr_t attr;
+
+    // deadlines are on the monotonic clock, so that setting the time
+    // doesn't expire all the probes at once (or none ever)
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_destroy(&changed);
+    pthread_cond_init(&changed, &attr);
+    pthread_condattr_destroy(&attr);
+    initialized = true;
+  }
+  maxworkers = (w > 0) ? w : 1;
+  timeout = t;
+  pthread_mutex_unlock(&lock);
+}
+
+int probe_submit(const hwNode & node,
+		 probe_function probe,
+		 const void *data,
+		 size_t len)
+{
+  probe_job *job = new probe_job(node);
+  int id = 0;
+
+  job->function = probe;
+  if (data && len)
+    job->data.assign((const char *) data, (const char *) data + len);
+  job->started = job->finished = job->expired = job->abandoned = false;
+  job->result = false;
+
+  pthread_mutex_lock(&lock);
+  id = nextid++;
+  jobs[id] = job;
+  queue.push_back(job);
+  if (queue.size() > idle)
+    spawn();
+
+  if (workers == 0)
+    run(job);
+  else
+    pthread_cond_broadcast(&changed);
+  pthread_mutex_unlock(&lock);
+
+  return id;
+}
+
+probe_status probe_wait(int id,
+			hwNode & node,
+			void *data,
+			size_t len)
+{
+  probe_status result = probe_failed;
+  probe_job *job = NULL;
+
+  pthread_mutex_lock(&lock);
+  if (jobs.find(id) == jobs.end())
+  {
+    pthread_mutex_unlock(&lock);
+    return probe_failed;
+  }
+  job = jobs[id];
+
+  while (!job->expired && !job->finished)
+  {
+    struct timespec *next = check_deadlines();
+
+    if (job->expired)
+      break;
+
+    if (!job->started && (workers == 0))
+      run(job);
+    else if (next)
+    {
+      struct timespec deadline = *next;
+      pthread_cond_timedwait(&changed, &lock, &deadline);
+    }
+    else
+      pthread_cond_wait(&changed, &lock);
+  }
+
+  jobs.erase(id);
+  node = job->node;
+  if (job->expired)
+  {
+    node.setConfig("probe", "timeout");
+    result = probe_timeout;
+    if (job->finished)
+      delete job;
+    else
+      job->abandoned = true;
+  }
+  else
+  {
+    if (data && len && !job->data.empty())
+      memcpy(data, &job->data[0],
+	     (len < job->data.size())? len : job->data.size());
+    result = job->result ? probe_ok : probe_failed;
+    delete job;
+  }
+  pthread_mutex_unlock(&lock);
+
+  return result;
+}
+
+void probe_cancel(int id)
+{
+  probe_job *job = NULL;
+
+  pthread_mutex_lock(&lock);
+  if (jobs.find(id) == jobs.end())
+  {
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+  job = jobs[id];
+  jobs.erase(id);
+
+  if (!job->started)
+  {
+    for (deque < probe_job * >::iterator i = queue.begin(); i != queue.end();
+	 i++)
+      if (*i == job)
+      {
+	queue.erase(i);
+	break;
+      }
+    delete job;
+  }
+  else if (!job->finished)
+  {
+    if (!job->expired)
+      expire(job);
+    job->abandoned = true;
+  }
+  else
+    delete job;
+  pthread_mutex_unlock(&lock);
+}
+
+static char *id = "@(#) $Id$";
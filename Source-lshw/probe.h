@@ -0,0 +1,45 @@
+#ifndef _PROBE_H_
+#define _PROBE_H_
+
+#include "hw.h"
+#include <stddef.h>
+
+/*
+ * slow device queries (ioctls on disks, cdroms, sg devices, PCMCIA
+ * sockets...) run on a bounded pool of worker threads so that one dead
+ * device doesn't stall the whole inventory.
+ *
+ * a probe works on its own copy of a node (plus an optional block of
+ * plain data) and must not touch the device tree. each probe has a
+ * deadline: when it expires, the probe is abandoned and the caller gets
+ * back the node it submitted, marked as incomplete.
+ */
+
+#define PROBE_WORKERS 8
+#define PROBE_TIMEOUT 5		/* seconds */
+
+typedef bool (*probe_function) (hwNode & node,
+				void *data);
+
+typedef enum
+{
+  probe_ok,
+  probe_failed,
+  probe_timeout
+}
+probe_status;
+
+void probe_setup(unsigned int workers,
+		 unsigned int timeout);	// milliseconds, 0 means no deadline
+
+int probe_submit(const hwNode & node,
+		 probe_function probe,
+		 const void *data = NULL,
+		 size_t len = 0);
+probe_status probe_wait(int id,
+			hwNode & node,
+			void *data = NULL,
+			size_t len = 0);
+void probe_cancel(int id);
+
+#endif
@@ -2,12 +2,13 @@
 #include "cdrom.h"
 #include "disk.h"
 #include "osutils.h"
+#include "vfs.h"
+#include "probe.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <dirent.h>
 #include <stdio.h>
 #include <scsi/sg.h>
 #include <scsi/scsi.h>
@@ -339,7 +340,7 @@ static bool do_modesense(int sg_fd,
   io_hdr.sbp = sense_b;
   io_hdr.timeout = 20000;	/* 20 seconds */
 
-  if (ioctl(sg_fd, SG_IO, &io_hdr) < 0)
+  if (vfs_ioctl(sg_fd, SG_IO, &io_hdr, sizeof(io_hdr)) < 0)
     return false;
 
   res =
@@ -388,7 +389,7 @@ static bool do_inq(int sg_fd,
   io_hdr.sbp = sense_b;
   io_hdr.timeout = 20000;	/* 20 seconds */
 
-  if (ioctl(sg_fd, SG_IO, &io_hdr) < 0)
+  if (vfs_ioctl(sg_fd, SG_IO, &io_hdr, sizeof(io_hdr)) < 0)
     return false;
 
   res =
@@ -429,7 +430,7 @@ static bool do_inquiry(int sg_fd,
   int k;
   unsigned char len;
 
-  if ((ioctl(sg_fd, SG_GET_VERSION_NUM, &k) < 0) || (k < 30000))
+  if ((vfs_ioctl(sg_fd, SG_GET_VERSION_NUM, &k, sizeof(k)) < 0) || (k < 30000))
     return false;
 
   memset(rsp_buff, 0, sizeof(rsp_buff));
@@ -533,14 +534,14 @@ static void scan_devices()
 
   for (i = 0; devices[i] != NULL; i++)
   {
-    fd = open(devices[i], O_RDONLY | O_NONBLOCK);
+    fd = vfs_open(devices[i], O_RDONLY | O_NONBLOCK);
     if (fd >= 0)
     {
       int bus = -1;
-      if (ioctl(fd, SCSI_IOCTL_GET_BUS_NUMBER, &bus) >= 0)
+      if (vfs_ioctl(fd, SCSI_IOCTL_GET_BUS_NUMBER, &bus, sizeof(bus)) >= 0)
       {
 	memset(&m_idlun, 0, sizeof(m_idlun));
-	if (ioctl(fd, SCSI_IOCTL_GET_IDLUN, &m_idlun) >= 0)
+	if (vfs_ioctl(fd, SCSI_IOCTL_GET_IDLUN, &m_idlun, sizeof(m_idlun)) >= 0)
 	{
 	  sg_map[scsi_handle(bus, (m_idlun.mux4 >> 16) & 0xff,
 			     m_idlun.mux4 & 0xff,
@@ -548,7 +549,7 @@ static void scan_devices()
 	    string(devices[i]);
 	}
       }
-      close(fd);
+      vfs_close(fd);
     }
   }
 }
@@ -577,83 +578,44 @@ static string host_logicalname(int i)
   return string(host);
 }
 
-static bool scan_sg(int sg,
-		    hwNode & n)
+struct sg_probe
 {
-  char buffer[20];
-  int fd = -1;
   My_sg_scsi_id m_id;
   char slot_name[16];
-  string host = "";
-  hwNode *parent = NULL;
-  hwNode *channel = NULL;
-  int emulated = 0;
+  int emulated;
+  bool pci;
+};
 
-  snprintf(buffer, sizeof(buffer), SG_X, sg);
+/*
+ * talks to /dev/sgN from a probe worker: the results are kept in the node
+ * and the sg_probe structure and attached to the tree by scan_sg()
+ */
+static bool probe_sg(hwNode & device,
+		     void *data)
+{
+  sg_probe *sg = (sg_probe *) data;
+  int fd = vfs_open(device.getLogicalName(), OPEN_FLAG | O_NONBLOCK);
 
-  fd = open(buffer, OPEN_FLAG | O_NONBLOCK);
   if (fd < 0)
     return false;
 
-  memset(&m_id, 0, sizeof(m_id));
-  if (ioctl(fd, SG_GET_SCSI_ID, &m_id) < 0)
-  {
-    close(fd);
-    return true;		// we failed to get info but still hope we can continue
-  }
-
-  host = host_logicalname(m_id.host_no);
-
-  memset(slot_name, 0, sizeof(slot_name));
-  if (ioctl(fd, SCSI_IOCTL_GET_PCI, slot_name) >= 0)
-  {
-    string parent_handle = string("PCI:") + string(slot_name);
-
-    parent = n.findChildByHandle(parent_handle);
-  }
-
-  if (!parent)
-    parent = n.findChildByLogicalName(host);
-
-  if (!parent)
-    parent = n.addChild(hwNode("scsi", hw::bus));
-
-  if (!parent)
+  memset(&sg->m_id, 0, sizeof(sg->m_id));
+  if (vfs_ioctl(fd, SG_GET_SCSI_ID, &sg->m_id, sizeof(sg->m_id)) < 0)
   {
-    close(fd);
-    return true;
-  }
-
-  parent->setLogicalName(host);
-  parent->claim();
-
-  emulated = 0;
-  ioctl(fd, SG_EMULATED_HOST, &emulated);
-
-  if (emulated)
-  {
-    parent->addCapability("emulated");
-  }
-
-  channel =
-    parent->findChildByHandle(scsi_handle(m_id.host_no, m_id.channel));
-  if (!channel)
-    channel = parent->addChild(hwNode("channel", hw::storage));
-
-  if (!channel)
-  {
-    close(fd);
-    return true;
+    vfs_close(fd);
+    return false;
   }
 
-  snprintf(buffer, sizeof(buffer), "Channel %d", m_id.channel);
-  channel->setDescription(buffer);
-  channel->setHandle(scsi_handle(m_id.host_no, m_id.channel));
-  channel->claim();
+  memset(sg->slot_name, 0, sizeof(sg->slot_name));
+  sg->pci =
+    (vfs_ioctl(fd, SCSI_IOCTL_GET_PCI, sg->slot_name, sizeof(sg->slot_name))
+     >= 0);
+  sg->slot_name[sizeof(sg->slot_name) - 1] = '\0';
 
-  hwNode device = hwNode("generic");
+  sg->emulated = 0;
+  vfs_ioctl(fd, SG_EMULATED_HOST, &sg->emulated, sizeof(sg->emulated));
 
-  switch (m_id.scsi_type)
+  switch (sg->m_id.scsi_type)
   {
   case 0:
     device = hwNode("disk", hw::storage);
@@ -680,87 +642,123 @@ static bool scan_sg(int sg,
   case 0xd:
     device = hwNode("enclosure", hw::generic);
     break;
+  default:
+    device = hwNode("generic");
   }
 
-  device.setDescription(scsi_type(m_id.scsi_type));
-  device.setHandle(scsi_handle(m_id.host_no,
-			       m_id.channel, m_id.scsi_id, m_id.lun));
+  device.setDescription(scsi_type(sg->m_id.scsi_type));
+  device.setHandle(scsi_handle(sg->m_id.host_no,
+			       sg->m_id.channel, sg->m_id.scsi_id,
+			       sg->m_id.lun));
   find_logicalname(device);
   do_inquiry(fd, device);
-  if ((m_id.scsi_type == 4) || (m_id.scsi_type == 5))
+  if ((sg->m_id.scsi_type == 4) || (sg->m_id.scsi_type == 5))
     scan_cdrom(device);
-  if ((m_id.scsi_type == 0) || (m_id.scsi_type == 7))
+  if ((sg->m_id.scsi_type == 0) || (sg->m_id.scsi_type == 7))
     scan_disk(device);
 
-  channel->addChild(device);
-
-  close(fd);
+  vfs_close(fd);
 
   return true;
 }
 
-static int selectdir(const struct dirent *d)
+static bool scan_sg(hwNode & n,
+		    hwNode & device,
+		    probe_status status,
+		    const sg_probe & sg)
 {
-  struct stat buf;
+  char buffer[20];
+  string host = "";
+  hwNode *parent = NULL;
+  hwNode *channel = NULL;
 
-  if (d->d_name[0] == '.')
-    return 0;
+  if (status == probe_timeout)
+  {
+    // we don't even know where it is connected
+    device.setDescription("SCSI device (not responding)");
+    n.addChild(device);
+    return true;
+  }
+
+  if (status != probe_ok)
+    return false;
+
+  host = host_logicalname(sg.m_id.host_no);
+
+  if (sg.pci)
+  {
+    string parent_handle = string("PCI:") + string(sg.slot_name);
+
+    parent = n.findChildByHandle(parent_handle);
+  }
+
+  if (!parent)
+    parent = n.findChildByLogicalName(host);
+
+  if (!parent)
+    parent = n.addChild(hwNode("scsi", hw::bus));
+
+  if (!parent)
+    return false;
 
-  if (lstat(d->d_name, &buf) != 0)
-    return 0;
+  parent->setLogicalName(host);
+  parent->claim();
+
+  if (sg.emulated)
+  {
+    parent->addCapability("emulated");
+  }
 
-  return S_ISDIR(buf.st_mode);
+  channel =
+    parent->findChildByHandle(scsi_handle(sg.m_id.host_no, sg.m_id.channel));
+  if (!channel)
+    channel = parent->addChild(hwNode("channel", hw::storage));
+
+  if (!channel)
+    return false;
+
+  snprintf(buffer, sizeof(buffer), "Channel %d", sg.m_id.channel);
+  channel->setDescription(buffer);
+  channel->setHandle(scsi_handle(sg.m_id.host_no, sg.m_id.channel));
+  channel->claim();
+
+  channel->addChild(device);
+
+  return true;
 }
 
 static bool scan_hosts(hwNode & node)
 {
-  struct dirent **namelist = NULL;
-  int n;
+  vector < string > namelist;
   vector < string > host_strs;
 
-  if (!pushd("/proc/scsi"))
-    return false;
-  n = scandir(".", &namelist, selectdir, alphasort);
-  popd();
-  if ((n < 0) || !namelist)
+  if (!listdir("/proc/scsi", namelist, S_IFDIR))
     return false;
 
-  pushd("/proc/scsi");
-  for (int i = 0; i < n; i++)
+  for (int i = 0; i < namelist.size(); i++)
   {
-    struct dirent **filelist = NULL;
-    int m = 0;
-
-    pushd(namelist[i]->d_name);
-    m = scandir(".", &filelist, NULL, alphasort);
-    popd();
+    vector < string > filelist;
 
-    if (m >= 0)
+    if (listdir(string("/proc/scsi/") + namelist[i], filelist))
     {
-      for (int j = 0; j < m; j++)
+      for (int j = 0; j < filelist.size(); j++)
       {
 	char *end = NULL;
 	int number = -1;
 
-	number = strtol(filelist[j]->d_name, &end, 0);
+	number = strtol(filelist[j].c_str(), &end, 0);
 
-	if ((number >= 0) && (end != filelist[j]->d_name))
+	if ((number >= 0) && (end != filelist[j].c_str()))
 	{
 	  hwNode *controller =
 	    node.findChildByLogicalName(host_logicalname(number));
 
 	  if (controller)
-	    controller->setConfig(string("driver"),
-				  string(namelist[i]->d_name));
+	    controller->setConfig(string("driver"), namelist[i]);
 	}
-	free(filelist[j]);
       }
-      free(filelist);
     }
-    free(namelist[i]);
   }
-  free(namelist);
-  popd();
 
   if (!loadfile("/proc/scsi/sg/host_strs", host_strs))
     return false;
@@ -781,12 +779,36 @@ static bool scan_hosts(hwNode & node)
 
 bool scan_scsi(hwNode & n)
 {
-  int i = 0;
+  vector < int >probes;
+  char buffer[20];
 
   scan_devices();
 
-  while (scan_sg(i, n))
-    i++;
+  // query all the sg devices concurrently, then attach them in order
+  while (true)
+  {
+    hwNode device("generic");
+    sg_probe sg;
+
+    snprintf(buffer, sizeof(buffer), SG_X, (int) probes.size());
+    if (!exists(buffer))
+      break;
+
+    device.setLogicalName(buffer);
+    memset(&sg, 0, sizeof(sg));
+    probes.push_back(probe_submit(device, probe_sg, &sg, sizeof(sg)));
+  }
+
+  for (int i = 0; i < probes.size(); i++)
+  {
+    hwNode device("generic");
+    sg_probe sg;
+    probe_status status;
+
+    memset(&sg, 0, sizeof(sg));
+    status = probe_wait(probes[i], device, &sg, sizeof(sg));
+    scan_sg(n, device, status, sg);
+  }
 
   scan_hosts(n);
 
@@ -0,0 +1,1056 @@
+#include "vfs.h"
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <scsi/sg.h>
+#include <pthread.h>
+
+using namespace std;
+
+#define SYSROOT_MAGIC "lshw-sysroot 1"
+
+/*
+ * sysroot archive format: a header line followed by one record per line,
+ * some records being followed by raw binary data.
+ *
+ *   open <errno> <path>
+ *   read <offset> <length> <path>\n<length bytes>
+ *   stat|lstat <errno> <mode> <rdev> <dev> <size> <mtime> <path>
+ *   dir <count> <path>\n<count lines>
+ *   link <errno> <path>\n<target>
+ *   ioctl <request> <result> <errno> <arglen> <datalen> <senselen> <path>\n<bytes>
+ *
+ * paths always come last so that they can contain spaces.
+ */
+
+struct sysroot_stat
+{
+  int error;
+  mode_t mode;
+  dev_t rdev;
+  dev_t dev;
+  off_t size;
+  time_t mtime;
+};
+
+struct sysroot_ioctl
+{
+  unsigned long request;
+  int result;
+  int error;
+  string arg;
+  string data;			// SG_IO: data transferred from the device
+  string sense;			// SG_IO: sense buffer
+};
+
+struct sysroot
+{
+  map < string, int >opens;
+  map < string, map < off_t, string > >extents;
+  map < string, sysroot_stat > stats;
+  map < string, sysroot_stat > lstats;
+  map < string, vector < string > >dirs;
+  map < string, pair < int, string > >links;
+  map < string, deque < sysroot_ioctl > >ioctls;
+
+  void addopen(const string & path, int error);
+  void addextent(const string & path, off_t offset, const char *buf,
+		 size_t count);
+  bool load(const string & archive);
+  bool save(const string & archive) const;
+};
+
+void sysroot::addopen(const string & path,
+		      int error)
+{
+  map < string, int >::iterator i = opens.find(path);
+
+  // a successful open always wins over a failed one
+  if ((i == opens.end()) || (error == 0))
+    opens[path] = error;
+}
+
+void sysroot::addextent(const string & path,
+			off_t offset,
+			const char *buf,
+			size_t count)
+{
+  map < off_t, string > &file = extents[path];
+  map < off_t, string >::iterator i;
+
+  if (count == 0)
+    return;
+
+  i = file.upper_bound(offset);
+  if (i != file.begin())
+  {
+    i--;
+    if (i->first + (off_t) i->second.length() == offset)
+    {
+      i->second.append(buf, count);	// contiguous with the previous read
+      return;
+    }
+    if (i->first + (off_t) i->second.length() >= offset + (off_t) count)
+      return;			// already known
+  }
+
+  file[offset] = string(buf, count);
+}
+
+static bool nextline(const string & s,
+		     size_t & pos,
+		     string & line)
+{
+  size_t end = s.find('\n', pos);
+
+  if (end == string::npos)
+    return false;
+
+  line = s.substr(pos, end - pos);
+  pos = end + 1;
+  return true;
+}
+
+// path is whatever follows the n-th space
+static string lastfield(const string & line,
+			int n)
+{
+  size_t pos = 0;
+
+  while ((n > 0) && (pos != string::npos))
+  {
+    pos = line.find(' ', pos);
+    if (pos != string::npos)
+      pos++;
+    n--;
+  }
+
+  if (pos == string::npos)
+    return "";
+  return line.substr(pos);
+}
+
+static bool getdata(const string & s,
+		    size_t & pos,
+		    size_t len,
+		    string & data)
+{
+  if (pos + len > s.length())
+    return false;
+
+  data = s.substr(pos, len);
+  pos += len;
+  return true;
+}
+
+bool sysroot::load(const string & archive)
+{
+  string content = "";
+  string line = "";
+  char buffer[4096];
+  size_t count = 0;
+  size_t pos = 0;
+  FILE *in = fopen(archive.c_str(), "r");
+
+  if (!in)
+    return false;
+
+  while ((count = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    content.append(buffer, count);
+  fclose(in);
+
+  if (!nextline(content, pos, line) || (line != SYSROOT_MAGIC))
+    return false;
+
+  while (nextline(content, pos, line))
+  {
+    char tag[10];
+
+    if (sscanf(line.c_str(), "%9s", tag) != 1)
+      return false;
+
+    if (strcmp(tag, "open") == 0)
+    {
+      int error = 0;
+
+      if (sscanf(line.c_str(), "%*s %d", &error) != 1)
+	return false;
+      addopen(lastfield(line, 2), error);
+    }
+    else if (strcmp(tag, "read") == 0)
+    {
+      long long offset = 0;
+      unsigned long length = 0;
+      string data = "";
+
+      if (sscanf(line.c_str(), "%*s %lld %lu", &offset, &length) != 2)
+	return false;
+      if (!getdata(content, pos, length, data))
+	return false;
+      extents[lastfield(line, 3)][offset] = data;
+      pos++;			// skip trailing newline
+    }
+    else if ((strcmp(tag, "stat") == 0) || (strcmp(tag, "lstat") == 0))
+    {
+      sysroot_stat st;
+      unsigned long mode = 0;
+      unsigned long long rdev = 0, dev = 0;
+      long long size = 0, mtime = 0;
+
+      if (sscanf(line.c_str(), "%*s %d %lo %llx %llx %lld %lld",
+		 &st.error, &mode, &rdev, &dev, &size, &mtime) != 6)
+	return false;
+      st.mode = mode;
+      st.rdev = rdev;
+      st.dev = dev;
+      st.size = size;
+      st.mtime = mtime;
+
+      if (tag[0] == 'l')
+	lstats[lastfield(line, 7)] = st;
+      else
+	stats[lastfield(line, 7)] = st;
+    }
+    else if (strcmp(tag, "dir") == 0)
+    {
+      int n = 0;
+      string entry = "";
+      vector < string > &entries = dirs[lastfield(line, 2)];
+
+      if (sscanf(line.c_str(), "%*s %d", &n) != 1)
+	return false;
+      for (int i = 0; i < n; i++)
+      {
+	if (!nextline(content, pos, entry))
+	  return false;
+	entries.push_back(entry);
+      }
+    }
+    else if (strcmp(tag, "link") == 0)
+    {
+      int error = 0;
+      string target = "";
+
+      if (sscanf(line.c_str(), "%*s %d", &error) != 1)
+	return false;
+      if (!nextline(content, pos, target))
+	return false;
+      links[lastfield(line, 2)] = make_pair(error, target);
+    }
+    else if (strcmp(tag, "ioctl") == 0)
+    {
+      sysroot_ioctl ctl;
+      unsigned long arglen = 0, datalen = 0, senselen = 0;
+
+      if (sscanf(line.c_str(), "%*s %lx %d %d %lu %lu %lu",
+		 &ctl.request, &ctl.result, &ctl.error,
+		 &arglen, &datalen, &senselen) != 6)
+	return false;
+      if (!getdata(content, pos, arglen, ctl.arg) ||
+	  !getdata(content, pos, datalen, ctl.data) ||
+	  !getdata(content, pos, senselen, ctl.sense))
+	return false;
+      ioctls[lastfield(line, 7)].push_back(ctl);
+      pos++;			// skip trailing newline
+    }
+    else
+      return false;
+  }
+
+  return true;
+}
+
+static void savestats(FILE * out,
+		      const char *tag,
+		      const map < string, sysroot_stat > &stats)
+{
+  for (map < string, sysroot_stat >::const_iterator i = stats.begin();
+       i != stats.end(); i++)
+    fprintf(out, "%s %d %lo %llx %llx %lld %lld %s\n", tag,
+	    i->second.error,
+	    (unsigned long) i->second.mode,
+	    (unsigned long long) i->second.rdev,
+	    (unsigned long long) i->second.dev,
+	    (long long) i->second.size,
+	    (long long) i->second.mtime, i->first.c_str());
+}
+
+bool sysroot::save(const string & archive) const
+{
+  FILE *out = fopen(archive.c_str(), "w");
+
+  if (!out)
+    return false;
+
+  fprintf(out, "%s\n", SYSROOT_MAGIC);
+
+  for (map < string, int >::const_iterator i = opens.begin();
+       i != opens.end(); i++)
+    fprintf(out, "open %d %s\n", i->second, i->first.c_str());
+
+  for (map < string, map < off_t, string > >::const_iterator i =
+       extents.begin(); i != extents.end(); i++)
+    for (map < off_t, string >::const_iterator j = i->second.begin();
+	 j != i->second.end(); j++)
+    {
+      fprintf(out, "read %lld %lu %s\n", (long long) j->first,
+	      (unsigned long) j->second.length(), i->first.c_str());
+      fwrite(j->second.data(), 1, j->second.length(), out);
+      fprintf(out, "\n");
+    }
+
+  savestats(out, "stat", stats);
+  savestats(out, "lstat", lstats);
+
+  for (map < string, vector < string > >::const_iterator i = dirs.begin();
+       i != dirs.end(); i++)
+  {
+    fprintf(out, "dir %lu %s\n", (unsigned long) i->second.size(),
+	    i->first.c_str());
+    for (unsigned int j = 0; j < i->second.size(); j++)
+      fprintf(out, "%s\n", i->second[j].c_str());
+  }
+
+  for (map < string, pair < int, string > >::const_iterator i =
+       links.begin(); i != links.end(); i++)
+    fprintf(out, "link %d %s\n%s\n", i->second.first, i->first.c_str(),
+	    i->second.second.c_str());
+
+  for (map < string, deque < sysroot_ioctl > >::const_iterator i =
+       ioctls.begin(); i != ioctls.end(); i++)
+    for (deque < sysroot_ioctl >::const_iterator j = i->second.begin();
+	 j != i->second.end(); j++)
+    {
+      fprintf(out, "ioctl %lx %d %d %lu %lu %lu %s\n", j->request,
+	      j->result, j->error, (unsigned long) j->arg.length(),
+	      (unsigned long) j->data.length(),
+	      (unsigned long) j->sense.length(), i->first.c_str());
+      fwrite(j->arg.data(), 1, j->arg.length(), out);
+      fwrite(j->data.data(), 1, j->data.length(), out);
+      fwrite(j->sense.data(), 1, j->sense.length(), out);
+      fprintf(out, "\n");
+    }
+
+  return fclose(out) == 0;
+}
+
+static sysroot_stat tosysroot(int result,
+			      const struct stat *buf)
+{
+  sysroot_stat st;
+
+  memset(&st, 0, sizeof(st));
+  if (result != 0)
+  {
+    st.error = errno;
+    return st;
+  }
+
+  st.mode = buf->st_mode;
+  st.rdev = buf->st_rdev;
+  st.dev = buf->st_dev;
+  st.size = buf->st_size;
+  st.mtime = buf->st_mtime;
+
+  return st;
+}
+
+static int fromsysroot(const map < string, sysroot_stat > &stats,
+		       const string & path,
+		       struct stat *buf)
+{
+  map < string, sysroot_stat >::const_iterator i = stats.find(path);
+
+  if (i == stats.end())
+  {
+    errno = ENOENT;
+    return -1;
+  }
+  if (i->second.error != 0)
+  {
+    errno = i->second.error;
+    return -1;
+  }
+
+  memset(buf, 0, sizeof(*buf));
+  buf->st_mode = i->second.mode;
+  buf->st_rdev = i->second.rdev;
+  buf->st_dev = i->second.dev;
+  buf->st_size = i->second.size;
+  buf->st_mtime = i->second.mtime;
+
+  return 0;
+}
+
+/*
+ * probes run concurrently (see probe.h): the recorder and the replayer
+ * protect their bookkeeping with this lock, but never hold it while
+ * waiting for the system
+ */
+static pthread_mutex_t vfs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+class vfs_lock
+{
+  public:
+  vfs_lock()
+  {
+    pthread_mutex_lock(&vfs_mutex);
+  }
+
+  ~vfs_lock()
+  {
+    pthread_mutex_unlock(&vfs_mutex);
+  }
+};
+
+static string devpath(dev_t device,
+		      mode_t type)
+{
+  char buffer[50];
+
+  snprintf(buffer, sizeof(buffer), "/dev/%s/%u:%u",
+	   S_ISBLK(type) ? "block" : "char", major(device), minor(device));
+
+  return string(buffer);
+}
+
+class vfs_backend
+{
+  public:
+  virtual ~ vfs_backend()
+  {
+  }
+
+  virtual int open(const string & path,
+		   int flags)
+  {
+    return::open(path.c_str(), flags);
+  }
+
+  virtual int opendev(dev_t device,
+		      mode_t type)
+  {
+    static const char *paths[] = {
+      "/var/lib/pcmcia", "/var/run", "/dev", "/tmp", NULL
+    };
+    int fd = ::open(devpath(device, type).c_str(), O_RDONLY);
+
+    if (fd >= 0)
+      return fd;
+
+    // no /dev/char or /dev/block: create a temporary device node
+    for (int i = 0; paths[i]; i++)
+    {
+      char fn[64];
+
+      snprintf(fn, sizeof(fn), "%s/ci-%d", paths[i], getpid());
+      if (mknod(fn, (type | S_IREAD), device) == 0)
+      {
+	fd = ::open(fn, O_RDONLY);
+	unlink(fn);
+	if (fd >= 0)
+	  return fd;
+      }
+    }
+
+    return -1;
+  }
+
+  virtual ssize_t read(int fd,
+		       void *buf,
+		       size_t count)
+  {
+    return::read(fd, buf, count);
+  }
+
+  virtual off_t lseek(int fd,
+		      off_t offset,
+		      int whence)
+  {
+    return::lseek(fd, offset, whence);
+  }
+
+  virtual int ioctl(int fd,
+		    unsigned long request,
+		    void *arg,
+		    size_t len)
+  {
+    return::ioctl(fd, request, arg);
+  }
+
+  virtual int close(int fd)
+  {
+    return::close(fd);
+  }
+
+  virtual int stat(const string & path,
+		   struct stat *buf)
+  {
+    return::stat(path.c_str(), buf);
+  }
+
+  virtual int lstat(const string & path,
+		    struct stat *buf)
+  {
+    return::lstat(path.c_str(), buf);
+  }
+
+  virtual int readlink(const string & path,
+		       string & target)
+  {
+    char buffer[PATH_MAX];
+    ssize_t len = ::readlink(path.c_str(), buffer, sizeof(buffer));
+
+    target = "";
+    if ((len < 0) || (len >= (ssize_t) sizeof(buffer)))
+      return -1;
+
+    target = string(buffer, len);
+    return 0;
+  }
+
+  virtual int scandir(const string & path,
+		      vector < string > &entries)
+  {
+    DIR *dir = opendir(path.c_str());
+    struct dirent *entry = NULL;
+
+    entries.clear();
+    if (!dir)
+      return -1;
+
+    while ((entry = readdir(dir)))
+      if ((strcmp(entry->d_name, ".") != 0)
+	  && (strcmp(entry->d_name, "..") != 0))
+	entries.push_back(entry->d_name);
+    closedir(dir);
+
+    sort(entries.begin(), entries.end());
+
+    return entries.size();
+  }
+
+  virtual bool finish()
+  {
+    return true;
+  }
+};
+
+/*
+ * the recorder accesses the real system and remembers everything it sees
+ */
+class vfs_recorder:public vfs_backend
+{
+  public:
+  vfs_recorder(const string & archive):archive(archive)
+  {
+  }
+
+  virtual int open(const string & path,
+		   int flags)
+  {
+    int fd = vfs_backend::open(path, flags);
+    vfs_lock lock;
+
+    data.addopen(path, (fd < 0) ? errno : 0);
+    if (fd >= 0)
+      files[fd] = path;
+
+    return fd;
+  }
+
+  virtual int opendev(dev_t device,
+		      mode_t type)
+  {
+    int fd = vfs_backend::opendev(device, type);
+    vfs_lock lock;
+
+    data.addopen(devpath(device, type), (fd < 0) ? errno : 0);
+    if (fd >= 0)
+      files[fd] = devpath(device, type);
+
+    return fd;
+  }
+
+  virtual ssize_t read(int fd,
+		       void *buf,
+		       size_t count)
+  {
+    off_t offset = vfs_backend::lseek(fd, 0, SEEK_CUR);
+    ssize_t result = vfs_backend::read(fd, buf, count);
+    vfs_lock lock;
+
+    if ((result > 0) && (offset >= 0) && (files.find(fd) != files.end()))
+      data.addextent(files[fd], offset, (const char *) buf, result);
+
+    return result;
+  }
+
+  virtual int ioctl(int fd,
+		    unsigned long request,
+		    void *arg,
+		    size_t len)
+  {
+    sysroot_ioctl ctl;
+    int result = vfs_backend::ioctl(fd, request, arg, len);
+
+    ctl.request = request;
+    ctl.result = result;
+    ctl.error = (result < 0) ? errno : 0;
+    if (arg && len)
+      ctl.arg = string((const char *) arg, len);
+
+    if ((request == SG_IO) && arg && (result >= 0))
+    {
+      sg_io_hdr_t *hdr = (sg_io_hdr_t *) arg;
+
+      if ((hdr->dxfer_direction == SG_DXFER_FROM_DEV) && hdr->dxferp)
+	ctl.data =
+	  string((const char *) hdr->dxferp, hdr->dxfer_len - hdr->resid);
+      if (hdr->sbp)
+	ctl.sense = string((const char *) hdr->sbp, hdr->sb_len_wr);
+    }
+
+    {
+      vfs_lock lock;
+
+      if (files.find(fd) != files.end())
+	data.ioctls[files[fd]].push_back(ctl);
+    }
+
+    if (result < 0)
+      errno = ctl.error;
+    return result;
+  }
+
+  virtual int close(int fd)
+  {
+    {
+      vfs_lock lock;
+
+      files.erase(fd);
+    }
+    return vfs_backend::close(fd);
+  }
+
+  virtual int stat(const string & path,
+		   struct stat *buf)
+  {
+    int result = vfs_backend::stat(path, buf);
+    vfs_lock lock;
+
+    if (data.stats.find(path) == data.stats.end())
+      data.stats[path] = tosysroot(result, buf);
+
+    return result;
+  }
+
+  virtual int lstat(const string & path,
+		    struct stat *buf)
+  {
+    int result = vfs_backend::lstat(path, buf);
+    vfs_lock lock;
+
+    if (data.lstats.find(path) == data.lstats.end())
+      data.lstats[path] = tosysroot(result, buf);
+
+    return result;
+  }
+
+  virtual int readlink(const string & path,
+		       string & target)
+  {
+    int result = vfs_backend::readlink(path, target);
+    vfs_lock lock;
+
+    data.links[path] = make_pair((result < 0) ? errno : 0, target);
+
+    return result;
+  }
+
+  virtual int scandir(const string & path,
+		      vector < string > &entries)
+  {
+    int result = vfs_backend::scandir(path, entries);
+    vfs_lock lock;
+
+    if (result >= 0)
+      data.dirs[path] = entries;
+
+    return result;
+  }
+
+  virtual bool finish()
+  {
+    vfs_lock lock;
+
+    return data.save(archive);
+  }
+
+  private:
+  string archive;
+  sysroot data;
+  map < int, string > files;
+};
+
+/*
+ * the replayer never touches the real system: everything is served from a
+ * previously recorded archive
+ */
+class vfs_replayer:public vfs_backend
+{
+  public:
+  vfs_replayer():nextfd(1000)
+  {
+  }
+
+  bool load(const string & archive)
+  {
+    return data.load(archive);
+  }
+
+  virtual int open(const string & path,
+		   int flags)
+  {
+    vfs_lock lock;
+    map < string, int >::iterator i = data.opens.find(path);
+
+    if ((i == data.opens.end()) && (data.extents.find(path) == data.extents.end()))
+    {
+      errno = ENOENT;
+      return -1;
+    }
+    if ((i != data.opens.end()) && (i->second != 0))
+    {
+      errno = i->second;
+      return -1;
+    }
+
+    files[nextfd].path = path;
+    files[nextfd].offset = 0;
+    return nextfd++;
+  }
+
+  virtual int opendev(dev_t device,
+		      mode_t type)
+  {
+    return open(devpath(device, type), O_RDONLY);
+  }
+
+  virtual ssize_t read(int fd,
+		       void *buf,
+		       size_t count)
+  {
+    vfs_lock lock;
+    map < int, openfile >::iterator f = files.find(fd);
+
+    if (f == files.end())
+    {
+      errno = EBADF;
+      return -1;
+    }
+
+    map < off_t, string > &file = data.extents[f->second.path];
+    map < off_t, string >::iterator i = file.upper_bound(f->second.offset);
+
+    if (i == file.begin())
+      return 0;
+    i--;
+
+    off_t skip = f->second.offset - i->first;
+    if (skip >= (off_t) i->second.length())
+      return 0;
+
+    if (count > i->second.length() - skip)
+      count = i->second.length() - skip;
+    memcpy(buf, i->second.data() + skip, count);
+    f->second.offset += count;
+
+    return count;
+  }
+
+  virtual off_t lseek(int fd,
+		      off_t offset,
+		      int whence)
+  {
+    vfs_lock lock;
+    map < int, openfile >::iterator f = files.find(fd);
+
+    if (f == files.end())
+    {
+      errno = EBADF;
+      return -1;
+    }
+
+    switch (whence)
+    {
+    case SEEK_SET:
+      f->second.offset = offset;
+      break;
+    case SEEK_CUR:
+      f->second.offset += offset;
+      break;
+    case SEEK_END:
+      {
+	map < off_t, string > &file = data.extents[f->second.path];
+
+	if (file.empty())
+	  f->second.offset = offset;
+	else
+	  f->second.offset =
+	    file.rbegin()->first + file.rbegin()->second.length() + offset;
+      }
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+    }
+
+    return f->second.offset;
+  }
+
+  virtual int ioctl(int fd,
+		    unsigned long request,
+		    void *arg,
+		    size_t len)
+  {
+    vfs_lock lock;
+    map < int, openfile >::iterator f = files.find(fd);
+
+    if (f == files.end())
+    {
+      errno = EBADF;
+      return -1;
+    }
+
+    deque < sysroot_ioctl > &replies = data.ioctls[f->second.path];
+    for (deque < sysroot_ioctl >::iterator i = replies.begin();
+	 i != replies.end(); i++)
+      if (i->request == request)
+      {
+	sysroot_ioctl ctl = *i;
+
+	replies.erase(i);
+
+	if (request == SG_IO)
+	{
+	  sg_io_hdr_t *hdr = (sg_io_hdr_t *) arg;
+	  sg_io_hdr_t saved = *hdr;	// keep our own buffer pointers
+
+	  memcpy(arg, ctl.arg.data(), min(len, ctl.arg.length()));
+	  hdr->dxferp = saved.dxferp;
+	  hdr->cmdp = saved.cmdp;
+	  hdr->sbp = saved.sbp;
+	  hdr->usr_ptr = saved.usr_ptr;
+	  if (hdr->dxferp)
+	    memcpy(hdr->dxferp, ctl.data.data(),
+		   min((size_t) saved.dxfer_len, ctl.data.length()));
+	  if (hdr->sbp)
+	    memcpy(hdr->sbp, ctl.sense.data(),
+		   min((size_t) saved.mx_sb_len, ctl.sense.length()));
+	}
+	else if (arg && len)
+	  memcpy(arg, ctl.arg.data(), min(len, ctl.arg.length()));
+
+	if (ctl.result < 0)
+	  errno = ctl.error;
+	return ctl.result;
+      }
+
+    errno = ENOTTY;
+    return -1;
+  }
+
+  virtual int close(int fd)
+  {
+    vfs_lock lock;
+
+    if (files.erase(fd) == 0)
+    {
+      errno = EBADF;
+      return -1;
+    }
+    return 0;
+  }
+
+  virtual int stat(const string & path,
+		   struct stat *buf)
+  {
+    vfs_lock lock;
+
+    return fromsysroot(data.stats, path, buf);
+  }
+
+  virtual int lstat(const string & path,
+		    struct stat *buf)
+  {
+    vfs_lock lock;
+
+    return fromsysroot(data.lstats, path, buf);
+  }
+
+  virtual int readlink(const string & path,
+		       string & target)
+  {
+    vfs_lock lock;
+    map < string, pair < int, string > >::iterator i = data.links.find(path);
+
+    target = "";
+    if (i == data.links.end())
+    {
+      errno = ENOENT;
+      return -1;
+    }
+    if (i->second.first != 0)
+    {
+      errno = i->second.first;
+      return -1;
+    }
+
+    target = i->second.second;
+    return 0;
+  }
+
+  virtual int scandir(const string & path,
+		      vector < string > &entries)
+  {
+    vfs_lock lock;
+    map < string, vector < string > >::iterator i = data.dirs.find(path);
+
+    entries.clear();
+    if (i == data.dirs.end())
+    {
+      errno = ENOENT;
+      return -1;
+    }
+
+    entries = i->second;
+    return entries.size();
+  }
+
+  private:
+  struct openfile
+  {
+    string path;
+    off_t offset;
+  };
+
+  sysroot data;
+  map < int, openfile > files;
+  int nextfd;
+};
+
+static vfs_backend native;
+static vfs_backend *backend = &native;
+static bool replaying = false;
+
+bool vfs_record(const string & archive)
+{
+  FILE *out = fopen(archive.c_str(), "w");	// fail early
+
+  if (!out)
+    return false;
+  fclose(out);
+
+  backend = new vfs_recorder(archive);
+  return true;
+}
+
+bool vfs_replay(const string & archive)
+{
+  vfs_replayer *replayer = new vfs_replayer();
+
+  if (!replayer->load(archive))
+  {
+    delete replayer;
+    return false;
+  }
+
+  backend = replayer;
+  replaying = true;
+  return true;
+}
+
+bool vfs_replaying()
+{
+  return replaying;
+}
+
+bool vfs_finish()
+{
+  return backend->finish();
+}
+
+int vfs_open(const string & path,
+	     int flags)
+{
+  return backend->open(path, flags);
+}
+
+int vfs_opendev(dev_t device,
+		mode_t type)
+{
+  return backend->opendev(device, type);
+}
+
+ssize_t vfs_read(int fd,
+		 void *buf,
+		 size_t count)
+{
+  return backend->read(fd, buf, count);
+}
+
+off_t vfs_lseek(int fd,
+		off_t offset,
+		int whence)
+{
+  return backend->lseek(fd, offset, whence);
+}
+
+int vfs_ioctl(int fd,
+	      unsigned long request,
+	      void *arg,
+	      size_t len)
+{
+  return backend->ioctl(fd, request, arg, len);
+}
+
+int vfs_close(int fd)
+{
+  return backend->close(fd);
+}
+
+int vfs_stat(const string & path,
+	     struct stat *buf)
+{
+  return backend->stat(path, buf);
+}
+
+int vfs_lstat(const string & path,
+	      struct stat *buf)
+{
+  return backend->lstat(path, buf);
+}
+
+int vfs_readlink(const string & path,
+		 string & target)
+{
+  return backend->readlink(path, target);
+}
+
+int vfs_scandir(const string & path,
+		vector < string > &entries)
+{
+  return backend->scandir(path, entries);
+}
+
+static char *id = "@(#) $Id$";
@@ -0,0 +1,33 @@
+#ifndef _VFS_H_
+#define _VFS_H_
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * every access to kernel-provided files, directories and device nodes goes
+ * through these functions instead of the raw system calls so that a run can
+ * be recorded to a sysroot archive and replayed later, on any machine and
+ * without the original hardware
+ */
+
+bool vfs_record(const std::string & archive);
+bool vfs_replay(const std::string & archive);
+bool vfs_replaying();
+bool vfs_finish();
+
+int vfs_open(const std::string & path, int flags);
+int vfs_opendev(dev_t device, mode_t type = S_IFCHR);
+ssize_t vfs_read(int fd, void *buf, size_t count);
+off_t vfs_lseek(int fd, off_t offset, int whence);
+int vfs_ioctl(int fd, unsigned long request, void *arg = NULL, size_t len = 0);
+int vfs_close(int fd);
+
+int vfs_stat(const std::string & path, struct stat *buf);
+int vfs_lstat(const std::string & path, struct stat *buf);
+int vfs_readlink(const std::string & path, std::string & target);
+int vfs_scandir(const std::string & path, std::vector < std::string > &entries);
+
+#endif